@@ -0,0 +1,63 @@
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#include "lispy.h"
+
+/*
+ * Ahead-of-time compilation benchmark.
+ *
+ * Runs stdlib.lsp and bench/aot.lsp twice, each time in a fresh global
+ * environment: once by loading the files, which parses them and walks
+ * every function body, and once through the C lispyc generated from
+ * them, linked in as bench/aot_lsp.c. Run from the top of the tree.
+ */
+
+lval* lispyc_load(lenv* e);
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void load(lenv* e, char* file) {
+  lval* x = builtin_load(e, lval_add(lval_sexpr(), lval_str(file)));
+  if (LTYPE(x) == LVAL_ERR) {
+    lval_println(x);
+  }
+  lval_del(x);
+}
+
+/* prints the value of a function from the workload, to show both agree */
+static void check(lenv* e) {
+  lval* x = lval_add(lval_add(lval_sexpr(), lval_sym("squares")), lval_int(10));
+  x = lval_add(lval_add(lval_sexpr(), lval_sym("sum")), x);
+  lval_println(lval_eval(e, x));
+}
+
+int main(int argc, char** argv) {
+  lval_read_init();
+
+  lenv* e = lenv_new();
+  gc_push_env(e);
+  lenv_add_builtins(e);
+  double start = now();
+  load(e, "stdlib.lsp");
+  load(e, "bench/aot.lsp");
+  double loaded = now() - start;
+  printf("%-10s %8.1f ms  ", "load", loaded * 1000);
+  check(e);
+  gc_pop(1);
+  lenv_del(e);
+
+  e = lenv_new();
+  gc_push_env(e);
+  lenv_add_builtins(e);
+  start = now();
+  lval_del(lispyc_load(e));
+  double compiled = now() - start;
+  printf("%-10s %8.1f ms  ", "lispyc", compiled * 1000);
+  check(e);
+
+  printf("speedup    %8.2fx\n", loaded / compiled);
+  return 0;
+}
@@ -0,0 +1,12 @@
+; Workload for bench/aot: recursion, arithmetic and the list functions
+(fun {fibi n} {if (< n 2) {n} {+ (fibi (- n 1)) (fibi (- n 2))}})
+(fun {count n acc} {if (== n 0) {acc} {count (- n 1) (+ acc 1)}})
+(fun {range a b} {if (>= a b) {nil} {join (list a) (range (+ a 1) b)}})
+(fun {squares n} {map (\ {x} {* x x}) (range 0 n)})
+
+(fibi 22)
+(count 200000 0)
+(sum (squares 500))
+(len (filter (\ {x} {== (% x 3) 0}) (range 0 500)))
+(reverse (range 0 300))
+(fib 15)
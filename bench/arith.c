@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#include "lispy.h"
+
+/*
+ * Arithmetic builtin benchmark.
+ *
+ * Times calls to the arithmetic builtins for the common argument shapes
+ * against a copy of the old shared builtin, which compared the operator
+ * name with strcmp for every argument pair. Each call is passed another
+ * reference to the same argument list so only the arithmetic is timed.
+ */
+
+#define CALLS 5000000
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * The old builtin. It was shared by every operator, so keep it out of
+ * line where the comparisons with op cannot fold away.
+ */
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+static lval* op_strcmp(lenv* e, lval* a, char* op) {
+  /* all arguments must be numbers */
+  for (int i = 0; i < a->count; i++) {
+    LASSERT(a, ltype_numeric(LTYPE(a->cell[i])),
+	    "Function %s passed incorrect type for argument %i",
+	    op, i);
+  }
+
+  /* accumulate in locals so no intermediate values are allocated */
+  lval* x = a->cell[0];
+  int is_float = LTYPE(x) == LVAL_FLOAT;
+  long num = is_float ? 0 : LNUM(x);
+  double fnum = is_float ? x->fnum : 0.0;
+
+  if ((strcmp(op, "-") == 0) && a->count == 1) {
+    num = -num;
+    fnum = -fnum;
+  }
+
+  for (int i = 1; i < a->count; i++) {
+    lval* y = a->cell[i];
+    if (!is_float && LTYPE(y) == LVAL_FLOAT) {
+      /* We must convert to the same type. Since one is a float, the end result
+       * must be a float as well.
+       */
+      is_float = 1;
+      fnum = (double) num;
+    }
+    double yf = LTYPE(y) == LVAL_FLOAT ? y->fnum : (double) LNUM(y);
+    if (strcmp(op, "+") == 0) {
+      if (is_float) {
+        fnum += yf;
+      } else {
+        num += LNUM(y);
+      }
+    }
+    if (strcmp(op, "-") == 0) {
+      if (is_float) {
+        fnum -= yf;
+      } else {
+        num -= LNUM(y);
+      }
+    }
+    if (strcmp(op, "*") == 0) {
+      if (is_float) {
+        fnum *= yf;
+      } else {
+        num *= LNUM(y);
+      }
+    }
+    if (strcmp(op, "/") == 0) {
+      if (yf == 0.0) {
+        lval_del(a);
+        return lval_err("Division by zero");
+      }
+      if (is_float) {
+        fnum /= yf;
+      } else {
+        num /= LNUM(y);
+      }
+    }
+    if (strcmp(op, "%") == 0) {
+      if (yf == 0.0) {
+        lval_del(a);
+        return lval_err("Division by zero");
+      }
+      if (is_float) {
+        lval_del(a);
+        return lval_err("Cannot perform floating point modulus");
+      }
+      num %= LNUM(y);
+    }
+  }
+  lval_del(a);
+  return is_float ? lval_float(fnum) : lval_int(num);
+}
+
+static lval* mul_strcmp(lenv* e, lval* a) {
+  return op_strcmp(e, a, "*");
+}
+
+/* average nanoseconds per call of f on args, adding results to sum */
+static double time_op(lbuiltin f, lval* args, double* sum) {
+  double start = now();
+  for (int i = 0; i < CALLS; i++) {
+    lval* r = f(NULL, lval_ref(args));
+    *sum += LTYPE(r) == LVAL_FLOAT ? r->fnum : (double) LNUM(r);
+    lval_del(r);
+  }
+  return (now() - start) * 1e9 / CALLS;
+}
+
+static lval* args_of(int n, int floats_from) {
+  lval* a = lval_sexpr();
+  for (int i = 0; i < n; i++) {
+    a = lval_add(a, i >= floats_from ? lval_float(1.0 + i) : lval_int(1 + i));
+  }
+  return a;
+}
+
+int main(int argc, char** argv) {
+  struct { char* name; lval* args; } shapes[] = {
+    { "2 integers", args_of(2, 2) },
+    { "2 floats", args_of(2, 0) },
+    { "8 integers", args_of(8, 8) },
+    { "8 mixed", args_of(8, 4) },
+  };
+
+  /* the sums keep the calls from being optimized away, and must agree */
+  printf("%-12s %10s %10s\n", "(* ...)", "strcmp", "special");
+  for (int i = 0; i < 4; i++) {
+    double sums[2] = { 0, 0 };
+    double old = time_op(mul_strcmp, shapes[i].args, &sums[0]);
+    double new = time_op(builtin_mul, shapes[i].args, &sums[1]);
+    printf("%-12s %7.2f ns %7.2f ns\n", shapes[i].name, old, new);
+    if (sums[0] != sums[1]) {
+      printf("results disagree\n");
+      return 1;
+    }
+    lval_del(shapes[i].args);
+  }
+  return 0;
+}
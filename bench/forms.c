@@ -0,0 +1,130 @@
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#include "lispy.h"
+
+/*
+ * Special form dispatch benchmark.
+ *
+ * Before evaluating each cell of an S-Expression the evaluator checks
+ * whether it names a special form, which limits how many cells are
+ * evaluated. This times that check over every cell of stdlib.lsp done
+ * three ways: comparing the name against each form with strcmp, as the
+ * evaluator once did, comparing interned pointers against each form,
+ * and switching on the form tag as lval_eval_count does. Run from the
+ * top of the tree.
+ */
+
+#define ROUNDS 2000
+
+static char* sym_defmacro;
+static char* sym_do;
+static char* sym_if;
+static char* sym_read;
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int count_strcmp(lval* c, int count) {
+  if (LTYPE(c) == LVAL_SYM) {
+    if (strcmp(c->sym, "defmacro") == 0) {
+      count = 1;
+    }
+    if (strcmp(c->sym, "read") == 0) {
+      count = 1;
+    }
+    if (strcmp(c->sym, "do") == 0) {
+      count = 1;
+    }
+    if (strcmp(c->sym, "if") == 0) {
+      count = 2;
+    }
+  }
+  return count;
+}
+
+static int count_pointer(lval* c, int count) {
+  if (LTYPE(c) == LVAL_SYM) {
+    if (c->sym == sym_defmacro) {
+      count = 1;
+    }
+    if (c->sym == sym_read) {
+      count = 1;
+    }
+    if (c->sym == sym_do) {
+      count = 1;
+    }
+    if (c->sym == sym_if) {
+      count = 2;
+    }
+  }
+  return count;
+}
+
+/* lval_eval_count with no environment, every cell taken for a head */
+static int count_form(lval* c, int count) {
+  return lval_eval_count(NULL, c, 0, count);
+}
+
+/* appends every cell under v to cells */
+static void collect(lval* v, lval** cells, int* n, int cap) {
+  for (int i = 0; i < v->count && *n < cap; i++) {
+    cells[(*n)++] = v->cell[i];
+    if (ltype_expr(LTYPE(v->cell[i]))) {
+      collect(v->cell[i], cells, n, cap);
+    }
+  }
+}
+
+/* average nanoseconds to check one cell with count */
+static double time_check(int (*count)(lval*, int), lval** cells, int n,
+                         long* sum) {
+  double start = now();
+  for (int r = 0; r < ROUNDS; r++) {
+    for (int i = 0; i < n; i++) {
+      *sum += count(cells[i], n);
+    }
+  }
+  return (now() - start) * 1e9 / ((double) ROUNDS * n);
+}
+
+int main(int argc, char** argv) {
+  lval_read_init();
+  sym_defmacro = lsym_intern("defmacro");
+  sym_do = lsym_intern("do");
+  sym_if = lsym_intern("if");
+  sym_read = lsym_intern("read");
+
+  mpc_result_t r;
+  if (!mpc_parse_contents("stdlib.lsp", Lispy, &r)) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    return 1;
+  }
+  lval* code = lval_read(r.output);
+  mpc_ast_delete(r.output);
+
+  static lval* cells[1 << 16];
+  int n = 0;
+  collect(code, cells, &n, 1 << 16);
+
+  /* the sums keep the checks from being optimized away, and must agree */
+  long sums[3] = { 0, 0, 0 };
+  printf("%i cells\n", n);
+  printf("%-16s %6.2f ns/cell\n", "strcmp",
+         time_check(count_strcmp, cells, n, &sums[0]));
+  printf("%-16s %6.2f ns/cell\n", "interned names",
+         time_check(count_pointer, cells, n, &sums[1]));
+  printf("%-16s %6.2f ns/cell\n", "form tag",
+         time_check(count_form, cells, n, &sums[2]));
+  if (sums[0] != sums[1] || sums[1] != sums[2]) {
+    printf("checks disagree\n");
+    return 1;
+  }
+
+  lval_del(code);
+  lval_read_cleanup();
+  return 0;
+}
@@ -0,0 +1,72 @@
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#include "lispy.h"
+
+/*
+ * Global lookup benchmark.
+ *
+ * Fills the global environment with the builtins plus an increasing
+ * number of extra definitions, then times lenv_get on a builtin and on
+ * the most recent definition, both directly and from inside a function
+ * frame. With hashed environments the cost per lookup should not grow
+ * with the number of globals.
+ */
+
+#define LOOKUPS 10000000
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* average nanoseconds per lenv_get of k in e */
+static double time_lookup(lenv* e, lval* k) {
+  double start = now();
+  for (int i = 0; i < LOOKUPS; i++) {
+    lval_del(lenv_get(e, k));
+  }
+  return (now() - start) * 1e9 / LOOKUPS;
+}
+
+int main(int argc, char** argv) {
+  int sizes[] = { 0, 100, 1000, 10000, 100000 };
+  printf("%8s %12s %12s %12s\n", "globals", "builtin", "newest", "from frame");
+
+  for (int s = 0; s < 5; s++) {
+    lenv* e = lenv_new();
+    lenv_add_builtins(e);
+
+    char name[32];
+    lval* v = lval_int(0);
+    for (int i = 0; i < sizes[s]; i++) {
+      sprintf(name, "global-%i", i);
+      lval* k = lval_sym(name);
+      lenv_put(e, k, v);
+      lval_del(k);
+    }
+    lval_del(v);
+
+    /* a function frame binding two arguments, as lval_call builds */
+    lenv* frame = lenv_new();
+    frame->par = e;
+    lval* x = lval_sym("x");
+    lval* l = lval_sym("l");
+    lenv_put(frame, x, x);
+    lenv_put(frame, l, l);
+
+    lval* builtin = lval_sym("+");
+    lval* newest = lval_sym(sizes[s] ? name : "load");
+    printf("%8i %9.1f ns %9.1f ns %9.1f ns\n", sizes[s],
+           time_lookup(e, builtin), time_lookup(e, newest),
+           time_lookup(frame, builtin));
+
+    lval_del(x);
+    lval_del(l);
+    lval_del(builtin);
+    lval_del(newest);
+    lenv_del(frame);
+    lenv_del(e);
+  }
+  return 0;
+}
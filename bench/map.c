@@ -0,0 +1,107 @@
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#include "lispy.h"
+
+/*
+ * Hash map benchmark.
+ *
+ * Builds tables of an increasing number of string keys and times
+ * map-put, map-get and map-del on them, against finding a key in a
+ * Q-Expression of {key value} pairs by comparing each pair in turn, as
+ * the stdlib's elem does. A put or get on a map should not get slower
+ * as it grows.
+ */
+
+#define OPS 1000000
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static lval* call2(lbuiltin f, lval* x, lval* y) {
+  return f(NULL, lval_add(lval_add(lval_sexpr(), x), y));
+}
+
+static lval* key(int i) {
+  char name[32];
+  sprintf(name, "key-%i", i);
+  return lval_str(name);
+}
+
+/* the pair for k in pairs, searched from the front */
+static lval* pairs_get(lval* pairs, lval* k) {
+  for (int i = 0; i < pairs->count; i++) {
+    if (lval_eq(pairs->cell[i]->cell[0], k)) {
+      return pairs->cell[i];
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  int sizes[] = { 10, 100, 1000, 10000, 100000 };
+  printf("%8s %12s %12s %12s %12s\n", "keys", "put", "get", "put+del",
+         "pairs get");
+
+  for (int s = 0; s < 5; s++) {
+    int n = sizes[s];
+    lval* m = builtin_hash_map(NULL, lval_add(lval_sexpr(), lval_qexpr()));
+    lval* pairs = lval_qexpr();
+    lval** keys = malloc(sizeof(lval*) * n);
+    for (int i = 0; i < n; i++) {
+      keys[i] = key(i);
+      pairs = lval_add(pairs, lval_add(lval_add(lval_qexpr(),
+                                                lval_ref(keys[i])),
+                                       lval_int(i)));
+    }
+
+    /* the map is held by nothing else, so each put changes it in place */
+    double start = now();
+    for (int i = 0; i < OPS; i++) {
+      lval* a = lval_add(lval_sexpr(), m);
+      a = lval_add(lval_add(a, lval_ref(keys[i % n])), lval_int(i));
+      m = builtin_map_put(NULL, a);
+    }
+    double put = (now() - start) * 1e9 / OPS;
+
+    start = now();
+    for (int i = 0; i < OPS; i++) {
+      lval_del(call2(builtin_map_get, lval_ref(m), lval_ref(keys[i % n])));
+    }
+    double get = (now() - start) * 1e9 / OPS;
+
+    /* keys are deleted and put back, leaving the size unchanged */
+    lval* extra = lval_str("extra");
+    start = now();
+    for (int i = 0; i < OPS; i++) {
+      lval* a = lval_add(lval_sexpr(), m);
+      a = lval_add(lval_add(a, lval_ref(extra)), lval_int(i));
+      m = call2(builtin_map_del, builtin_map_put(NULL, a), lval_ref(extra));
+    }
+    double del = (now() - start) * 1e9 / OPS;
+
+    /* a linear search is slow enough to need fewer tries */
+    int tries = OPS / n > 100 ? OPS / n : 100;
+    start = now();
+    for (int i = 0; i < tries; i++) {
+      if (!pairs_get(pairs, keys[(i * 7919) % n])) {
+        printf("missing key\n");
+        return 1;
+      }
+    }
+    double pget = (now() - start) * 1e9 / tries;
+
+    printf("%8i %9.1f ns %9.1f ns %9.1f ns %9.1f ns\n", n, put, get, del,
+           pget);
+    for (int i = 0; i < n; i++) {
+      lval_del(keys[i]);
+    }
+    free(keys);
+    lval_del(extra);
+    lval_del(pairs);
+    lval_del(m);
+  }
+  return 0;
+}
@@ -0,0 +1,88 @@
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#include "lispy.h"
+
+/*
+ * Persistent collection benchmark.
+ *
+ * Times one update of a collection of an increasing size while the old
+ * version is still held, as it is when a fold passes its accumulator to
+ * a function: map-put on a hash map and on a persistent map, and adding
+ * an item to the end of a Q-Expression and of a persistent vector. The
+ * hash map and the Q-Expression are copied whole, so their updates grow
+ * with the size; the persistent ones copy a path of at most seven nodes.
+ */
+
+#define OPS 1000000
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static lval* call2(lbuiltin f, lval* x, lval* y) {
+  return f(NULL, lval_add(lval_add(lval_sexpr(), x), y));
+}
+
+static lval* put(lval* m, int i) {
+  lval* a = lval_add(lval_add(lval_sexpr(), m), lval_int(i));
+  return builtin_map_put(NULL, lval_add(a, lval_int(i)));
+}
+
+static lval* join(lval* l, int i) {
+  return call2(builtin_join, l, lval_add(lval_qexpr(), lval_int(i)));
+}
+
+static lval* push(lval* v, int i) {
+  return call2(builtin_pvec_push, v, lval_int(i));
+}
+
+typedef lval* (*op)(lval*, int);
+
+/* nanoseconds per update of a held x of n items, discarding each result */
+static double time_op(op f, lval* x, int n) {
+  /* a copy of every item is slow enough to need fewer tries */
+  int tries = OPS / n > 100 ? OPS / n : 100;
+  double start = now();
+  for (int i = 0; i < tries; i++) {
+    lval_del(f(lval_ref(x), n + i));
+  }
+  return (now() - start) * 1e9 / tries;
+}
+
+/* a collection of n items built up with f from empty */
+static lval* build(op f, lval* x, int n) {
+  for (int i = 0; i < n; i++) {
+    x = f(x, i);
+  }
+  return x;
+}
+
+int main(int argc, char** argv) {
+  int sizes[] = { 10, 100, 1000, 10000, 100000 };
+  printf("%8s %12s %12s %12s %12s\n", "items", "hash-map", "pmap",
+         "join", "pvec-push");
+
+  for (int s = 0; s < 5; s++) {
+    int n = sizes[s];
+    lval* empty = lval_add(lval_sexpr(), lval_qexpr());
+    lval* hm = build(put, builtin_hash_map(NULL, lval_ref(empty)), n);
+    lval* pm = build(put, builtin_pmap(NULL, lval_ref(empty)), n);
+    lval* l = build(join, lval_qexpr(), n);
+    lval* v = build(push, builtin_pvec(NULL, empty), n);
+
+    double thm = time_op(put, hm, n);
+    double tpm = time_op(put, pm, n);
+    double tl = time_op(join, l, n);
+    double tv = time_op(push, v, n);
+    printf("%8i %9.1f ns %9.1f ns %9.1f ns %9.1f ns\n", n, thm, tpm, tl,
+           tv);
+
+    lval_del(hm);
+    lval_del(pm);
+    lval_del(l);
+    lval_del(v);
+  }
+  return 0;
+}
@@ -0,0 +1,142 @@
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#include "lispy.h"
+
+/*
+ * Vector benchmark.
+ *
+ * Times sums, dot products and elementwise addition over the same
+ * numbers held as a Q-Expression of boxed numbers and as a vector, the
+ * vector both with the scalar kernels and with the widest SIMD kernels
+ * the processor has. The list versions call the arithmetic builtins the
+ * way the stdlib folds and maps would, without the evaluator around them.
+ */
+
+#define N 1000
+#define CALLS 20000
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double number(lval* r) {
+  return LTYPE(r) == LVAL_FLOAT ? r->fnum : (double) LNUM(r);
+}
+
+/* (+ x0 x1 ...) */
+static lval* list_sum(lval* x, lval* y) {
+  lval* a = lval_sexpr();
+  lval_reserve(a, x->count);
+  for (int i = 0; i < x->count; i++) {
+    a->cell[a->count++] = lval_ref(x->cell[i]);
+  }
+  return builtin_add(NULL, a);
+}
+
+/* (+ (* x0 y0) (* x1 y1) ...) */
+static lval* list_dot(lval* x, lval* y) {
+  lval* a = lval_sexpr();
+  lval_reserve(a, x->count);
+  for (int i = 0; i < x->count; i++) {
+    lval* m = lval_add(lval_add(lval_sexpr(), lval_ref(x->cell[i])),
+                       lval_ref(y->cell[i]));
+    a->cell[a->count++] = builtin_mul(NULL, m);
+  }
+  return builtin_add(NULL, a);
+}
+
+/* {(+ x0 y0) (+ x1 y1) ...}, returning its first item */
+static lval* list_add(lval* x, lval* y) {
+  lval* r = lval_qexpr();
+  lval_reserve(r, x->count);
+  for (int i = 0; i < x->count; i++) {
+    lval* a = lval_add(lval_add(lval_sexpr(), lval_ref(x->cell[i])),
+                       lval_ref(y->cell[i]));
+    r->cell[r->count++] = builtin_add(NULL, a);
+  }
+  lval* v = lval_ref(r->cell[0]);
+  lval_del(r);
+  return v;
+}
+
+static lval* vec_sum(lval* x, lval* y) {
+  return builtin_vec_sum(NULL, lval_add(lval_sexpr(), lval_ref(x)));
+}
+
+static lval* vec_dot(lval* x, lval* y) {
+  lval* a = lval_add(lval_add(lval_sexpr(), lval_ref(x)), lval_ref(y));
+  return builtin_vec_dot(NULL, a);
+}
+
+/* x + y, returning its first item as a vector */
+static lval* vec_add(lval* x, lval* y) {
+  lval* a = lval_add(lval_add(lval_sexpr(), lval_ref(x)), lval_ref(y));
+  lval* v = builtin_add(NULL, a);
+  return builtin_head(NULL, lval_add(lval_sexpr(), v));
+}
+
+typedef lval* (*op)(lval*, lval*);
+
+/* average microseconds per call of f on x and y, adding results to sum */
+static double time_op(op f, lval* x, lval* y, double* sum) {
+  double start = now();
+  for (int i = 0; i < CALLS; i++) {
+    lval* r = f(x, y);
+    if (LTYPE(r) == LVAL_VEC) {
+      r = builtin_vec_sum(NULL, lval_add(lval_sexpr(), r));
+    }
+    *sum += number(r);
+    lval_del(r);
+  }
+  return (now() - start) * 1e6 / CALLS;
+}
+
+static lval* list_of(int floats, int k) {
+  lval* l = lval_qexpr();
+  for (int i = 0; i < N; i++) {
+    long n = (i * 7 + k) % 100;
+    l = lval_add(l, floats ? lval_float(n + 0.5) : lval_int(n));
+  }
+  return l;
+}
+
+int main(int argc, char** argv) {
+  struct { char* name; op list; op vec; int floats; } shapes[] = {
+    { "sum ints", list_sum, vec_sum, 0 },
+    { "sum floats", list_sum, vec_sum, 1 },
+    { "dot floats", list_dot, vec_dot, 1 },
+    { "+ ints", list_add, vec_add, 0 },
+    { "+ floats", list_add, vec_add, 1 },
+  };
+
+  /*
+   * The sums keep the calls from being optimized away, and must agree:
+   * the items are small halves, so no order of float additions rounds.
+   */
+  printf("%-12s %10s %10s %10s\n", "1000 items", "list", "scalar", "simd");
+  for (int i = 0; i < 5; i++) {
+    lval* xl = list_of(shapes[i].floats, 0);
+    lval* yl = list_of(shapes[i].floats, 3);
+    lval* xv = builtin_vec(NULL, lval_add(lval_sexpr(), lval_ref(xl)));
+    lval* yv = builtin_vec(NULL, lval_add(lval_sexpr(), lval_ref(yl)));
+    double sums[3] = { 0, 0, 0 };
+    double list = time_op(shapes[i].list, xl, yl, &sums[0]);
+    lval_simd = 0;
+    double scalar = time_op(shapes[i].vec, xv, yv, &sums[1]);
+    lval_simd = 1;
+    double simd = time_op(shapes[i].vec, xv, yv, &sums[2]);
+    printf("%-12s %7.2f us %7.2f us %7.2f us\n", shapes[i].name,
+           list, scalar, simd);
+    if (sums[0] != sums[1] || sums[1] != sums[2]) {
+      printf("results disagree\n");
+      return 1;
+    }
+    lval_del(xl);
+    lval_del(yl);
+    lval_del(xv);
+    lval_del(yv);
+  }
+  return 0;
+}
@@ -0,0 +1,484 @@
+#include <limits.h>
+#include "lispy.h"
+
+/*
+ * Arbitrary precision integers.
+ *
+ * Integer arithmetic is done on longs while the result fits, and the
+ * builtins come here once it would overflow. An LVAL_BIGINT holds the
+ * magnitude of a number as base 2^32 digits, least significant first,
+ * and a sign. Results are normalized: there are no leading zero digits
+ * and any value that fits in a long is an LVAL_INT, so every integer
+ * has one representation.
+ *
+ * The lbig_* functions take integers of either type without taking
+ * ownership of them. Multiplication uses the schoolbook method on
+ * short operands and Karatsuba's above LBIG_KARATSUBA digits, division
+ * is Knuth's algorithm D, and printing and reading work nine decimal
+ * digits at a time.
+ */
+
+/* digits both operands need before Karatsuba beats the schoolbook */
+#define LBIG_KARATSUBA 32
+
+/* largest power of ten in a digit, and its number of zeros */
+#define LBIG_DEC      1000000000
+#define LBIG_DEC_ZERO 9
+
+typedef uint32_t ldigit;
+
+#ifndef __GNUC__
+int lint_add(long x, long y, long* r) {
+  if ((y > 0 && x > LONG_MAX - y) || (y < 0 && x < LONG_MIN - y)) {
+    return 1;
+  }
+  *r = x + y;
+  return 0;
+}
+
+int lint_sub(long x, long y, long* r) {
+  if ((y < 0 && x > LONG_MAX + y) || (y > 0 && x < LONG_MIN + y)) {
+    return 1;
+  }
+  *r = x - y;
+  return 0;
+}
+
+int lint_mul(long x, long y, long* r) {
+  if (x > 0 ? (y > 0 ? x > LONG_MAX / y : y < LONG_MIN / x)
+            : (y > 0 ? x < LONG_MIN / y : x != 0 && y < LONG_MAX / x)) {
+    return 1;
+  }
+  *r = x * y;
+  return 0;
+}
+#endif
+
+/* length of the n digits of d without leading zeros */
+static int lmag_trim(ldigit* d, int n) {
+  while (n > 0 && d[n - 1] == 0) {
+    n--;
+  }
+  return n;
+}
+
+/*
+ * Sets *d and *neg to the magnitude and sign of the integer x and
+ * returns its length. The magnitude of an LVAL_INT is put in buf.
+ */
+static int lmag_of(lval* x, ldigit buf[2], ldigit** d, int* neg) {
+  if (LTYPE(x) == LVAL_BIGINT) {
+    *d = x->digits;
+    *neg = x->neg;
+    return x->len;
+  }
+  long n = LNUM(x);
+  uint64_t m = n < 0 ? 0 - (uint64_t) n : (uint64_t) n;
+  buf[0] = (ldigit) m;
+  buf[1] = (ldigit) (m >> 32);
+  *d = buf;
+  *neg = n < 0;
+  return lmag_trim(buf, 2);
+}
+
+/* the integer with sign neg and the n digits of d, an INT if it fits */
+static lval* lbig_make(ldigit* d, int n, int neg) {
+  n = lmag_trim(d, n);
+  if (n <= 2) {
+    uint64_t m = n == 0 ? 0 : d[0] | (n == 2 ? (uint64_t) d[1] << 32 : 0);
+    if (!neg && m <= LONG_MAX) {
+      return lval_int((long) m);
+    }
+    if (neg && m <= (uint64_t) LONG_MAX + 1) {
+      return lval_int(m == (uint64_t) LONG_MAX + 1 ? LONG_MIN : -(long) m);
+    }
+  }
+  lval* v = lval_new(LVAL_BIGINT);
+  v->len = n;
+  v->neg = neg;
+  v->digits = lpool_alloc(sizeof(ldigit) * n);
+  memcpy(v->digits, d, sizeof(ldigit) * n);
+  gc_grow(sizeof(ldigit) * n);
+  return v;
+}
+
+/* compares the magnitudes a and b, which have no leading zeros */
+static int lmag_cmp(ldigit* a, int an, ldigit* b, int bn) {
+  if (an != bn) {
+    return an < bn ? -1 : 1;
+  }
+  for (int i = an - 1; i >= 0; i--) {
+    if (a[i] != b[i]) {
+      return a[i] < b[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+/* r = a + b, r has room for one digit more than the longer */
+static void lmag_add(ldigit* r, ldigit* a, int an, ldigit* b, int bn) {
+  if (an < bn) {
+    ldigit* t = a; a = b; b = t;
+    int tn = an; an = bn; bn = tn;
+  }
+  uint64_t carry = 0;
+  for (int i = 0; i < an; i++) {
+    carry += (uint64_t) a[i] + (i < bn ? b[i] : 0);
+    r[i] = (ldigit) carry;
+    carry >>= 32;
+  }
+  r[an] = (ldigit) carry;
+}
+
+/* r = a - b for a >= b, r has room for an digits */
+static void lmag_sub(ldigit* r, ldigit* a, int an, ldigit* b, int bn) {
+  int64_t borrow = 0;
+  for (int i = 0; i < an; i++) {
+    int64_t t = (int64_t) a[i] - (i < bn ? b[i] : 0) - borrow;
+    borrow = t < 0;
+    r[i] = (ldigit) t;
+  }
+}
+
+/* r += a where the sum fits in the rn digits of r */
+static void lmag_add_into(ldigit* r, int rn, ldigit* a, int an) {
+  uint64_t carry = 0;
+  for (int i = 0; i < rn && (i < an || carry); i++) {
+    carry += (uint64_t) r[i] + (i < an ? a[i] : 0);
+    r[i] = (ldigit) carry;
+    carry >>= 32;
+  }
+}
+
+/* r -= a where a <= r */
+static void lmag_sub_into(ldigit* r, int rn, ldigit* a, int an) {
+  int64_t borrow = 0;
+  for (int i = 0; i < rn && (i < an || borrow); i++) {
+    int64_t t = (int64_t) r[i] - (i < an ? a[i] : 0) - borrow;
+    borrow = t < 0;
+    r[i] = (ldigit) t;
+  }
+}
+
+/* r = a * b by the schoolbook method, r has room for an + bn digits */
+static void lmag_mul_school(ldigit* r, ldigit* a, int an, ldigit* b, int bn) {
+  memset(r, 0, sizeof(ldigit) * (an + bn));
+  for (int i = 0; i < bn; i++) {
+    uint64_t carry = 0;
+    for (int j = 0; j < an; j++) {
+      carry += (uint64_t) a[j] * b[i] + r[i + j];
+      r[i + j] = (ldigit) carry;
+      carry >>= 32;
+    }
+    r[i + an] = (ldigit) carry;
+  }
+}
+
+/* r = a * b, r has room for an + bn digits */
+static void lmag_mul(ldigit* r, ldigit* a, int an, ldigit* b, int bn) {
+  if (an < bn) {
+    ldigit* t = a; a = b; b = t;
+    int tn = an; an = bn; bn = tn;
+  }
+  if (bn < LBIG_KARATSUBA) {
+    lmag_mul_school(r, a, an, b, bn);
+    return;
+  }
+
+  if (2 * bn <= an) {
+    /* lopsided: multiply b by one piece of a the length of b at a time */
+    ldigit* t = malloc(sizeof(ldigit) * 2 * bn);
+    memset(r, 0, sizeof(ldigit) * (an + bn));
+    for (int i = 0; i < an; i += bn) {
+      int k = an - i < bn ? an - i : bn;
+      lmag_mul(t, a + i, k, b, bn);
+      lmag_add_into(r + i, an + bn - i, t, k + bn);
+    }
+    free(t);
+    return;
+  }
+
+  /*
+   * With a = a1 B^m + a0 and b = b1 B^m + b0,
+   * a b = a1 b1 B^2m + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) B^m + a0 b0
+   * takes three half size products instead of four.
+   */
+  int m = an / 2;
+  int a1n = an - m;
+  int b1n = bn - m;
+  lmag_mul(r, a, m, b, m);
+  lmag_mul(r + 2 * m, a + m, a1n, b + m, b1n);
+
+  int sn = a1n + 1;
+  int tn = (b1n > m ? b1n : m) + 1;
+  ldigit* s = malloc(sizeof(ldigit) * (sn + tn + sn + tn));
+  ldigit* t = s + sn;
+  ldigit* z = t + tn;
+  lmag_add(s, a, m, a + m, a1n);
+  lmag_add(t, b, m, b + m, b1n);
+  lmag_mul(z, s, sn, t, tn);
+  lmag_sub_into(z, sn + tn, r, 2 * m);
+  lmag_sub_into(z, sn + tn, r + 2 * m, a1n + b1n);
+  lmag_add_into(r + m, an + bn - m, z, lmag_trim(z, sn + tn));
+  free(s);
+}
+
+/*
+ * q = a / b and r = a % b for a >= b, by Knuth's algorithm D. q has
+ * room for an - bn + 1 digits and r for bn.
+ */
+static void lmag_divmod(ldigit* q, ldigit* r, ldigit* a, int an,
+                        ldigit* b, int bn) {
+  if (bn == 1) {
+    uint64_t rem = 0;
+    for (int i = an - 1; i >= 0; i--) {
+      uint64_t t = rem << 32 | a[i];
+      q[i] = (ldigit) (t / b[0]);
+      rem = t % b[0];
+    }
+    r[0] = (ldigit) rem;
+    return;
+  }
+
+  /* shift both so the top digit of the divisor has its high bit set */
+  int s = 0;
+  while (!((b[bn - 1] << s) & 0x80000000)) {
+    s++;
+  }
+  ldigit* u = malloc(sizeof(ldigit) * (an + 1 + bn));
+  ldigit* v = u + an + 1;
+  for (int i = bn - 1; i > 0; i--) {
+    v[i] = b[i] << s | (s ? b[i - 1] >> (32 - s) : 0);
+  }
+  v[0] = b[0] << s;
+  u[an] = s ? a[an - 1] >> (32 - s) : 0;
+  for (int i = an - 1; i > 0; i--) {
+    u[i] = a[i] << s | (s ? a[i - 1] >> (32 - s) : 0);
+  }
+  u[0] = a[0] << s;
+
+  for (int j = an - bn; j >= 0; j--) {
+    /* estimate the quotient digit from the top two digits, then fix it */
+    uint64_t top = (uint64_t) u[j + bn] << 32 | u[j + bn - 1];
+    uint64_t qhat = top / v[bn - 1];
+    uint64_t rhat = top % v[bn - 1];
+    while (qhat >> 32 || qhat * v[bn - 2] > (rhat << 32 | u[j + bn - 2])) {
+      qhat--;
+      rhat += v[bn - 1];
+      if (rhat >> 32) {
+        break;
+      }
+    }
+
+    /* u -= qhat v at digit j */
+    int64_t k = 0;
+    int64_t t;
+    for (int i = 0; i < bn; i++) {
+      uint64_t p = qhat * v[i];
+      t = (int64_t) u[i + j] - k - (int64_t) (p & 0xffffffff);
+      u[i + j] = (ldigit) t;
+      k = (int64_t) (p >> 32) - (t >> 32);
+    }
+    t = (int64_t) u[j + bn] - k;
+    u[j + bn] = (ldigit) t;
+
+    q[j] = (ldigit) qhat;
+    if (t < 0) {
+      /* qhat was one too large, so add v back */
+      q[j]--;
+      uint64_t carry = 0;
+      for (int i = 0; i < bn; i++) {
+        carry += (uint64_t) u[i + j] + v[i];
+        u[i + j] = (ldigit) carry;
+        carry >>= 32;
+      }
+      u[j + bn] += (ldigit) carry;
+    }
+  }
+
+  for (int i = 0; i < bn; i++) {
+    r[i] = u[i] >> s | (s ? u[i + 1] << (32 - s) : 0);
+  }
+  free(u);
+}
+
+/* x + y, or x - y if sub is set */
+static lval* lbig_addsub(lval* x, lval* y, int sub) {
+  ldigit xb[2], yb[2];
+  ldigit *a, *b;
+  int aneg, bneg;
+  int an = lmag_of(x, xb, &a, &aneg);
+  int bn = lmag_of(y, yb, &b, &bneg);
+  bneg ^= sub;
+
+  int rn = (an > bn ? an : bn) + 1;
+  ldigit* r = malloc(sizeof(ldigit) * rn);
+  lval* v;
+  if (aneg == bneg) {
+    lmag_add(r, a, an, b, bn);
+    v = lbig_make(r, rn, aneg);
+  } else if (lmag_cmp(a, an, b, bn) >= 0) {
+    lmag_sub(r, a, an, b, bn);
+    v = lbig_make(r, an, aneg);
+  } else {
+    lmag_sub(r, b, bn, a, an);
+    v = lbig_make(r, bn, bneg);
+  }
+  free(r);
+  return v;
+}
+
+lval* lbig_add(lval* x, lval* y) {
+  return lbig_addsub(x, y, 0);
+}
+
+lval* lbig_sub(lval* x, lval* y) {
+  return lbig_addsub(x, y, 1);
+}
+
+lval* lbig_mul(lval* x, lval* y) {
+  ldigit xb[2], yb[2];
+  ldigit *a, *b;
+  int aneg, bneg;
+  int an = lmag_of(x, xb, &a, &aneg);
+  int bn = lmag_of(y, yb, &b, &bneg);
+  if (an == 0 || bn == 0) {
+    return lval_int(0);
+  }
+
+  ldigit* r = malloc(sizeof(ldigit) * (an + bn));
+  lmag_mul(r, a, an, b, bn);
+  lval* v = lbig_make(r, an + bn, aneg ^ bneg);
+  free(r);
+  return v;
+}
+
+/* x / y rounded towards zero, or the remainder if mod is set, as in C */
+static lval* lbig_divmod(lval* x, lval* y, int mod) {
+  ldigit xb[2], yb[2];
+  ldigit *a, *b;
+  int aneg, bneg;
+  int an = lmag_of(x, xb, &a, &aneg);
+  int bn = lmag_of(y, yb, &b, &bneg);
+  if (lmag_cmp(a, an, b, bn) < 0) {
+    return mod ? lval_ref(x) : lval_int(0);
+  }
+
+  ldigit* q = malloc(sizeof(ldigit) * (an - bn + 1 + bn));
+  ldigit* r = q + an - bn + 1;
+  lmag_divmod(q, r, a, an, b, bn);
+  lval* v = mod ? lbig_make(r, bn, aneg) : lbig_make(q, an - bn + 1, aneg ^ bneg);
+  free(q);
+  return v;
+}
+
+/* y must not be 0 */
+lval* lbig_div(lval* x, lval* y) {
+  return lbig_divmod(x, y, 0);
+}
+
+/* y must not be 0 */
+lval* lbig_mod(lval* x, lval* y) {
+  return lbig_divmod(x, y, 1);
+}
+
+lval* lbig_neg(lval* x) {
+  ldigit xb[2];
+  ldigit* a;
+  int neg;
+  int n = lmag_of(x, xb, &a, &neg);
+  return lbig_make(a, n, !neg);
+}
+
+/* less than, equal to or greater than 0 as x is to y */
+int lbig_cmp(lval* x, lval* y) {
+  ldigit xb[2], yb[2];
+  ldigit *a, *b;
+  int aneg, bneg;
+  int an = lmag_of(x, xb, &a, &aneg);
+  int bn = lmag_of(y, yb, &b, &bneg);
+  if (aneg != bneg) {
+    return aneg ? -1 : 1;
+  }
+  int c = lmag_cmp(a, an, b, bn);
+  return aneg ? -c : c;
+}
+
+double lbig_to_double(lval* x) {
+  if (LTYPE(x) == LVAL_INT) {
+    return (double) LNUM(x);
+  }
+  double r = 0.0;
+  for (int i = x->len - 1; i >= 0; i--) {
+    r = r * 4294967296.0 + x->digits[i];
+  }
+  return x->neg ? -r : r;
+}
+
+/* the integer written in decimal in s, with an optional sign */
+lval* lbig_read(char* s) {
+  int neg = *s == '-';
+  if (*s == '-' || *s == '+') {
+    s++;
+  }
+  int len = strlen(s);
+  ldigit* d = malloc(sizeof(ldigit) * (len / LBIG_DEC_ZERO + 1));
+  int n = 0;
+
+  /* d = d 10^k + the next k decimal digits */
+  for (int i = 0; i < len;) {
+    int k = i == 0 && len % LBIG_DEC_ZERO ? len % LBIG_DEC_ZERO : LBIG_DEC_ZERO;
+    uint64_t carry = 0;
+    uint64_t scale = 1;
+    for (int j = 0; j < k; j++, i++) {
+      carry = carry * 10 + (s[i] - '0');
+      scale *= 10;
+    }
+    for (int j = 0; j < n; j++) {
+      carry += d[j] * scale;
+      d[j] = (ldigit) carry;
+      carry >>= 32;
+    }
+    if (carry) {
+      d[n++] = (ldigit) carry;
+    }
+  }
+
+  lval* v = lbig_make(d, n, neg);
+  free(d);
+  return v;
+}
+
+/* x in decimal, which the caller must free */
+char* lbig_str(lval* x) {
+  int n = x->len;
+  ldigit* d = malloc(sizeof(ldigit) * n);
+  memcpy(d, x->digits, sizeof(ldigit) * n);
+
+  /* each pass divides by 10^9, leaving nine decimal digits */
+  ldigit* parts = malloc(sizeof(ldigit) * (2 * n + 1));
+  int count = 0;
+  do {
+    uint64_t rem = 0;
+    for (int i = n - 1; i >= 0; i--) {
+      uint64_t t = rem << 32 | d[i];
+      d[i] = (ldigit) (t / LBIG_DEC);
+      rem = t % LBIG_DEC;
+    }
+    parts[count++] = (ldigit) rem;
+    n = lmag_trim(d, n);
+  } while (n > 0);
+
+  char* s = malloc(LBIG_DEC_ZERO * count + 2);
+  char* p = s;
+  if (x->neg) {
+    *p++ = '-';
+  }
+  p += sprintf(p, "%u", (unsigned) parts[count - 1]);
+  for (int i = count - 2; i >= 0; i--) {
+    p += sprintf(p, "%09u", (unsigned) parts[i]);
+  }
+  free(parts);
+  free(d);
+  return s;
+}
@@ -1,4 +1,5 @@
 #include <editline/readline.h>
+#include <limits.h>
 #include "lispy.h"
 
 lval* builtin_load(lenv* e, lval* a) {
@@ -12,14 +13,16 @@ lval* builtin_load(lenv* e, lval* a) {
     lval* expr = lval_read(r.output);
     mpc_ast_delete(r.output);
     /* Evaluate each Expression */
-    while (expr->count) {
-      lval* x = lval_eval(e, lval_pop(expr, 0));
+    gc_push(expr);
+    for (int i = 0; i < expr->count; i++) {
+      lval* x = lval_eval(e, lval_expand(e, lval_ref(expr->cell[i])));
       /* If Evaluation leads to error print it */
-      if (x->type == LVAL_ERR) {
+      if (LTYPE(x) == LVAL_ERR) {
         lval_println(x);
       }
       lval_del(x);
     }
+    gc_pop(1);
     /* Delete expressions and arguments */
     lval_del(expr);
     lval_del(a);
@@ -73,40 +76,16 @@ lval* builtin_read(lenv* e, lval* a) {
   return v;
 }
 
-lval* builtin_defmacro(lenv* e, lval* a) {
-  LASSERT(a, (a->cell[0]->type == LVAL_SYM || a->cell[0]->type == LVAL_SEXPR),
-          "Function 'defmacro' takes symbol or s-expression. Got %s",
-          ltype_name(a->cell[0]->type));
-  LASSERT_NUM("defmacro", a, 2);
-  lval* sym = a->cell[0];
-  lval* macro = a->cell[1];
-
-  if (sym->type == LVAL_SYM) {
-    lenv_def(e, sym, macro);
-  } else {
-    for (int i = 0; i < sym->count; i++) {
-      LASSERT(a, (sym->cell[i]->type == LVAL_SYM),
-              "Function 'defmacro' cannot define non-symbol. Got %s, Expected %s",
-              ltype_name(sym->cell[i]->type),
-              ltype_name(LVAL_SYM));
-    }
-    lval* func_name = lval_pop(sym, 0);
-    lval* args = sym;
-    lval* lambda = lval_lambda(args, macro);
-    lenv_put(e, func_name, lambda);
-  }
-  lval_del(a);
-  return lval_ok();
-}
-
-lval* builtin_var(lenv* e, lval* a, char* func) {
+/* binds symbols to values with put, lenv_def or lenv_put, for func */
+lval* builtin_var(lenv* e, lval* a, char* func,
+                  void (*put)(lenv*, lval*, lval*)) {
   LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
   lval* syms = a->cell[0];
   for (int i = 0; i < syms->count; i++) {
-    LASSERT(a, (syms->cell[i]->type == LVAL_SYM),
+    LASSERT(a, (LTYPE(syms->cell[i]) == LVAL_SYM),
             "Function '%s' cannot redefine non-symbol. Got %s, Expected %s",
             func,
-            ltype_name(syms->cell[i]->type),
+            ltype_name(LTYPE(syms->cell[i])),
             ltype_name(LVAL_SYM));
   }
 
@@ -117,37 +96,35 @@ lval* builtin_var(lenv* e, lval* a, char* func) {
           syms->count);
 
   for (int i = 0; i < syms->count; i++) {
-    /* define 'def' globally */
-    if (strcmp(func, "def") == 0) {
-      lenv_def(e, syms->cell[i], a->cell[i + 1]);
-    }
-    if (strcmp(func, "=") == 0) {
-      lenv_put(e, syms->cell[i], a->cell[i + 1]);
-    }
+    put(e, syms->cell[i], a->cell[i + 1]);
   }
   lval_del(a);
   return lval_ok();
 }
 
 lval* builtin_def(lenv* e, lval* a) {
-  return builtin_var(e, a, "def");
+  /* define 'def' globally */
+  return builtin_var(e, a, "def", lenv_def);
 }
 
 lval* builtin_fun(lenv* e, lval* a) {
   LASSERT_TYPE("fun", a, 0, LVAL_QEXPR);
   LASSERT_TYPE("fun", a, 1, LVAL_QEXPR);
   LASSERT_NUM("fun", a, 2);
-  lval* def = a->cell[0];
+  lval* def = a->cell[0] = lval_mut(a->cell[0]);
   lval* body = a->cell[1];
   for (int i = 0; i < def->count; i++) {
-    LASSERT(a, (def->cell[i]->type == LVAL_SYM),
+    LASSERT(a, (LTYPE(def->cell[i]) == LVAL_SYM),
 	    "Function 'fun' cannot define non-symbol. Got %s, Expected %s",
-	    ltype_name(def->cell[i]->type),
+	    ltype_name(LTYPE(def->cell[i])),
 	    ltype_name(LVAL_SYM));
   }
   lval* func_name = lval_pop(def, 0);
   lval* args = def;
-  lenv_put(e, func_name, lval_lambda(args, body));
+  lval* lambda = lval_lambda(lval_ref(args), lval_ref(body));
+  lenv_put(e, func_name, lambda);
+  lval_del(lambda);
+  lval_del(func_name);
   lval_del(a);
   return lval_ok();
 }
@@ -160,7 +137,21 @@ lval* builtin_err(lenv* e, lval* a) {
   return err;
 }
 
-lval* builtin_if(lenv* e, lval* a) {
+/* prints its arguments separated by spaces, then a newline */
+lval* builtin_print(lenv* e, lval* a) {
+  for (int i = 0; i < a->count; i++) {
+    if (i > 0) {
+      putchar(' ');
+    }
+    lval_print(a->cell[i]);
+  }
+  putchar('\n');
+  lval_del(a);
+  return lval_ok();
+}
+
+/* the branch of an if to evaluate next, or an error */
+lval* builtin_if_branch(lenv* e, lval* a) {
   LASSERT_NUM("if", a, 3);
   /* first arg must be condition */
   LASSERT_TYPE("if", a, 0, LVAL_BOOL);
@@ -168,26 +159,208 @@ lval* builtin_if(lenv* e, lval* a) {
   LASSERT_TYPEF("if", a, 1, ltype_expr, "expression");
   /* false branch */
   LASSERT_TYPEF("if", a, 2, ltype_expr, "expression");
-  lval* x;
-  a->cell[1]->type = LVAL_SEXPR;
-  a->cell[2]->type = LVAL_SEXPR;
+  /* branches may be shared, so own the chosen one before retyping it */
+  lval* x = lval_mut(lval_pop(a, LNUM(a->cell[0]) ? 1 : 2));
+  x->type = LVAL_SEXPR;
+  lval_del(a);
+  return x;
+}
 
-  if (a->cell[0]->num) {
-    x = lval_eval(e, lval_pop(a, 1));
-  } else {
-    x = lval_eval(e, lval_pop(a, 2));
+lval* builtin_if(lenv* e, lval* a) {
+  return lval_eval(e, builtin_if_branch(e, a));
+}
+
+/* the last expression of (do a b ... z), once the others are evaluated */
+lval* builtin_do_expr(lenv* e, lval* a) {
+  if (a->count == 0) {
+    lval_del(a);
+    return lval_qexpr();
   }
+  gc_push(a);
+  for (int i = 0; i < a->count - 1; i++) {
+    lval* x = lval_eval(e, lval_ref(a->cell[i]));
+    if (LTYPE(x) == LVAL_ERR) {
+      gc_pop(1);
+      lval_del(a);
+      return x;
+    }
+    lval_del(x);
+  }
+  gc_pop(1);
+  return lval_take(a, a->count - 1);
+}
+
+/*
+ * do reached other than as the form, (unpack do {...}) or through
+ * another name, is passed its arguments already evaluated and returns
+ * the last as it is.
+ */
+lval* builtin_do(lenv* e, lval* a) {
+  if (a->count == 0) {
+    lval_del(a);
+    return lval_qexpr();
+  }
+  return lval_take(a, a->count - 1);
+}
+
+/* the body of (let {body}), evaluated in a frame of its own */
+lval* builtin_let_expr(lenv* e, lval* a) {
+  LASSERT_NUM("let", a, 1);
+  LASSERT_TYPEF("let", a, 0, ltype_expr, "expression");
+  lval* x = lval_mut(lval_take(a, 0));
+  x->type = LVAL_SEXPR;
+  return x;
+}
+
+lval* builtin_let(lenv* e, lval* a) {
+  lval* x = builtin_let_expr(e, a);
+  if (LTYPE(x) == LVAL_ERR) {
+    return x;
+  }
+  lenv* frame = lenv_new();
+  lenv_parent(frame, e);
+  gc_push_env(frame);
+  lval* r = lval_eval(frame, x);
+  gc_pop(1);
+  lenv_del(frame);
+  return r;
+}
+
+/*
+ * An error unless the arguments of a from the first are {x y} clauses.
+ * Items after the second are ignored, as they were by the stdlib select
+ * and case these builtins replace.
+ */
+static lval* builtin_clauses(char* func, lval* a, int first) {
+  for (int i = first; i < a->count; i++) {
+    lval* c = a->cell[i];
+    if (LTYPE(c) != LVAL_QEXPR) {
+      return lval_err("Function '%s' passed incorrect type for argument %i. "
+                      "Got %s, Expected %s.", func, i, ltype_name(LTYPE(c)),
+                      ltype_name(LVAL_QEXPR));
+    }
+    if (c->count < 2) {
+      return lval_err("Function '%s' passed a clause of %i items for "
+                      "argument %i. Expected at least 2.", func, c->count, i);
+    }
+  }
+  return NULL;
+}
+
+/* the second item of clause i of a, which is freed */
+static lval* builtin_clause_expr(lval* a, int i) {
+  lval* x = lval_ref(a->cell[i]->cell[1]);
   lval_del(a);
   return x;
 }
 
+/*
+ * The expression of the first clause of (select {cond expr}...) whose
+ * condition is true. Conditions are evaluated in order, until one is.
+ */
+lval* builtin_select_branch(lenv* e, lval* a) {
+  lval* err = builtin_clauses("select", a, 0);
+  if (err) {
+    lval_del(a);
+    return err;
+  }
+  gc_push(a);
+  for (int i = 0; i < a->count; i++) {
+    lval* c = lval_eval(e, lval_ref(a->cell[i]->cell[0]));
+    if (LTYPE(c) != LVAL_BOOL) {
+      gc_pop(1);
+      lval_del(a);
+      if (LTYPE(c) == LVAL_ERR) {
+        return c;
+      }
+      err = lval_err("Function 'select' passed incorrect type for the "
+                     "condition of clause %i. Got %s, Expected %s.",
+                     i, ltype_name(LTYPE(c)), ltype_name(LVAL_BOOL));
+      lval_del(c);
+      return err;
+    }
+    int yes = LNUM(c);
+    lval_del(c);
+    if (yes) {
+      gc_pop(1);
+      return builtin_clause_expr(a, i);
+    }
+  }
+  gc_pop(1);
+  lval_del(a);
+  return lval_err("No Selection Found");
+}
+
+lval* builtin_select(lenv* e, lval* a) {
+  return lval_eval(e, builtin_select_branch(e, a));
+}
+
+/*
+ * The expression of the first clause of (case x {key expr}...) whose
+ * key is equal to x. Keys are evaluated in order, until one is.
+ */
+lval* builtin_case_branch(lenv* e, lval* a) {
+  LASSERT(a, a->count > 0, "Function 'case' passed no arguments.");
+  lval* err = builtin_clauses("case", a, 1);
+  if (err) {
+    lval_del(a);
+    return err;
+  }
+  gc_push(a);
+  for (int i = 1; i < a->count; i++) {
+    lval* k = lval_eval(e, lval_ref(a->cell[i]->cell[0]));
+    if (LTYPE(k) == LVAL_ERR) {
+      gc_pop(1);
+      lval_del(a);
+      return k;
+    }
+    int eq = lval_eq(a->cell[0], k);
+    lval_del(k);
+    if (eq) {
+      gc_pop(1);
+      return builtin_clause_expr(a, i);
+    }
+  }
+  gc_pop(1);
+  lval_del(a);
+  return lval_err("No Case Found");
+}
+
+lval* builtin_case(lenv* e, lval* a) {
+  return lval_eval(e, builtin_case_branch(e, a));
+}
+
+/*
+ * (table x buckets) replaces a case whose keys are all constants, see
+ * opt.c. buckets holds a power of two lists, each of the clauses whose
+ * key hashes to it in the order they were written, so one lookup finds
+ * the clause case would.
+ */
+lval* builtin_case_table_branch(lenv* e, lval* a) {
+  lval* buckets = a->cell[1];
+  lval* b = buckets->cell[lval_hash(a->cell[0]) & (buckets->count - 1)];
+  for (int i = 0; i < b->count; i++) {
+    if (lval_eq(a->cell[0], b->cell[i]->cell[0])) {
+      lval* x = lval_ref(b->cell[i]->cell[1]);
+      lval_del(a);
+      return x;
+    }
+  }
+  lval_del(a);
+  return lval_err("No Case Found");
+}
+
+lval* builtin_case_table(lenv* e, lval* a) {
+  return lval_eval(e, builtin_case_table_branch(e, a));
+}
+
 lval* builtin_and(lenv* e, lval* a) {
   for (int i = 0; i < a->count; i++) {
     LASSERT_TYPE("&&", a, i, LVAL_BOOL);
   }
   int r = 1;
   for (int i = 0; i < a->count; i++) {
-    r &= a->cell[i]->num;
+    r &= LNUM(a->cell[i]);
     if (!r) {
       break;
     }
@@ -202,7 +375,7 @@ lval* builtin_or(lenv* e, lval* a) {
   }
   int r = 0;
   for (int i = 0; i < a->count; i++) {
-    r |= a->cell[i]->num;
+    r |= LNUM(a->cell[i]);
     if (r) {
       break;
     }
@@ -212,95 +385,326 @@ lval* builtin_or(lenv* e, lval* a) {
 }
 
 lval* builtin_put(lenv* e, lval* a) {
-  return builtin_var(e, a, "=");
+  return builtin_var(e, a, "=", lenv_put);
 }
   
+/*
+ * Arithmetic and ordering. Each operator has its own builtin which
+ * passes a constant LOP_* code to an inline worker, so the compiler
+ * emits one specialized copy per operator and the switches on op fold
+ * away. What is left is dispatch on argument shape: two integers, two
+ * floats, then integers only, then mixed integers and floats. Integer
+ * arithmetic is checked for overflow and continues on bignums when a
+ * result would not fit in a long, see bignum.c. Vectors go to vec.c.
+ */
+
+/* each use gets its own copy even where the compiler would share one */
+#ifdef __GNUC__
+#define LOP_INLINE static inline __attribute__((always_inline))
+#else
+#define LOP_INLINE static inline
+#endif
+
+/* operator names, only used in error messages */
+static char* lop_names[] = { "+", "-", "*", "/", "%", ">", "<", ">=", "<=" };
+
+/*
+ * *r = x op y on integers, or nonzero if it overflows; y is nonzero for
+ * division and modulus.
+ */
+LOP_INLINE int lop_int(int op, long x, long y, long* r) {
+  switch (op) {
+  case LOP_ADD: return lint_add(x, y, r);
+  case LOP_SUB: return lint_sub(x, y, r);
+  case LOP_MUL: return lint_mul(x, y, r);
+  default:
+    /* the only quotient that does not fit, and C leaves % undefined too */
+    if (x == LONG_MIN && y == -1) {
+      return 1;
+    }
+    *r = op == LOP_DIV ? x / y : x % y;
+    return 0;
+  }
+}
+
+/* x op y on integers of either size; y is nonzero for division and modulus */
+LOP_INLINE lval* lop_big(int op, lval* x, lval* y) {
+  switch (op) {
+  case LOP_ADD: return lbig_add(x, y);
+  case LOP_SUB: return lbig_sub(x, y);
+  case LOP_MUL: return lbig_mul(x, y);
+  case LOP_DIV: return lbig_div(x, y);
+  default: return lbig_mod(x, y);
+  }
+}
+
+/* x op y on floats; never called for modulus */
+LOP_INLINE double lop_float(int op, double x, double y) {
+  switch (op) {
+  case LOP_ADD: return x + y;
+  case LOP_SUB: return x - y;
+  case LOP_MUL: return x * y;
+  default: return x / y;
+  }
+}
+
+/* the number v as a float */
+LOP_INLINE double lop_double(lval* v) {
+  switch (LTYPE(v)) {
+  case LVAL_FLOAT: return v->fnum;
+  case LVAL_INT: return (double) LNUM(v);
+  default: return lbig_to_double(v);
+  }
+}
+
+/* the error for dividing by the number y under op, or NULL */
+LOP_INLINE lval* lop_check(int op, double y, int is_float) {
+  if ((op == LOP_DIV || op == LOP_MOD) && y == 0.0) {
+    return lval_err("Division by zero");
+  }
+  if (op == LOP_MOD && is_float) {
+    return lval_err("Cannot perform floating point modulus");
+  }
+  return NULL;
+}
+
+/* folds the numbers in a from left to right with op */
+LOP_INLINE lval* builtin_arith(lenv* e, lval* a, int op) {
+  int n = a->count;
+  lval** c = a->cell;
+  lval* err;
+  long r;
+
+  if (n == 2 && LTYPE(c[0]) == LVAL_INT && LTYPE(c[1]) == LVAL_INT) {
+    long x = LNUM(c[0]);
+    long y = LNUM(c[1]);
+    if ((op == LOP_DIV || op == LOP_MOD) && y == 0) {
+      lval_del(a);
+      return lval_err("Division by zero");
+    }
+    if (!lop_int(op, x, y, &r)) {
+      lval_del(a);
+      return lval_int(r);
+    }
+  }
+  if (n == 2 && LTYPE(c[0]) == LVAL_FLOAT && LTYPE(c[1]) == LVAL_FLOAT) {
+    double x = c[0]->fnum;
+    double y = c[1]->fnum;
+    if ((err = lop_check(op, y, 1))) {
+      lval_del(a);
+      return err;
+    }
+    lval_del(a);
+    return lval_float(lop_float(op, x, y));
+  }
+
+  LASSERT(a, n > 0, "Function %s passed no arguments", lop_names[op]);
+
+  if (n == 1 && op == LOP_SUB) {
+    if (LTYPE(c[0]) == LVAL_VEC) {
+      return lvec_arith(a, op);
+    }
+    LASSERT(a, ltype_numeric(LTYPE(c[0])),
+	    "Function %s passed incorrect type for argument %i",
+	    lop_names[op], 0);
+    lval* x = LTYPE(c[0]) == LVAL_FLOAT ? lval_float(-c[0]->fnum)
+      : LTYPE(c[0]) == LVAL_INT && LNUM(c[0]) != LONG_MIN ? lval_int(-LNUM(c[0]))
+      : lbig_neg(c[0]);
+    lval_del(a);
+    return x;
+  }
+
+  /* fold integers in a local while they last and fit */
+  long num = 0;
+  int i = 1;
+  if (LTYPE(c[0]) == LVAL_INT) {
+    num = LNUM(c[0]);
+    for (; i < n && LTYPE(c[i]) == LVAL_INT; i++) {
+      long y = LNUM(c[i]);
+      if (((op == LOP_DIV || op == LOP_MOD) && y == 0)
+          || lop_int(op, num, y, &r)) {
+        break;
+      }
+      num = r;
+    }
+    if (i == n) {
+      lval_del(a);
+      return lval_int(num);
+    }
+  }
+
+  /* all arguments must be numbers, which takes priority over other errors */
+  for (int j = LTYPE(c[0]) == LVAL_INT ? i : 0; j < n; j++) {
+    if (LTYPE(c[j]) == LVAL_VEC) {
+      return lvec_arith(a, op);
+    }
+    LASSERT(a, ltype_numeric(LTYPE(c[j])),
+	    "Function %s passed incorrect type for argument %i",
+	    lop_names[op], j);
+  }
+
+  /* integers of any size up to the first float */
+  double fnum = LTYPE(c[0]) == LVAL_FLOAT ? c[0]->fnum : (double) num;
+  if (LTYPE(c[0]) == LVAL_BIGINT
+      || (LTYPE(c[0]) == LVAL_INT && LTYPE(c[i]) != LVAL_FLOAT)) {
+    lval* x = LTYPE(c[0]) == LVAL_INT ? lval_int(num) : lval_ref(c[0]);
+    for (; i < n && LTYPE(c[i]) != LVAL_FLOAT; i++) {
+      if ((op == LOP_DIV || op == LOP_MOD)
+          && LTYPE(c[i]) == LVAL_INT && LNUM(c[i]) == 0) {
+        lval_del(x);
+        lval_del(a);
+        return lval_err("Division by zero");
+      }
+      lval* y = lop_big(op, x, c[i]);
+      lval_del(x);
+      x = y;
+    }
+    if (i == n) {
+      lval_del(a);
+      return x;
+    }
+    fnum = lbig_to_double(x);
+    lval_del(x);
+  }
+
+  /* then floats for the rest */
+  for (; i < n; i++) {
+    double y = lop_double(c[i]);
+    if ((err = lop_check(op, y, 1))) {
+      lval_del(a);
+      return err;
+    }
+    fnum = lop_float(op, fnum, y);
+  }
+  lval_del(a);
+  return lval_float(fnum);
+}
+
+/* x op y for an ordering operator */
+#define LOP_ORDER(op, x, y) \
+  ((op) == LOP_GT ? (x) > (y) : (op) == LOP_LT ? (x) < (y) : \
+   (op) == LOP_GTE ? (x) >= (y) : (x) <= (y))
+
+/* compares two numbers with op */
+LOP_INLINE lval* builtin_order(lenv* e, lval* a, int op) {
+  LASSERT_NUM(lop_names[op], a, 2);
+  lval* x = a->cell[0];
+  lval* y = a->cell[1];
+  int r;
+  if (LTYPE(x) == LVAL_INT && LTYPE(y) == LVAL_INT) {
+    r = LOP_ORDER(op, LNUM(x), LNUM(y));
+  } else if (LTYPE(x) == LVAL_VEC || LTYPE(y) == LVAL_VEC) {
+    return lvec_order(a, op);
+  } else {
+    /* all arguments must be numbers */
+    for (int i = 0; i < 2; i++) {
+      LASSERT(a, ltype_numeric(LTYPE(a->cell[i])),
+	      "Function %s passed incorrect type for argument %i",
+	      lop_names[op], i);
+    }
+    if (LTYPE(x) == LVAL_FLOAT || LTYPE(y) == LVAL_FLOAT) {
+      /* type conversion required */
+      r = LOP_ORDER(op, lop_double(x), lop_double(y));
+    } else {
+      r = LOP_ORDER(op, lbig_cmp(x, y), 0);
+    }
+  }
+  lval_del(a);
+  return lval_bool(r);
+}
+
 lval* builtin_add(lenv* e, lval* a) {
-  return builtin_op(e, a, "+");
+  return builtin_arith(e, a, LOP_ADD);
 }
 
 lval* builtin_sub(lenv* e, lval* a) {
-  return builtin_op(e, a, "-");
+  return builtin_arith(e, a, LOP_SUB);
 }
 
 lval* builtin_mul(lenv* e, lval* a) {
-  return builtin_op(e, a, "*");
+  return builtin_arith(e, a, LOP_MUL);
 }
 
 lval* builtin_div(lenv* e, lval* a) {
-  return builtin_op(e, a, "/");
+  return builtin_arith(e, a, LOP_DIV);
 }
 
 lval* builtin_mod(lenv* e, lval* a) {
-  return builtin_op(e, a, "%");
+  return builtin_arith(e, a, LOP_MOD);
 }
 
 lval* builtin_eq(lenv* e, lval* a) {
-  return builtin_cmp(e, a, "==");
+  LASSERT_NUM("==", a, 2);
+  int r = lval_eq(a->cell[0], a->cell[1]);
+  lval_del(a);
+  return lval_bool(r);
 }
 
 lval* builtin_ne(lenv* e, lval* a) {
-  return builtin_cmp(e, a, "!=");
+  LASSERT_NUM("!=", a, 2);
+  int r = !lval_eq(a->cell[0], a->cell[1]);
+  lval_del(a);
+  return lval_bool(r);
 }
 
 lval* builtin_gt(lenv* e, lval* a) {
-  return builtin_ord(e, a, ">");
+  return builtin_order(e, a, LOP_GT);
 }
 
 lval* builtin_lt(lenv* e, lval* a) {
-  return builtin_ord(e, a, "<");
+  return builtin_order(e, a, LOP_LT);
 }
 
 lval* builtin_gte(lenv* e, lval* a) {
-  return builtin_ord(e, a, ">=");
+  return builtin_order(e, a, LOP_GTE);
 }
 
 lval* builtin_lte(lenv* e, lval* a) {
-  return builtin_ord(e, a, "<=");
+  return builtin_order(e, a, LOP_LTE);
 }
 
 lval* builtin_head(lenv* e, lval* a) {
   LASSERT_NUM("head", a, 1);
   lval* arg1 = a->cell[0];
-  LASSERT(a, ltype_expr_or_str(arg1->type),
-	  "Function 'head' passed incorrect type. Got %s, Expected string or expression.",
-	  ltype_name(arg1->type));
-  if (arg1->type == LVAL_QEXPR) {
+  LASSERT(a, ltype_seq(LTYPE(arg1)),
+	  "Function 'head' passed incorrect type. Got %s, Expected string, expression or vector.",
+	  ltype_name(LTYPE(arg1)));
+  if (LTYPE(arg1) == LVAL_QEXPR) {
     LASSERT(a, arg1->count != 0, "Function 'head' passed {}");
-    /* take the first argument */
-    lval* v = lval_take(a, 0);
-    /* delete all the elements after the first */
-    while (v->count > 1) {
-      lval_del(lval_pop(v, 1));
-    }
+    /* share the first element into a new list */
+    lval* v = lval_add(lval_qexpr(), lval_ref(arg1->cell[0]));
+    lval_del(a);
     return v;
-  } else if (arg1->type == LVAL_STR) {
+  } else if (LTYPE(arg1) == LVAL_STR) {
     LASSERT (a, (strlen(arg1->str) != 0),
              "Function 'head' passed empty string");
     char* first = malloc(sizeof(char) + 1);
     first[0] = arg1->str[0];
     first[1] = '\0';
     lval_del(a);
-    return lval_str(first);
+    lval* v = lval_str(first);
+    free(first);
+    return v;
+  } else if (LTYPE(arg1) == LVAL_VEC) {
+    LASSERT(a, arg1->vlen != 0, "Function 'head' passed []");
+    return lvec_slice(lval_take(a, 0), 0, 1);
   } else {
-    return lval_err("Function 'head' type not handled: %s", ltype_name(arg1->type));
+    return lval_err("Function 'head' type not handled: %s", ltype_name(LTYPE(arg1)));
   }
 }
 
 lval* builtin_tail(lenv* e, lval* a) {
   LASSERT_NUM("tail", a, 1);
   lval* arg1 = a->cell[0];
-  LASSERT(a, ltype_expr_or_str(arg1->type),
-	  "Function 'tail' passed incorrect type. Got %s, Expected string or expression",
-	  ltype_name(a->cell[0]->type));
-  if (arg1->type == LVAL_QEXPR) {
+  LASSERT(a, ltype_seq(LTYPE(arg1)),
+	  "Function 'tail' passed incorrect type. Got %s, Expected string, expression or vector",
+	  ltype_name(LTYPE(a->cell[0])));
+  if (LTYPE(arg1) == LVAL_QEXPR) {
     LASSERT(a, a->cell[0]->count != 0, "Function 'tail' passed {}");
-    /* take the first argument */
+    /* a view of the rest, so walking a list does not copy it */
     lval* v = lval_take(a, 0);
-    /* delete the first element and return */
-    lval_del(lval_pop(v, 0));
-    return v;
-  } else if (arg1->type == LVAL_STR) {
+    return lval_slice(v, 1, v->count - 1);
+  } else if (LTYPE(arg1) == LVAL_STR) {
     LASSERT (a, (strlen(arg1->str) != 0),
              "Function 'head' passed empty string");
     char* rest = malloc(sizeof(char) * strlen(arg1->str));
@@ -308,21 +712,76 @@ lval* builtin_tail(lenv* e, lval* a) {
     strcpy(rest, rp);
     rest[strlen(rest)] = '\0';
     lval_del(a);
-    return lval_str(rest);
+    lval* v = lval_str(rest);
+    free(rest);
+    return v;
+  } else if (LTYPE(arg1) == LVAL_VEC) {
+    LASSERT(a, arg1->vlen != 0, "Function 'tail' passed []");
+    lval* v = lval_take(a, 0);
+    return lvec_slice(v, 1, v->vlen - 1);
   } else {
-    return lval_err("Function 'tail' type not handled: %s", ltype_name(arg1->type));
+    return lval_err("Function 'tail' type not handled: %s", ltype_name(LTYPE(arg1)));
   }
 }
 
+/* number of items of a list or vector, or characters of a string */
+static long builtin_length(lval* l) {
+  if (LTYPE(l) == LVAL_VEC) {
+    return l->vlen;
+  }
+  return LTYPE(l) == LVAL_STR ? (long) strlen(l->str) : l->count;
+}
+
+#define LASSERT_COUNT(func, args) \
+  LASSERT_NUM(func, args, 2); \
+  LASSERT_TYPE(func, args, 0, LVAL_INT); \
+  LASSERT_TYPEF(func, args, 1, ltype_seq, "string, expression or vector"); \
+  LASSERT(args, LNUM(args->cell[0]) >= 0 \
+          && LNUM(args->cell[0]) <= builtin_length(args->cell[1]), \
+          "Function '%s' passed %li for a length of %li.", func, \
+          LNUM(args->cell[0]), builtin_length(args->cell[1]))
+
+/* the first n items of l, sharing its cells */
+lval* builtin_take(lenv* e, lval* a) {
+  LASSERT_COUNT("take", a);
+  int n = LNUM(a->cell[0]);
+  lval* l = lval_take(a, 1);
+  if (LTYPE(l) == LVAL_STR) {
+    l = lval_mut(l);
+    l->str[n] = '\0';
+    return l;
+  }
+  if (LTYPE(l) == LVAL_VEC) {
+    return lvec_slice(l, 0, n);
+  }
+  return lval_slice(l, 0, n);
+}
+
+/* l without its first n items, sharing its cells */
+lval* builtin_drop(lenv* e, lval* a) {
+  LASSERT_COUNT("drop", a);
+  int n = LNUM(a->cell[0]);
+  lval* l = lval_take(a, 1);
+  if (LTYPE(l) == LVAL_STR) {
+    lval* v = lval_str(l->str + n);
+    lval_del(l);
+    return v;
+  }
+  if (LTYPE(l) == LVAL_VEC) {
+    return lvec_slice(l, n, l->vlen - n);
+  }
+  return lval_slice(l, n, l->count - n);
+}
+
 lval* builtin_lambda(lenv* e, lval* a) {
   LASSERT_NUM("\\", a, 2);
   LASSERT_TYPEF("\\", a, 0, ltype_expr, "expression");
   LASSERT_TYPEF("\\", a, 1, ltype_expr, "expression");
 
   for (int i = 0; i < a->cell[0]->count; i++) {
-    LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
+    LASSERT(a, (LTYPE(a->cell[0]->cell[i]) == LVAL_SYM),
 	    "Cannot define a non-symbol. Got %s, Expected %s.",
-	    ltype_name(a->cell[0]->cell[i]->type),
+	    ltype_name(LTYPE(a->cell[0]->cell[i])),
 	    ltype_name(LVAL_SYM));
   }
   lval* formals = lval_pop(a, 0);
@@ -336,193 +795,53 @@ lval* builtin_list(lenv* e, lval* a) {
   return a;
 }
 
-lval* builtin_eval(lenv* e, lval* a) {
+/* the expression an eval evaluates, or an error */
+lval* builtin_eval_expr(lenv* e, lval* a) {
   LASSERT_NUM("eval", a, 1);
-  LASSERT(a, ltype_expr(a->cell[0]->type),
+  LASSERT(a, ltype_expr(LTYPE(a->cell[0])),
           "Function 'eval' passed incorrect type. Got %s, expected expression",
-          ltype_name(a->cell[0]->type));
+          ltype_name(LTYPE(a->cell[0])));
 
-  lval* x = lval_take(a, 0);
+  lval* x = lval_mut(lval_take(a, 0));
   x->type = LVAL_SEXPR;
-  return lval_eval(e, x);
+  return lval_expand(e, x);
 }
 
-lval* builtin_join(lenv* e, lval* a) {
-  for (int i = 0; i < a->count; i++) {
-    LASSERT(a, (a->cell[i]->type == LVAL_QEXPR || a->cell[i]->type == LVAL_STR),
-            "Function 'join' cannot operate on type: %s",
-            ltype_name(a->cell[i]->type));
-  }
-
-  lval* x = lval_pop(a, 0);
-  while (a->count) {
-    x = lval_join(x, lval_pop(a, 0));
-  }
-  lval_del(a);
-  return x;
+lval* builtin_eval(lenv* e, lval* a) {
+  return lval_eval(e, builtin_eval_expr(e, a));
 }
 
-/* performs the provided operation against cells in the lval a */
-lval* builtin_op(lenv* e, lval* a, char* op) {
-  /* all arguments must be numbers */
+lval* builtin_join(lenv* e, lval* a) {
+  int vecs = 0;
   for (int i = 0; i < a->count; i++) {
-    LASSERT(a, ltype_numeric(a->cell[i]->type),
-	    "Function %s passed incorrect type for argument %i",
-	    op, i);
+    int t = LTYPE(a->cell[i]);
+    LASSERT(a, (t == LVAL_QEXPR || t == LVAL_STR || t == LVAL_VEC),
+            "Function 'join' cannot operate on type: %s",
+            ltype_name(t));
+    vecs += t == LVAL_VEC;
   }
-
-  /* pop first element */
-  lval* x = lval_pop(a, 0);
-
-  if ((strcmp(op, "-") == 0) && a->count == 0) {
-    if (x->type == LVAL_INT) {
-      x->num = -x->num;
-    } else if (x->type == LVAL_FLOAT) {
-      x->fnum = -x->fnum;
-    }
+  if (vecs && vecs == a->count) {
+    return lvec_join(a);
   }
-
-  while (a->count > 0) {
-    lval* y = lval_pop(a, 0);
-    if (x->type != y->type) {
-      /* We must convert to the same type. Since one is a float, the end result
-       * must be a float as well.
-       */
-      x = lval_int_to_float(x);
-      y = lval_int_to_float(y);
-    }
-    if (strcmp(op, "+") == 0) {
-      if (x->type == LVAL_INT) {
-        x->num += y->num;
-      } else if (x->type == LVAL_FLOAT) {
-        x->fnum += y->fnum;
-      }
-    }
-    if (strcmp(op, "-") == 0) {
-      if (x->type == LVAL_INT) {
-        x->num -= y->num;
-      } else if (x->type == LVAL_FLOAT) {
-        x->fnum -= y->fnum;
-      }
+  /* vectors joined onto lists become lists */
+  for (int i = 0; vecs && i < a->count; i++) {
+    if (LTYPE(a->cell[i]) == LVAL_VEC) {
+      a->cell[i] = lvec_list(a->cell[i]);
     }
-    if (strcmp(op, "*") == 0) {
-      if (x->type == LVAL_INT) {
-        x->num *= y->num;
-      } else if (x->type == LVAL_FLOAT) {
-        x->fnum *= y->fnum;
-      }
-    }
-    if (strcmp(op, "/") == 0) {
-      if ((y->type == LVAL_INT && y->num == 0)
-          || (y->type == LVAL_INT && y->fnum == (double) 0.0)) {
-	lval_del(x);
-	lval_del(y);
-	x = lval_err("Division by zero");
-	break;
-      }
-      if (x->type == LVAL_INT) {
-        x->num /= y->num;
-      } else if (y->type == LVAL_FLOAT) {
-        x->fnum /= y->fnum;
-      }
-    }
-    if (strcmp(op, "%") == 0) {
-      if ((y->type == LVAL_INT && y->num == 0)
-          || (y->type == LVAL_FLOAT && y->fnum == (double) 0.0)) {
-	lval_del(x);
-	lval_del(y);
-	x = lval_err("Division by zero");
-	break;
-      }
-      if (x->type == LVAL_INT) {
-        x->num %= y->num;
-      } else if (x->type == LVAL_FLOAT) {
-        lval_del(x);
-        lval_del(y);
-        x = lval_err("Cannot perform floating point modulus");
-      }
-    }
-    lval_del(y);
   }
-  lval_del(a);
-  return x;
-}
 
-lval* builtin_ord(lenv* e, lval* a, char* op) {
-  LASSERT_NUM(op, a, 2);
-  /* all arguments must be numbers */
-  for (int i = 0; i < a->count; i++) {
-    LASSERT(a, ltype_numeric(a->cell[i]->type),
-	    "Function %s passed incorrect type for argument %i",
-	    op, i);
-  }
-  int r;
   lval* x = lval_pop(a, 0);
-  lval* y = lval_pop(a, 0);
-  if (x->type != y->type) {
-    /* type conversion required */
-    x = lval_int_to_float(x);
-    y = lval_int_to_float(y);
-  }
-  if (strcmp(op, ">") == 0) {
-    if (x->type == LVAL_INT) {
-      r = x->num > y->num;
-    } else {
-      r = x->fnum > y->fnum;
-    }
-  }
-  if (strcmp(op, "<") == 0) {
-    if (x->type == LVAL_INT) {
-      r = x->num < y->num;
-    } else {
-      r = x->fnum < y->fnum;
-    }
-  }
-  if (strcmp(op, "==") == 0) {
-    if (x->type == LVAL_INT) {
-      r = x->num == y->num;
-    } else {
-      r = x->fnum == y->fnum;
-    }
-  }
-  if (strcmp(op, ">=") == 0) {
-    if (x->type == LVAL_INT) {
-      r = x->num >= y->num;
-    } else {
-      r = x->fnum >= y->fnum;
-    }
-  }
-  if (strcmp(op, "<=") == 0) {
-    if (x->type == LVAL_INT) {
-      r = x->num <= y->num;
-    } else {
-      r = x->fnum <= y->fnum;
-    }
+  for (int i = 0; i < a->count; i++) {
+    x = lval_join(x, lval_ref(a->cell[i]));
   }
-
-  lval_del(x);
-  lval_del(y);
   lval_del(a);
-  return lval_bool(r);
+  return x;
 }
 
 lval* builtin_not(lenv* e, lval* a) {
   LASSERT_NUM("!", a, 1);
-  LASSERT_TYPE("!", a, 1, LVAL_BOOL);
-  int r = !a->cell[0]->num;
+  LASSERT_TYPE("!", a, 0, LVAL_BOOL);
+  int r = !LNUM(a->cell[0]);
   lval_del(a);
   return lval_bool(r);
 }
-
-lval* builtin_cmp(lenv* e, lval* a, char* op) {
-  LASSERT_NUM(op, a, 2);
-  int r;
-  if (strcmp(op, "==") == 0) {
-    r = lval_eq(a->cell[0], a->cell[1]);
-  }
-  if (strcmp(op, "!=") == 0) {
-    r = !lval_eq(a->cell[0], a->cell[1]);
-  }
-  lval_del(a);
-  return lval_bool(r);
-}     
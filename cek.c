@@ -0,0 +1,109 @@
+#include "lispy.h"
+
+/*
+ * Explicit stack evaluator, used when lval_engine is LVAL_ENGINE_CEK.
+ *
+ * lval_eval_tree evaluates the cells of an S-Expression by recursing on
+ * the C stack, so deeply nested non-tail expressions can overflow it.
+ * This evaluator keeps the same state on a heap allocated continuation
+ * stack instead: the control is the expression being evaluated and its
+ * environment, and each continuation frame is an S-Expression waiting
+ * for one of its cells. Applying an evaluated S-Expression is shared
+ * with the tree evaluator through lval_apply, so both give the same
+ * results.
+ *
+ * The stack is bounded by lval_cek_max_depth. Running out produces a
+ * "stack exhausted" error which propagates like any other error.
+ * Builtins that evaluate (load, for instance) re-enter the machine and
+ * push onto the same stack, so the bound covers them too.
+ */
+
+typedef struct {
+  /* S-Expression whose cells are being evaluated in place */
+  lval* v;
+  /* cell being evaluated and number of cells to evaluate */
+  int i;
+  int count;
+  lenv* e;
+  /* frame owned by the evaluation of v, see lval_enter */
+  lenv* owned;
+} cek_frame;
+
+int lval_cek_max_depth = 1000000;
+
+static cek_frame* cek_stack = NULL;
+static int cek_count = 0;
+static int cek_cap = 0;
+
+static cek_frame* cek_push(void) {
+  if (cek_count == cek_cap) {
+    cek_cap = cek_cap ? cek_cap * 2 : 256;
+    cek_stack = realloc(cek_stack, sizeof(cek_frame) * cek_cap);
+  }
+  return &cek_stack[cek_count++];
+}
+
+lval* lval_eval_cek(lenv* e, lval* v) {
+  /* frames below base belong to an enclosing run of the machine */
+  int base = cek_count;
+  lenv* owned = NULL;
+  lval* r;
+
+  while (1) {
+    /* reduce v to a value r, or start evaluating its cells */
+    gc_safepoint(e, v);
+    if (LTYPE(v) == LVAL_SYM) {
+      r = lenv_get(e, v);
+      lval_del(v);
+    } else if (LTYPE(v) != LVAL_SEXPR) {
+      r = v;
+    } else if (v->count == 0) {
+      r = lval_apply(&e, &v, 0, &owned, NULL);
+    } else if (cek_count >= lval_cek_max_depth) {
+      lval_del(v);
+      r = lval_err("stack exhausted, more than %i frames",
+                   lval_cek_max_depth);
+    } else {
+      v = lval_mut(v);
+      gc_push(v);
+      cek_frame* k = cek_push();
+      k->v = v;
+      k->i = 0;
+      k->count = lval_eval_count(e, v->cell[0], 0, v->count);
+      k->e = e;
+      k->owned = owned;
+      owned = NULL;
+      v = v->cell[0];
+      continue;
+    }
+
+    /* return r to the innermost waiting frame */
+    while (1) {
+      lval_release(owned);
+      owned = NULL;
+      if (cek_count == base) {
+        return r;
+      }
+      cek_frame* k = &cek_stack[cek_count - 1];
+      k->v->cell[k->i++] = r;
+      if (k->i < k->count) {
+        k->count = lval_eval_count(k->e, k->v->cell[k->i], k->i, k->count);
+        e = k->e;
+        v = k->v->cell[k->i];
+        break;
+      }
+
+      /* every cell is evaluated, apply the S-Expression */
+      cek_count--;
+      gc_pop(1);
+      e = k->e;
+      v = k->v;
+      owned = k->owned;
+      r = lval_apply(&e, &v, k->count, &owned, NULL);
+      if (r == NULL) {
+        /* continue with the expression in tail position */
+        break;
+      }
+    }
+  }
+}
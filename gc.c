@@ -0,0 +1,323 @@
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#include "lispy.h"
+
+#ifdef LISPY_GC
+
+/*
+ * Tracing mark-and-sweep collector, used when built with -DLISPY_GC.
+ *
+ * Every lval and lenv is recorded in the heap when allocated. lval_del
+ * and lenv_del do nothing in this mode; instead, at safe points in
+ * lval_eval, everything reachable from the root stack is marked and
+ * the rest is freed.
+ *
+ * Collections are paced by bytes rather than objects, since one list
+ * or string may own far more memory than the lval holding it. Storage
+ * a value or environment takes beyond its struct is counted with
+ * gc_grow where it is allocated.
+ *
+ * The root stack holds the global environment plus every value the
+ * evaluator is still holding on to across a nested lval_eval call.
+ */
+
+enum { GC_LVAL, GC_LENV };
+
+typedef struct {
+  int kind;
+  void* ptr;
+} gc_ref;
+
+typedef struct {
+  int count;
+  int cap;
+  gc_ref* refs;
+} gc_stack;
+
+/* all allocated objects */
+static gc_stack heap;
+/* values the evaluator is holding */
+static gc_stack roots;
+/* work list for marking */
+static gc_stack gray;
+
+/* fewest bytes allocated between collections */
+#define GC_MIN_THRESHOLD (4L << 20)
+
+/* bytes allocated since the last collection */
+static long gc_allocated = 0;
+/* collect once this many bytes have been allocated */
+static long gc_threshold = GC_MIN_THRESHOLD;
+
+static long   gc_collections = 0;
+static double gc_pause_total = 0.0;
+static double gc_pause_max = 0.0;
+static double gc_pause_last = 0.0;
+static long   gc_live_objects = 0;
+static long   gc_live_bytes = 0;
+static long   gc_peak_bytes = 0;
+
+static void gc_stack_push(gc_stack* s, int kind, void* ptr) {
+  if (s->count == s->cap) {
+    s->cap = s->cap ? s->cap * 2 : 256;
+    s->refs = realloc(s->refs, sizeof(gc_ref) * s->cap);
+  }
+  s->refs[s->count].kind = kind;
+  s->refs[s->count].ptr = ptr;
+  s->count++;
+}
+
+/* v is new and has no payload yet, what that allocates goes to gc_grow */
+void gc_track_lval(lval* v) {
+  v->marked = 0;
+  gc_stack_push(&heap, GC_LVAL, v);
+  gc_allocated += sizeof(lval);
+}
+
+void gc_track_lenv(lenv* e) {
+  e->marked = 0;
+  gc_stack_push(&heap, GC_LENV, e);
+  gc_allocated += sizeof(lenv);
+}
+
+/* counts bytes a tracked value or environment has allocated for itself */
+void gc_grow(long bytes) {
+  gc_allocated += bytes;
+}
+
+void gc_push(lval* v) {
+  gc_stack_push(&roots, GC_LVAL, v);
+}
+
+void gc_push_env(lenv* e) {
+  gc_stack_push(&roots, GC_LENV, e);
+}
+
+void gc_pop(int n) {
+  roots.count -= n;
+}
+
+static void gc_mark_lval(lval* v) {
+  if (v && !LVAL_IMM(v) && !v->marked) {
+    v->marked = 1;
+    gc_stack_push(&gray, GC_LVAL, v);
+  }
+}
+
+static void gc_mark_lenv(lenv* e) {
+  if (e && !e->marked) {
+    e->marked = 1;
+    gc_stack_push(&gray, GC_LENV, e);
+  }
+}
+
+/* mark everything reachable from the gray objects */
+static void gc_trace(void) {
+  while (gray.count) {
+    gc_ref r = gray.refs[--gray.count];
+    if (r.kind == GC_LENV) {
+      lenv* e = r.ptr;
+      gc_mark_lenv(e->par);
+      for (int i = 0; i < e->count; i++) {
+        gc_mark_lval(e->vals[i]);
+      }
+      continue;
+    }
+    lval* v = r.ptr;
+    switch (v->type) {
+    case LVAL_MACRO:
+    case LVAL_FUN:
+      if (!v->builtin) {
+        gc_mark_lval(v->args);
+        gc_mark_lval(v->formals);
+        gc_mark_lval(v->body);
+      }
+      break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+      for (int i = 0; i < v->count; i++) {
+        gc_mark_lval(v->cell[i]);
+      }
+      gc_mark_lval(v->base);
+      if (v->cache) {
+        gc_mark_lval(v->cache->opt);
+      }
+      break;
+    case LVAL_VEC:
+      gc_mark_lval(v->vbase);
+      break;
+    case LVAL_MAP:
+    case LVAL_SET:
+      for (int i = 0; i < v->mused; i++) {
+        gc_mark_lval(v->mentries[i].key);
+        gc_mark_lval(v->mentries[i].val);
+      }
+      break;
+    case LVAL_PMAP:
+    case LVAL_PVEC:
+      gc_mark_lval(v->proot);
+      gc_mark_lval(v->ptail);
+      break;
+    case LVAL_NODE:
+      for (int i = 0; i < v->nlen; i++) {
+        gc_mark_lval(v->nkids[i]);
+      }
+      break;
+    default: break;
+    }
+  }
+}
+
+/* free an unreachable lval, its children are swept separately */
+static void gc_free_lval(lval* v) {
+  switch (v->type) {
+  case LVAL_ERR: free(v->err); break;
+  case LVAL_STR: free(v->str); break;
+  case LVAL_BIGINT: lpool_free(v->digits, sizeof(uint32_t) * v->len); break;
+  case LVAL_SEXPR:
+  case LVAL_QEXPR:
+    if (!v->base) {
+      lpool_free(v->cell, sizeof(lval*) * v->cap);
+    }
+    if (v->cache) {
+      if (v->cache->chunk) {
+        lchunk_del(v->cache->chunk);
+      }
+      lpool_free(v->cache, sizeof(lbody));
+    }
+    break;
+  case LVAL_VEC:
+    if (!v->vbase) {
+      lpool_free(v->vints, LVEC_SIZE(v) * v->vlen);
+    }
+    break;
+  case LVAL_MAP:
+  case LVAL_SET:
+    lpool_free(v->mentries, sizeof(lentry) * v->mcap);
+    lpool_free(v->mindex, sizeof(int) * 2 * v->mcap);
+    break;
+  case LVAL_NODE:
+    lpool_free(v->nkids, sizeof(lval*) * v->ncap);
+    break;
+  default: break;
+  }
+  lpool_free(v, sizeof(lval));
+}
+
+static void gc_free_lenv(lenv* e) {
+  lpool_free(e->syms, sizeof(char*) * e->count);
+  lpool_free(e->vals, sizeof(lval*) * e->count);
+  lpool_free(e->index, sizeof(int) * e->index_cap);
+  lpool_free(e, sizeof(lenv));
+}
+
+static long gc_size_lval(lval* v) {
+  switch (v->type) {
+  case LVAL_ERR: return sizeof(lval) + strlen(v->err) + 1;
+  case LVAL_STR: return sizeof(lval) + strlen(v->str) + 1;
+  case LVAL_BIGINT: return sizeof(lval) + sizeof(uint32_t) * v->len;
+  case LVAL_SEXPR:
+  case LVAL_QEXPR:
+    /* slices allocate no cells of their own */
+    return sizeof(lval) + (v->base ? 0 : sizeof(lval*) * v->cap)
+      + (v->cache ? sizeof(lbody) : 0);
+  case LVAL_VEC:
+    return sizeof(lval) + (v->vbase ? 0 : LVEC_SIZE(v) * v->vlen);
+  case LVAL_MAP:
+  case LVAL_SET:
+    return sizeof(lval) + (sizeof(lentry) + 2 * sizeof(int)) * v->mcap;
+  case LVAL_NODE:
+    return sizeof(lval) + sizeof(lval*) * v->ncap;
+  default: return sizeof(lval);
+  }
+}
+
+static double gc_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void gc_run(lenv* e, lval* v) {
+  double start = gc_now();
+
+  /* mark */
+  for (int i = 0; i < roots.count; i++) {
+    if (roots.refs[i].kind == GC_LENV) {
+      gc_mark_lenv(roots.refs[i].ptr);
+    } else {
+      gc_mark_lval(roots.refs[i].ptr);
+    }
+  }
+  gc_mark_lenv(e);
+  gc_mark_lval(v);
+  gc_trace();
+
+  /* sweep, compacting the heap list as we go */
+  long live = 0;
+  long bytes = 0;
+  for (int i = 0; i < heap.count; i++) {
+    gc_ref r = heap.refs[i];
+    if (r.kind == GC_LENV) {
+      lenv* x = r.ptr;
+      if (!x->marked) {
+        gc_free_lenv(x);
+        continue;
+      }
+      x->marked = 0;
+      bytes += sizeof(lenv) + (sizeof(char*) + sizeof(lval*)) * x->count
+        + sizeof(int) * x->index_cap;
+    } else {
+      lval* x = r.ptr;
+      if (!x->marked) {
+        gc_free_lval(x);
+        continue;
+      }
+      x->marked = 0;
+      bytes += gc_size_lval(x);
+    }
+    heap.refs[live++] = r;
+  }
+  heap.count = live;
+
+  double pause = gc_now() - start;
+  gc_collections++;
+  gc_pause_total += pause;
+  gc_pause_last = pause;
+  if (pause > gc_pause_max) {
+    gc_pause_max = pause;
+  }
+  gc_live_objects = live;
+  gc_live_bytes = bytes;
+  if (bytes > gc_peak_bytes) {
+    gc_peak_bytes = bytes;
+  }
+
+  /* let the heap double before collecting again */
+  gc_allocated = 0;
+  gc_threshold = bytes > GC_MIN_THRESHOLD ? bytes : GC_MIN_THRESHOLD;
+}
+
+/* called by lval_eval, e and v are live in addition to the roots */
+void gc_safepoint(lenv* e, lval* v) {
+  if (gc_allocated >= gc_threshold) {
+    gc_run(e, v);
+  }
+}
+
+/*
+ * Collects and prints collector statistics. Arguments are ignored,
+ * they only exist so the call can be written as (gc-stats {}).
+ */
+lval* builtin_gc_stats(lenv* e, lval* a) {
+  lval_del(a);
+  gc_run(e, NULL);
+  printf("collections: %li\n", gc_collections);
+  printf("pause total: %.3f ms, max: %.3f ms, last: %.3f ms\n",
+         gc_pause_total * 1000, gc_pause_max * 1000, gc_pause_last * 1000);
+  printf("heap: %li bytes in %li objects, peak %li bytes\n",
+         gc_live_bytes, gc_live_objects, gc_peak_bytes);
+  return lval_ok();
+}
+
+#endif
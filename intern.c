@@ -0,0 +1,93 @@
+#include "lispy.h"
+
+/*
+ * Symbol intern table.
+ *
+ * Every distinct symbol name is stored exactly once, so symbols can be
+ * compared by pointer and symbol lvals can share the name instead of
+ * owning a copy. Names live for the lifetime of the program.
+ *
+ * The table is open addressed with linear probing and is kept at most
+ * half full.
+ */
+
+char* lsym_amp;
+char* lsym_quasiquote;
+char* lsym_splice;
+char* lsym_unquote;
+
+static lsym** lsym_table = NULL;
+static unsigned long lsym_cap = 0;
+static unsigned long lsym_count = 0;
+
+/* FNV-1a */
+static unsigned long lsym_hash_str(char* s) {
+  unsigned long h = 2166136261u;
+  for (; *s; s++) {
+    h ^= (unsigned char) *s;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static void lsym_insert(lsym* sym) {
+  unsigned long i = sym->hash & (lsym_cap - 1);
+  while (lsym_table[i]) {
+    i = (i + 1) & (lsym_cap - 1);
+  }
+  lsym_table[i] = sym;
+}
+
+static void lsym_grow(void) {
+  lsym** old = lsym_table;
+  unsigned long old_cap = lsym_cap;
+  lsym_cap = old_cap ? old_cap * 2 : 256;
+  lsym_table = calloc(lsym_cap, sizeof(lsym*));
+  for (unsigned long i = 0; i < old_cap; i++) {
+    if (old[i]) {
+      lsym_insert(old[i]);
+    }
+  }
+  free(old);
+}
+
+static char* lsym_lookup(char* name) {
+  unsigned long h = lsym_hash_str(name);
+  unsigned long i = h & (lsym_cap - 1);
+  while (lsym_table[i]) {
+    lsym* sym = lsym_table[i];
+    if (sym->hash == h && strcmp(sym->name, name) == 0) {
+      return sym->name;
+    }
+    i = (i + 1) & (lsym_cap - 1);
+  }
+
+  if ((lsym_count + 1) * 2 > lsym_cap) {
+    lsym_grow();
+  }
+  lsym* sym = malloc(sizeof(lsym) + strlen(name) + 1);
+  sym->hash = h;
+  sym->form = LFORM_NONE;
+  sym->local = 0;
+  strcpy(sym->name, name);
+  lsym_insert(sym);
+  lsym_count++;
+  return sym->name;
+}
+
+/* returns the unique copy of name */
+char* lsym_intern(char* name) {
+  if (lsym_table == NULL) {
+    /* first use, create the table and the names the evaluator checks for */
+    lsym_grow();
+    lsym_amp = lsym_lookup("&");
+    lsym_quasiquote = lsym_lookup("quasiquote");
+    lsym_splice = lsym_lookup("unquote-splicing");
+    lsym_unquote = lsym_lookup("unquote");
+    LSYM(lsym_lookup("defmacro"))->form = LFORM_DEFMACRO;
+    LSYM(lsym_lookup("do"))->form       = LFORM_DO;
+    LSYM(lsym_lookup("if"))->form       = LFORM_IF;
+    LSYM(lsym_lookup("read"))->form     = LFORM_READ;
+  }
+  return lsym_lookup(name);
+}
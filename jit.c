@@ -0,0 +1,531 @@
+#define _DEFAULT_SOURCE
+#include "lispy.h"
+
+/*
+ * Native code tier for the bytecode VM, enabled by lval_jit.
+ *
+ * vm.c counts the calls of each lambda body. Once a body has run
+ * lval_jit_threshold times it is handed to ljit_compile, which emits
+ * x86-64 for it if the lambda is a pure integer function: up to six
+ * formals, and a body made only of integer constants, formals, the
+ * arithmetic builtins, comparisons as conditions of 'if', and calls of
+ * the function to itself. Anything else is left to the interpreter.
+ *
+ * The native code works on raw longs and assumes what the names in the
+ * body mean. Before each entry ljit_run checks that the arguments are
+ * integers and that every name still resolves to the builtin, or to the
+ * function itself, that the code was compiled for. Formals are not
+ * allowed to shadow those names, so the check holds for the recursive
+ * calls made inside the native code as well. Calls to itself in tail
+ * position become jumps. The code does nothing but compute, so when it
+ * cannot continue (dividing by zero or by -1, a result too large for a
+ * long, or recursing too deep for the C stack) it bails out and the
+ * interpreter runs the call from the start.
+ */
+
+int lval_jit = 0;
+int lval_jit_threshold = 100;
+int lval_jit_dump = 0;
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+/* native frames a single entry may use before bailing out */
+#define LJIT_MAX_DEPTH 10000
+
+/* set by native code that could not finish */
+static long ljit_bail;
+/* frames left before bailing out */
+static long ljit_depth;
+
+typedef long (*ljit_fn)(long, long, long, long, long, long);
+
+/* a name the native code assumes the meaning of */
+typedef struct {
+  /* symbol in the body, looked up by ljit_run */
+  lval* sym;
+  /* builtin it must resolve to, NULL for the function itself */
+  lbuiltin fn;
+} ljit_name;
+
+struct ljit {
+  unsigned char* code;
+  size_t size;
+  ljit_fn entry;
+  int nformals;
+  char* formals[6];
+  int nnames;
+  ljit_name* names;
+};
+
+/* builtins the native code implements */
+enum {
+  JIT_IF, JIT_ADD, JIT_SUB, JIT_MUL, JIT_DIV, JIT_MOD,
+  JIT_EQ, JIT_NE, JIT_GT, JIT_LT, JIT_GTE, JIT_LTE, JIT_OPS
+};
+
+static struct {
+  char* name;
+  lbuiltin fn;
+  /* for comparisons, the second byte of the jcc taken when false */
+  unsigned char jfalse;
+} ljit_ops[JIT_OPS] = {
+  { "if", builtin_if,  0 },
+  { "+",  builtin_add, 0 },
+  { "-",  builtin_sub, 0 },
+  { "*",  builtin_mul, 0 },
+  { "/",  builtin_div, 0 },
+  { "%",  builtin_mod, 0 },
+  { "==", builtin_eq,  0x85 },
+  { "!=", builtin_ne,  0x84 },
+  { ">",  builtin_gt,  0x8e },
+  { "<",  builtin_lt,  0x8d },
+  { ">=", builtin_gte, 0x8c },
+  { "<=", builtin_lte, 0x8f }
+};
+
+/* argument registers in order: rdi, rsi, rdx, rcx, r8, r9 */
+static const int ljit_args[6] = { 7, 6, 2, 1, 8, 9 };
+
+/* code being generated */
+typedef struct {
+  unsigned char* buf;
+  int count;
+  int cap;
+  lval* formals;
+  /* offsets of the shared exits, the entry and the body */
+  int bail;
+  int exit;
+  int entry;
+  int body;
+  /* the name the function calls itself by */
+  char* self;
+  ljit_name* names;
+  int nnames;
+} ljit_gen;
+
+static void ljit_byte(ljit_gen* g, int b) {
+  if (g->count == g->cap) {
+    g->cap = g->cap ? g->cap * 2 : 256;
+    g->buf = realloc(g->buf, g->cap);
+  }
+  g->buf[g->count++] = b;
+}
+
+static void ljit_code(ljit_gen* g, char* s, int n) {
+  for (int i = 0; i < n; i++) {
+    ljit_byte(g, (unsigned char) s[i]);
+  }
+}
+
+static void ljit_imm32(ljit_gen* g, int x) {
+  for (int i = 0; i < 4; i++) {
+    ljit_byte(g, (x >> (8 * i)) & 0xff);
+  }
+}
+
+static void ljit_imm64(ljit_gen* g, long x) {
+  for (int i = 0; i < 8; i++) {
+    ljit_byte(g, (x >> (8 * i)) & 0xff);
+  }
+}
+
+/* points the rel32 ending at offset at, which was emitted as a placeholder, to to */
+static void ljit_patch(ljit_gen* g, int at, int to) {
+  int rel = to - at;
+  for (int i = 0; i < 4; i++) {
+    g->buf[at - 4 + i] = (rel >> (8 * i)) & 0xff;
+  }
+}
+
+/* jmp, call or jcc to an offset already emitted */
+static void ljit_jump(ljit_gen* g, char* op, int n, int to) {
+  ljit_code(g, op, n);
+  ljit_imm32(g, 0);
+  ljit_patch(g, g->count, to);
+}
+
+/* mov rdx, address */
+static void ljit_addr(ljit_gen* g, long* p) {
+  ljit_code(g, "\x48\xba", 2);
+  ljit_imm64(g, (long) p);
+}
+
+/* mov rax, [rbp - 8 * (slot + 1)] */
+static void ljit_load(ljit_gen* g, int slot) {
+  ljit_code(g, "\x48\x8b\x45", 3);
+  ljit_byte(g, -8 * (slot + 1));
+}
+
+/* mov [rbp - 8 * (slot + 1)], register r */
+static void ljit_store(ljit_gen* g, int slot, int r) {
+  ljit_byte(g, r >= 8 ? 0x4c : 0x48);
+  ljit_byte(g, 0x89);
+  ljit_byte(g, 0x45 | (r & 7) << 3);
+  ljit_byte(g, -8 * (slot + 1));
+}
+
+/* pop into register r */
+static void ljit_pop(ljit_gen* g, int r) {
+  if (r >= 8) {
+    ljit_byte(g, 0x41);
+  }
+  ljit_byte(g, 0x58 + (r & 7));
+}
+
+/* index of formal sym, or -1 */
+static int ljit_formal(ljit_gen* g, char* sym) {
+  for (int i = 0; i < g->formals->count; i++) {
+    if (g->formals->cell[i]->sym == sym) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* index in ljit_ops of the builtin sym names, or -1 */
+static int ljit_op(char* sym) {
+  for (int i = 0; i < JIT_OPS; i++) {
+    if (sym == lsym_intern(ljit_ops[i].name)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* records that the code depends on what sym means */
+static void ljit_depend(ljit_gen* g, lval* sym, lbuiltin fn) {
+  for (int i = 0; i < g->nnames; i++) {
+    if (g->names[i].sym->sym == sym->sym) {
+      return;
+    }
+  }
+  g->names = realloc(g->names, sizeof(ljit_name) * (g->nnames + 1));
+  g->names[g->nnames].sym = sym;
+  g->names[g->nnames].fn = fn;
+  g->nnames++;
+}
+
+static int ljit_sexpr(ljit_gen* g, lval** cells, int count, int tail);
+
+/* code leaving the integer value of x in rax, 0 if x is not supported */
+static int ljit_expr(ljit_gen* g, lval* x) {
+  switch (LTYPE(x)) {
+  case LVAL_INT:
+    ljit_code(g, "\x48\xb8", 2);
+    ljit_imm64(g, LNUM(x));
+    return 1;
+  case LVAL_SYM: {
+    int i = ljit_formal(g, x->sym);
+    if (i < 0) {
+      return 0;
+    }
+    ljit_load(g, i);
+    return 1;
+  }
+  case LVAL_SEXPR:
+    return ljit_sexpr(g, x->cell, x->count, 0);
+  }
+  return 0;
+}
+
+/* code jumping to the returned placeholder if comparison x is false */
+static int ljit_cond(ljit_gen* g, lval* x) {
+  if (LTYPE(x) != LVAL_SEXPR || x->count != 3
+      || LTYPE(x->cell[0]) != LVAL_SYM) {
+    return 0;
+  }
+  int op = ljit_op(x->cell[0]->sym);
+  if (op < JIT_EQ) {
+    return 0;
+  }
+  ljit_depend(g, x->cell[0], ljit_ops[op].fn);
+  if (!ljit_expr(g, x->cell[1])) {
+    return 0;
+  }
+  ljit_code(g, "\x50", 1);                      /* push rax */
+  if (!ljit_expr(g, x->cell[2])) {
+    return 0;
+  }
+  ljit_code(g, "\x48\x89\xc1\x58", 4);          /* mov rcx, rax; pop rax */
+  ljit_code(g, "\x48\x39\xc8\x0f", 4);          /* cmp rax, rcx; jcc */
+  ljit_byte(g, ljit_ops[op].jfalse);
+  ljit_imm32(g, 0);
+  return g->count;
+}
+
+static int ljit_branch(ljit_gen* g, lval* x, int tail) {
+  if (!ltype_expr(LTYPE(x))) {
+    return 0;
+  }
+  return ljit_sexpr(g, x->cell, x->count, tail);
+}
+
+/* code for the S-Expression made of cells, see ljit_expr */
+static int ljit_sexpr(ljit_gen* g, lval** cells, int count, int tail) {
+  if (count == 0) {
+    return 0;
+  }
+  if (count == 1) {
+    /* the value of a lone integer is itself */
+    return ljit_expr(g, cells[0]);
+  }
+  if (LTYPE(cells[0]) != LVAL_SYM) {
+    return 0;
+  }
+
+  char* sym = cells[0]->sym;
+  int op = ljit_op(sym);
+
+  if (op == JIT_IF) {
+    if (count != 4) {
+      return 0;
+    }
+    ljit_depend(g, cells[0], builtin_if);
+    int other = ljit_cond(g, cells[1]);
+    if (!other || !ljit_branch(g, cells[2], tail)) {
+      return 0;
+    }
+    ljit_code(g, "\xe9", 1);                    /* jmp end */
+    ljit_imm32(g, 0);
+    int end = g->count;
+    ljit_patch(g, other, g->count);
+    if (!ljit_branch(g, cells[3], tail)) {
+      return 0;
+    }
+    ljit_patch(g, end, g->count);
+    return 1;
+  }
+
+  if (op > JIT_IF && op < JIT_EQ) {
+    ljit_depend(g, cells[0], ljit_ops[op].fn);
+    if (!ljit_expr(g, cells[1])) {
+      return 0;
+    }
+    if (op == JIT_SUB && count == 2) {
+      ljit_code(g, "\x48\xf7\xd8", 3);          /* neg rax */
+      ljit_jump(g, "\x0f\x80", 2, g->bail);     /* jo bail */
+    }
+    for (int i = 2; i < count; i++) {
+      ljit_code(g, "\x50", 1);                  /* push rax */
+      if (!ljit_expr(g, cells[i])) {
+        return 0;
+      }
+      ljit_code(g, "\x48\x89\xc1\x58", 4);      /* mov rcx, rax; pop rax */
+      switch (op) {
+      case JIT_ADD: ljit_code(g, "\x48\x01\xc8", 3); break;
+      case JIT_SUB: ljit_code(g, "\x48\x29\xc8", 3); break;
+      case JIT_MUL: ljit_code(g, "\x48\x0f\xaf\xc1", 4); break;
+      default:
+        /* test rcx, rcx; jz bail; cmp rcx, -1; jz bail; cqo; idiv rcx */
+        ljit_code(g, "\x48\x85\xc9", 3);
+        ljit_jump(g, "\x0f\x84", 2, g->bail);
+        ljit_code(g, "\x48\x83\xf9\xff", 4);
+        ljit_jump(g, "\x0f\x84", 2, g->bail);
+        ljit_code(g, "\x48\x99\x48\xf7\xf9", 5);
+        if (op == JIT_MOD) {
+          ljit_code(g, "\x48\x89\xd0", 3);      /* mov rax, rdx */
+        }
+      }
+      if (op < JIT_DIV) {
+        ljit_jump(g, "\x0f\x80", 2, g->bail);   /* jo bail */
+      }
+    }
+    return 1;
+  }
+
+  /* anything else must be a call of the function to itself */
+  if (op >= 0 || ljit_formal(g, sym) >= 0 || count - 1 != g->formals->count
+      || LSYM(sym)->form != LFORM_NONE
+      || (g->self && g->self != sym)) {
+    return 0;
+  }
+  g->self = sym;
+  ljit_depend(g, cells[0], NULL);
+  for (int i = 1; i < count; i++) {
+    if (!ljit_expr(g, cells[i])) {
+      return 0;
+    }
+    ljit_code(g, "\x50", 1);                    /* push rax */
+  }
+  if (tail) {
+    /* reuse the frame and start again */
+    for (int i = count - 2; i >= 0; i--) {
+      ljit_code(g, "\x58", 1);                  /* pop rax */
+      ljit_store(g, i, 0);
+    }
+    ljit_jump(g, "\xe9", 1, g->body);
+    return 1;
+  }
+  for (int i = count - 2; i >= 0; i--) {
+    ljit_pop(g, ljit_args[i]);
+  }
+  ljit_jump(g, "\xe8", 1, g->entry);
+  /* leave at once if the call bailed out */
+  ljit_addr(g, &ljit_bail);
+  ljit_code(g, "\x48\x83\x3a\x00", 4);          /* cmp qword [rdx], 0 */
+  ljit_jump(g, "\x0f\x85", 2, g->exit);
+  return 1;
+}
+
+/* hex dump of the code generated for f */
+static void ljit_dump(ljit* j, lval* f) {
+  printf("jit: ");
+  lval_print(f);
+  printf(", %li bytes, entry at %04lx\n",
+         (long) j->size, (long) ((unsigned char*) j->entry - j->code));
+  for (size_t i = 0; i < j->size; i++) {
+    if (i % 16 == 0) {
+      printf("  %04lx:", (long) i);
+    }
+    printf(" %02x", j->code[i]);
+    if (i % 16 == 15 || i == j->size - 1) {
+      printf("\n");
+    }
+  }
+}
+
+ljit* ljit_compile(lval* f) {
+  lval* formals = f->formals;
+  if (formals->count > 6) {
+    return NULL;
+  }
+  for (int i = 0; i < formals->count; i++) {
+    char* sym = formals->cell[i]->sym;
+    if (sym == lsym_amp || LSYM(sym)->form != LFORM_NONE
+        || ljit_op(sym) >= 0) {
+      return NULL;
+    }
+    for (int k = 0; k < i; k++) {
+      if (formals->cell[k]->sym == sym) {
+        return NULL;
+      }
+    }
+  }
+
+  ljit_gen g = { 0 };
+  g.formals = formals;
+
+  /* bail: mov qword [ljit_bail], 1 and fall into the exit */
+  g.bail = g.count;
+  ljit_addr(&g, &ljit_bail);
+  ljit_code(&g, "\x48\xc7\x02\x01\x00\x00\x00", 7);
+  /* exit: add qword [ljit_depth], 1; leave; ret */
+  g.exit = g.count;
+  ljit_addr(&g, &ljit_depth);
+  ljit_code(&g, "\x48\x83\x02\x01\xc9\xc3", 6);
+
+  /* entry: push rbp; mov rbp, rsp; sub rsp, 8 * formals */
+  g.entry = g.count;
+  ljit_code(&g, "\x55\x48\x89\xe5\x48\x83\xec", 7);
+  ljit_byte(&g, 8 * formals->count);
+  for (int i = 0; i < formals->count; i++) {
+    ljit_store(&g, i, ljit_args[i]);
+  }
+  /* sub qword [ljit_depth], 1; jz bail */
+  ljit_addr(&g, &ljit_depth);
+  ljit_code(&g, "\x48\x83\x2a\x01", 4);
+  ljit_jump(&g, "\x0f\x84", 2, g.bail);
+
+  g.body = g.count;
+  lval* body = f->body;
+  if (!ljit_sexpr(&g, body->cell, body->count, 1)) {
+    free(g.buf);
+    free(g.names);
+    return NULL;
+  }
+  ljit_jump(&g, "\xe9", 1, g.exit);
+
+  unsigned char* code = mmap(NULL, g.count, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    free(g.buf);
+    free(g.names);
+    return NULL;
+  }
+  memcpy(code, g.buf, g.count);
+  mprotect(code, g.count, PROT_READ | PROT_EXEC);
+  free(g.buf);
+
+  ljit* j = malloc(sizeof(ljit));
+  j->code = code;
+  j->size = g.count;
+  j->entry = (ljit_fn) (code + g.entry);
+  j->nformals = formals->count;
+  for (int i = 0; i < formals->count; i++) {
+    j->formals[i] = formals->cell[i]->sym;
+  }
+  j->nnames = g.nnames;
+  j->names = g.names;
+
+  if (lval_jit_dump) {
+    ljit_dump(j, f);
+  }
+  return j;
+}
+
+/* whether the code j was compiled from f's body can run f */
+static int ljit_guard(ljit* j, lval* f, lenv* e) {
+  if (f->formals->count != j->nformals) {
+    return 0;
+  }
+  for (int i = 0; i < j->nformals; i++) {
+    if (f->formals->cell[i]->sym != j->formals[i] || i >= e->count
+        || e->syms[i] != j->formals[i] || LTYPE(e->vals[i]) != LVAL_INT) {
+      return 0;
+    }
+  }
+  for (int i = 0; i < j->nnames; i++) {
+    lval* x = lenv_get(e, j->names[i].sym);
+    int ok = LTYPE(x) == LVAL_FUN && x->builtin == j->names[i].fn;
+    if (ok && x->builtin == NULL) {
+      ok = x->args == NULL && x->body == f->body
+        && x->formals->count == j->nformals;
+      for (int k = 0; ok && k < j->nformals; k++) {
+        ok = x->formals->cell[k]->sym == j->formals[k];
+      }
+    }
+    lval_del(x);
+    if (!ok) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int ljit_run(ljit* j, lval* f, lenv* e, long* result) {
+  if (!ljit_guard(j, f, e)) {
+    return 0;
+  }
+  long a[6] = { 0 };
+  for (int i = 0; i < j->nformals; i++) {
+    a[i] = LNUM(e->vals[i]);
+  }
+  ljit_bail = 0;
+  ljit_depth = LJIT_MAX_DEPTH;
+  *result = j->entry(a[0], a[1], a[2], a[3], a[4], a[5]);
+  return ljit_bail ? -1 : 1;
+}
+
+void ljit_del(ljit* j) {
+  munmap(j->code, j->size);
+  free(j->names);
+  free(j);
+}
+
+#else
+
+/* no native code generator for this architecture */
+ljit* ljit_compile(lval* f) {
+  return NULL;
+}
+
+int ljit_run(ljit* j, lval* f, lenv* e, long* result) {
+  return 0;
+}
+
+void ljit_del(ljit* j) {
+}
+
+#endif
@@ -1,47 +1,133 @@
 #include "lispy.h"
 
+/*
+ * Bindings are kept in insertion order in syms/vals. Function frames
+ * only bind a handful of names and are scanned linearly; once an
+ * environment grows past LENV_SMALL entries (in practice the global
+ * one) an open-addressed index keyed on the symbol hash is built
+ * alongside the arrays.
+ */
+#define LENV_SMALL 8
+
+static void lenv_index_insert(lenv* e, int slot) {
+  unsigned long mask = e->index_cap - 1;
+  unsigned long i = LSYM(e->syms[slot])->hash & mask;
+  while (e->index[i]) {
+    i = (i + 1) & mask;
+  }
+  e->index[i] = slot + 1;
+}
+
+/* rebuild the index large enough to stay at most half full */
+static void lenv_reindex(lenv* e) {
+  lpool_free(e->index, sizeof(int) * e->index_cap);
+  e->index_cap = 32;
+  while (e->index_cap < e->count * 2) {
+    e->index_cap *= 2;
+  }
+  e->index = lpool_alloc(sizeof(int) * e->index_cap);
+  gc_grow(sizeof(int) * e->index_cap);
+  memset(e->index, 0, sizeof(int) * e->index_cap);
+  for (int i = 0; i < e->count; i++) {
+    lenv_index_insert(e, i);
+  }
+}
+
+/* returns the slot binding sym in e alone, or -1 */
+static int lenv_find(lenv* e, char* sym) {
+  if (e->index) {
+    unsigned long mask = e->index_cap - 1;
+    unsigned long i = LSYM(sym)->hash & mask;
+    while (e->index[i]) {
+      int slot = e->index[i] - 1;
+      if (e->syms[slot] == sym) {
+        return slot;
+      }
+      i = (i + 1) & mask;
+    }
+    return -1;
+  }
+  for (int i = 0; i < e->count; i++) {
+    if (e->syms[i] == sym) {
+      return i;
+    }
+  }
+  return -1;
+}
+
 lenv* lenv_new(void) {
-  lenv* e = malloc(sizeof(lenv));
+  lenv* e = lpool_alloc(sizeof(lenv));
+#ifdef LISPY_GC
+  gc_track_lenv(e);
+#endif
   e->par = NULL;
+  e->root = e;
   e->count = 0;
   e->syms = NULL;
   e->vals = NULL;
+  e->index = NULL;
+  e->index_cap = 0;
   return e;
 }
 
 void lenv_del(lenv* e) {
+#ifdef LISPY_GC
+  /* unreachable environments are freed by the collector */
+  return;
+#endif
   for (int i = 0; i < e->count; i++) {
-    free(e->syms[i]);
     lval_del(e->vals[i]);
   }
-  free(e->syms);
-  free(e->vals);
-  free(e);
+  lpool_free(e->syms, sizeof(char*) * e->count);
+  lpool_free(e->vals, sizeof(lval*) * e->count);
+  lpool_free(e->index, sizeof(int) * e->index_cap);
+  lpool_free(e, sizeof(lenv));
 }
 
 lval* lenv_get(lenv* e, lval* k) {
-  for (int i = 0; i < e->count; i++) {
-    if (strcmp(e->syms[i], k->sym) == 0) {
-      return lval_copy(e->vals[i]);
-    }
+  /* formals resolved by lval_lambda are usually at their slot */
+  if (k->slot >= 0 && k->slot < e->count && e->syms[k->slot] == k->sym) {
+    return lval_ref(e->vals[k->slot]);
   }
-  if (e->par) {
-    return lenv_get(e->par, k);
-  } else {
-    return lval_err("unbound symbol '%s'", k->sym);
+  if (!LSYM(k->sym)->local) {
+    /* bound nowhere but the global environment, see lenv_set */
+    e = e->root;
   }
+  for (; e; e = e->par) {
+    int i = lenv_find(e, k->sym);
+    if (i >= 0) {
+      return lval_ref(e->vals[i]);
+    }
+  }
+  return lval_err("unbound symbol '%s'", k->sym);
+}
+
+/* the macro sym names in the global environment of e, or NULL */
+lval* lenv_macro(lenv* e, char* sym) {
+  e = e->root;
+  int i = lenv_find(e, sym);
+  return i >= 0 && LTYPE(e->vals[i]) == LVAL_MACRO ? e->vals[i] : NULL;
 }
 
 lenv* lenv_copy(lenv* e) {
-  lenv* n = malloc(sizeof(lenv));
+  lenv* n = lpool_alloc(sizeof(lenv));
+#ifdef LISPY_GC
+  gc_track_lenv(n);
+#endif
   n->par = e->par;
+  n->root = e->par ? e->root : n;
   n->count = e->count;
-  n->syms = malloc(sizeof(char*) * n->count);
-  n->vals = malloc(sizeof(lval*) * n->count);
+  n->syms = lpool_alloc(sizeof(char*) * n->count);
+  n->vals = lpool_alloc(sizeof(lval*) * n->count);
+  gc_grow((sizeof(char*) + sizeof(lval*)) * n->count);
   for (int i = 0; i < e->count; i++) {
-    n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-    strcpy(n->syms[i], e->syms[i]);
-    n->vals[i] = lval_copy(e->vals[i]);
+    n->syms[i] = e->syms[i];
+    n->vals[i] = lval_ref(e->vals[i]);
+  }
+  n->index = NULL;
+  n->index_cap = 0;
+  if (e->index) {
+    lenv_reindex(n);
   }
   return n;
 }
@@ -58,11 +144,14 @@ void lenv_add_builtins(lenv* e) {
   lenv_add_builtin(e, "list",     builtin_list);
   lenv_add_builtin(e, "head",     builtin_head);
   lenv_add_builtin(e, "tail",     builtin_tail);
+  lenv_add_builtin(e, "take",     builtin_take);
+  lenv_add_builtin(e, "drop",     builtin_drop);
   lenv_add_builtin(e, "eval",     builtin_eval);
   lenv_add_builtin(e, "join",     builtin_join);
   lenv_add_builtin(e, "def",      builtin_def);
   lenv_add_builtin(e, "defmacro", builtin_defmacro);
   lenv_add_builtin(e, "error",    builtin_err);
+  lenv_add_builtin(e, "print",    builtin_print);
   lenv_add_builtin(e, "fun",      builtin_fun);
   lenv_add_builtin(e, "read",     builtin_read);
   lenv_add_builtin(e, "parse",    builtin_parse);
@@ -80,36 +169,126 @@ void lenv_add_builtins(lenv* e) {
   lenv_add_builtin(e, "<=",       builtin_lte);
   lenv_add_builtin(e, ">=",       builtin_gte);
   lenv_add_builtin(e, "if",       builtin_if);
+  lenv_add_builtin(e, "do",       builtin_do);
+  lenv_add_builtin(e, "let",      builtin_let);
+  lenv_add_builtin(e, "select",   builtin_select);
+  lenv_add_builtin(e, "case",     builtin_case);
   lenv_add_builtin(e, "!",        builtin_not);
   lenv_add_builtin(e, "&&",       builtin_and);
   lenv_add_builtin(e, "||",       builtin_or);
   lenv_add_builtin(e, "load",     builtin_load);
+  lenv_add_builtin(e, "vec",      builtin_vec);
+  lenv_add_builtin(e, "vec-list", builtin_vec_list);
+  lenv_add_builtin(e, "vec-len",  builtin_vec_len);
+  lenv_add_builtin(e, "vec-sum",  builtin_vec_sum);
+  lenv_add_builtin(e, "vec-min",  builtin_vec_min);
+  lenv_add_builtin(e, "vec-max",  builtin_vec_max);
+  lenv_add_builtin(e, "vec-dot",  builtin_vec_dot);
+  lenv_add_builtin(e, "hash-map", builtin_hash_map);
+  lenv_add_builtin(e, "map-get",  builtin_map_get);
+  lenv_add_builtin(e, "map-put",  builtin_map_put);
+  lenv_add_builtin(e, "map-del",  builtin_map_del);
+  lenv_add_builtin(e, "map-has",  builtin_map_has);
+  lenv_add_builtin(e, "map-len",  builtin_map_len);
+  lenv_add_builtin(e, "map-keys", builtin_map_keys);
+  lenv_add_builtin(e, "map-vals", builtin_map_vals);
+  lenv_add_builtin(e, "hash-set", builtin_hash_set);
+  lenv_add_builtin(e, "set-add",  builtin_set_add);
+  lenv_add_builtin(e, "set-del",  builtin_set_del);
+  lenv_add_builtin(e, "set-has",  builtin_set_has);
+  lenv_add_builtin(e, "set-len",  builtin_set_len);
+  lenv_add_builtin(e, "set-list", builtin_set_list);
+  lenv_add_builtin(e, "pmap",      builtin_pmap);
+  lenv_add_builtin(e, "pvec",      builtin_pvec);
+  lenv_add_builtin(e, "pvec-get",  builtin_pvec_get);
+  lenv_add_builtin(e, "pvec-set",  builtin_pvec_set);
+  lenv_add_builtin(e, "pvec-push", builtin_pvec_push);
+  lenv_add_builtin(e, "pvec-pop",  builtin_pvec_pop);
+  lenv_add_builtin(e, "pvec-len",  builtin_pvec_len);
+  lenv_add_builtin(e, "pvec-list", builtin_pvec_list);
+  lenv_add_builtin(e, "quasiquote", builtin_quasiquote);
+  lenv_add_builtin(e, "unquote", builtin_unquote);
+  lenv_add_builtin(e, "unquote-splicing", builtin_unquote);
+  lenv_add_builtin(e, "macro-stats", builtin_macro_stats);
+  lenv_add_builtin(e, "pool-stats", builtin_pool_stats);
+#ifdef LISPY_GC
+  lenv_add_builtin(e, "gc-stats", builtin_gc_stats);
+#endif
 }
 
-void lenv_put(lenv* e, lval* k, lval* v) {
+static void lenv_set(lenv* e, char* sym, lval* v) {
+  if (e->par && !LSYM(sym)->local) {
+    /* optimized bodies assumed the name always meant the global */
+    LSYM(sym)->local = 1;
+    lval_epoch++;
+  }
   /* check and see if variable already exists */
-  for (int i = 0; i < e->count; i++) {
+  int i = lenv_find(e, sym);
+  if (i >= 0) {
     /* if we find an existing match, replace */
-    if (strcmp(e->syms[i], k->sym) == 0) {
-      lval_del(e->vals[i]);
-      e->vals[i] = lval_copy(v);
-      return;
+    lval* old = e->vals[i];
+    if (!e->par && LSYM(sym)->form != LFORM_NONE) {
+      /* the form may no longer be its builtin, see lval_form */
+      LSYM(sym)->local = 1;
     }
+    if (!e->par && (LTYPE(old) == LVAL_FUN || LTYPE(v) == LVAL_FUN
+                    || LTYPE(old) == LVAL_MACRO || LTYPE(v) == LVAL_MACRO)) {
+      /* a function optimized bodies may have folded or inlined changed,
+         or a macro they expanded */
+      lval_epoch++;
+    }
+    e->vals[i] = lval_ref(v);
+    lval_del(old);
+    return;
+  }
+  if (!e->par && LTYPE(v) == LVAL_MACRO) {
+    /* bodies expanded before it was defined may call it */
+    lval_epoch++;
   }
   /* no matching entry, so allocate space */
   e->count++;
-  e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-  e->syms = realloc(e->syms, sizeof(char*) * e->count);
+  e->vals = lpool_resize(e->vals, sizeof(lval*) * (e->count - 1),
+                         sizeof(lval*) * e->count);
+  e->syms = lpool_resize(e->syms, sizeof(char*) * (e->count - 1),
+                         sizeof(char*) * e->count);
+  gc_grow(sizeof(char*) + sizeof(lval*));
+
+  /* share lval into new location */
+  e->vals[e->count - 1] = lval_ref(v);
+  e->syms[e->count - 1] = sym;
 
-  /* copy lval into new location */
-  e->vals[e->count - 1] = lval_copy(v);
-  e->syms[e->count - 1] = malloc(strlen(k->sym) + 1);
-  strcpy(e->syms[e->count - 1], k->sym);
+  if (e->index && e->count * 2 <= e->index_cap) {
+    lenv_index_insert(e, e->count - 1);
+  } else if (e->count > LENV_SMALL) {
+    lenv_reindex(e);
+  }
 }
 
-void lenv_def(lenv* e, lval* k, lval* v) {
-  while (e->par) {
-    e = e->par;
+void lenv_put(lenv* e, lval* k, lval* v) {
+  lenv_set(e, k->sym, v);
+}
+
+/*
+ * Lets e replace old, its parent, so old can be freed on a tail call.
+ * Bindings of old that e does not shadow are copied into e, after any
+ * e already has, and e takes over old's parent, so lookups from e see
+ * the same values as before.
+ */
+void lenv_inherit(lenv* e, lenv* old) {
+  for (int i = 0; i < old->count; i++) {
+    if (lenv_find(e, old->syms[i]) < 0) {
+      lenv_set(e, old->syms[i], old->vals[i]);
+    }
   }
-  lenv_put(e, k, v);
+  e->par = old->par;
+}
+
+/* makes par the parent of e, which then shares its global environment */
+void lenv_parent(lenv* e, lenv* par) {
+  e->par = par;
+  e->root = par ? par->root : e;
+}
+
+void lenv_def(lenv* e, lval* k, lval* v) {
+  lenv_put(e->root, k, v);
 }
@@ -1,10 +1,20 @@
+#include <stddef.h>
+#include <stdint.h>
 #include "mpc.h"
 
 struct lval;
 struct lenv;
+struct lchunk;
+struct ljit;
+struct lentry;
+struct lbody;
 
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lchunk lchunk;
+typedef struct ljit ljit;
+typedef struct lentry lentry;
+typedef struct lbody lbody;
 
 enum {
       LVAL_ERR,
@@ -16,7 +26,15 @@ enum {
       LVAL_SEXPR,
       LVAL_QEXPR,
       LVAL_BOOL,
-      LVAL_STR
+      LVAL_STR,
+      LVAL_BIGINT,
+      LVAL_MACRO,
+      LVAL_VEC,
+      LVAL_MAP,
+      LVAL_SET,
+      LVAL_PMAP,
+      LVAL_PVEC,
+      LVAL_NODE
 };
 
 enum { LERR_DIV_ZERO, LERR_BAD_OP, LERR_BAD_NUM };
@@ -33,6 +51,9 @@ mpc_parser_t* Symbol;
 mpc_parser_t* Sexpr;
 mpc_parser_t* Qexpr;
 mpc_parser_t* List;
+mpc_parser_t* Quasi;
+mpc_parser_t* Unquote;
+mpc_parser_t* Splice;
 mpc_parser_t* Expr;
 mpc_parser_t* Lispy;
 
@@ -41,76 +62,384 @@ mpc_parser_t* Lispy;
  * Base container for all values in the language.
  * Can contain a raw value, or a list of other lvals
  * in the cells field.
+ *
+ * Only one payload is ever used at a time, so they share storage. What
+ * a list caches when it is run as a function body is kept out of line,
+ * see struct lbody, so no payload is over four pointers long.
  */
 struct lval {
   /* enumerated type of LVAL_* */
   int type;
+  /* number of owners, shared values must not be modified */
+  int refs;
+#ifdef LISPY_GC
+  /* set while tracing if the value is reachable */
+  int marked;
+#endif
 
-  /* Used if type == LVAL_INT */
-  long     num;
-  /* Used if type == LVAL_FLOAT */
-  double  fnum;
-
-  /* Used if type == LVAL_ERR */
-  char*    err;
-  /* Used if type == LVAL_SYM */
-  char*    sym;
-  /* Used if type == LVAL_STR */
-  char*    str;
-
-  /* Used if type == LVAL_FUN */
-  lbuiltin builtin;
-  /* Used to evaluate variables in functions */
-  lenv*    env;
-  /* Used to define arguments for functions */
-  lval*    formals;
-  /* Used to define a function body */
-  lval*    body;
-  
-  int count;
-  struct lval** cell;
+  union {
+    /* Used if type == LVAL_INT or LVAL_BOOL */
+    long     num;
+    /* Used if type == LVAL_FLOAT */
+    double  fnum;
+    /* Used if type == LVAL_BIGINT, see bignum.c */
+    struct {
+      /* number of digits, never 0 */
+      int       len;
+      /* 1 if negative */
+      int       neg;
+      /* base 2^32 digits, least significant first */
+      uint32_t* digits;
+    };
+
+    /* Used if type == LVAL_VEC, see vec.c */
+    struct {
+      /* number of elements */
+      int      vlen;
+      /* 1 if the elements are doubles, 0 if longs */
+      int      vfloat;
+      union {
+        long*   vints;
+        double* vfloats;
+      };
+      /* vector whose elements these are a run of, NULL if they are owned */
+      struct lval* vbase;
+    };
+
+    /* Used if type == LVAL_MAP or LVAL_SET, see map.c */
+    struct {
+      /* number of keys */
+      int      mlen;
+      /* entries used, counting those of deleted keys */
+      int      mused;
+      /* room for entries, the index has twice as many slots */
+      int      mcap;
+      /* entries in insertion order */
+      lentry*  mentries;
+      /* open-addressed index of entry numbers plus one, 0 if empty */
+      int*     mindex;
+    };
+
+    /* Used if type == LVAL_PMAP or LVAL_PVEC, see trie.c */
+    struct {
+      /* number of keys or items */
+      long     plen;
+      /* bits of an index a vector's root node takes */
+      int      pshift;
+      /* root node, NULL while there is none */
+      struct lval* proot;
+      /* node of a vector's last items, up to 32 of them */
+      struct lval* ptail;
+    };
+
+    /* Used if type == LVAL_NODE, a node shared between tries, see trie.c */
+    struct {
+      /* branches of a map node holding an entry, or a node */
+      uint32_t ndata;
+      uint32_t nnodes;
+      /* kids used, and room for them */
+      int      nlen;
+      int      ncap;
+      struct lval** nkids;
+    };
+
+    /* Used if type == LVAL_ERR */
+    char*    err;
+    /* Used if type == LVAL_SYM */
+    struct {
+      /* interned name */
+      char*    sym;
+      /* frame slot of the formal this refers to, -1 if not a formal */
+      int      slot;
+      /* LFORM_* of the name, copied from its lsym */
+      int      form;
+    };
+    /* Used if type == LVAL_STR */
+    char*    str;
+
+    /* Used if type == LVAL_FUN, or LVAL_MACRO with builtin and args NULL */
+    struct {
+      lbuiltin builtin;
+      /* arguments supplied by partial application, or NULL */
+      lval*    args;
+      /* Used to define arguments for functions */
+      lval*    formals;
+      /* Used to define a function body */
+      lval*    body;
+    };
+
+    /* Used if type == LVAL_SEXPR or LVAL_QEXPR */
+    struct {
+      int count;
+      /* number of cells there is room for, see lval_reserve */
+      int cap;
+      struct lval** cell;
+      /* list whose cells these are a run of, NULL if they are owned */
+      struct lval* base;
+      /* what running the list as a function body made, NULL if never */
+      lbody* cache;
+    };
+  };
+};
+
+/*
+ * Made the first time a list is run as the body of a lambda or macro,
+ * so that the lists which never are carry just the pointer to it.
+ */
+struct lbody {
+  /* lval_epoch opt was made in, 0 if never, see opt.c */
+  int epoch;
+  /* optimized copy of the body, NULL if it is the same */
+  lval* opt;
+  /* bytecode compiled from the body, see vm.c */
+  lchunk* chunk;
 };
 
+/*
+ * Immediates: integers that fit in 63 bits, booleans and OK are held in
+ * the lval* itself rather than allocated. Pool blocks are 8 byte
+ * aligned, so a pointer to an allocated lval never has its low bits set:
+ *
+ *   ...value 1       an LVAL_INT, shifted left by one
+ *   ...value type 10 an LVAL_BOOL or LVAL_OK, the type in bits 2 to 7
+ *                    and the value from bit 8 up
+ *
+ * Only the type and num of an immediate can be read, through LTYPE and
+ * LNUM. lval_ref, lval_del, lval_copy and lval_mut return or drop them
+ * as they are, so they need no reference count.
+ */
+#define LVAL_IMM(v)     ((uintptr_t) (v) & 3)
+#define LVAL_IMM_MIN    (-(1L << 62))
+#define LVAL_IMM_MAX    ((1L << 62) - 1)
+#define LVAL_IMM_OF(type, x) \
+  ((lval*) (((uintptr_t) (x) << 8) | ((uintptr_t) (type) << 2) | 2))
+
+/* type of v, which may be an immediate; evaluates v more than once */
+#define LTYPE(v)                                             \
+  (LVAL_IMM(v) ? ((uintptr_t) (v) & 1 ? LVAL_INT              \
+                  : (int) ((uintptr_t) (v) >> 2 & 63))       \
+   : (v)->type)
+
+/* num of v, an LVAL_INT or LVAL_BOOL which may be an immediate */
+#define LNUM(v)                                              \
+  ((uintptr_t) (v) & 1 ? (long) ((intptr_t) (v) >> 1)        \
+   : (uintptr_t) (v) & 2 ? (long) ((intptr_t) (v) >> 8)      \
+   : (v)->num)
+
+/*
+ * Special forms, whose arguments are not all evaluated. Which one a
+ * symbol names is decided once, when the name is interned, so the
+ * evaluator dispatches on an integer. A name is only special while it
+ * means the builtin of its form, see lval_form.
+ */
+enum { LFORM_NONE, LFORM_IF, LFORM_READ, LFORM_DEFMACRO, LFORM_DO };
+
+/*
+ * Interned symbol:
+ * One record per distinct symbol name. Symbol lvals and environments
+ * hold pointers to the name, which identify the symbol, and LSYM gets
+ * back to the record.
+ */
+typedef struct lsym {
+  unsigned long hash;
+  /* LFORM_* the name is */
+  int form;
+  /*
+   * set once the name has been bound anywhere but the global scope, or
+   * if it names a form, rebound there
+   */
+  int local;
+  char name[];
+} lsym;
+
+#define LSYM(s) ((lsym*) ((s) - offsetof(lsym, name)))
+
+/* well known symbols, compared by pointer */
+extern char* lsym_amp;
+extern char* lsym_quasiquote;
+extern char* lsym_splice;
+extern char* lsym_unquote;
+
+/* evaluators lval_eval can use, selected by lval_engine */
+enum { LVAL_ENGINE_TREE, LVAL_ENGINE_CEK, LVAL_ENGINE_VM };
+
+extern int lval_engine;
+/* most frames the cek engine, or the vm engine's calls, may hold */
+extern int lval_cek_max_depth;
+/* whether the vm engine compiles hot functions to native code, see jit.c */
+extern int lval_jit;
+/* calls of a function before it is compiled to native code */
+extern int lval_jit_threshold;
+/* whether to print the native code generated */
+extern int lval_jit_dump;
+/* whether lambda bodies are optimized before they run, see opt.c */
+extern int lval_opt;
+/* bumped whenever a change may invalidate an optimized body */
+extern int lval_epoch;
+/* whether vector kernels may use SIMD instructions, see vec.c */
+extern int lval_simd;
+
 struct lenv {
+#ifdef LISPY_GC
+  int marked;
+#endif
   lenv* par;
+  /* the global environment the chain of parents ends in, see lenv_parent */
+  lenv* root;
   int count;
+  /* interned symbol names */
   char** syms;
   lval** vals;
+  /* hash index of slot + 1 into syms/vals, NULL for small environments */
+  int* index;
+  int index_cap;
 };
 
 lval* builtin_add(lenv* e, lval* a);
 lval* builtin_and(lenv* e, lval* a);
-lval* builtin_cmp(lenv* e, lval* a, char* op);
+lval* builtin_case(lenv* e, lval* a);
+lval* builtin_case_branch(lenv* e, lval* a);
+lval* builtin_case_table(lenv* e, lval* a);
+lval* builtin_case_table_branch(lenv* e, lval* a);
 lval* builtin_def(lenv* e, lval* a);
 lval* builtin_defmacro(lenv* e, lval* a);
 lval* builtin_div(lenv* e, lval* a);
+lval* builtin_do(lenv* e, lval* a);
+lval* builtin_do_expr(lenv* e, lval* a);
+lval* builtin_drop(lenv* e, lval* a);
 lval* builtin_eq(lenv* e, lval* a);
 lval* builtin_err(lenv* e, lval* a);
 lval* builtin_eval(lenv* e, lval* a);
+lval* builtin_eval_expr(lenv* e, lval* a);
 lval* builtin_fun(lenv* e, lval* a);
 lval* builtin_gt(lenv* e, lval* a);
 lval* builtin_gte(lenv* e, lval* a);
+lval* builtin_hash_map(lenv* e, lval* a);
+lval* builtin_hash_set(lenv* e, lval* a);
 lval* builtin_head(lenv* e, lval* a);
 lval* builtin_if(lenv* e, lval* a);
+lval* builtin_if_branch(lenv* e, lval* a);
 lval* builtin_join(lenv* e, lval* a);
 lval* builtin_lambda(lenv* e, lval* a);
+lval* builtin_let(lenv* e, lval* a);
+lval* builtin_let_expr(lenv* e, lval* a);
 lval* builtin_list(lenv* e, lval* a);
 lval* builtin_load(lenv* e, lval* a);
 lval* builtin_lt(lenv* e, lval* a);
 lval* builtin_lte(lenv* e, lval* a);
+lval* builtin_macro_stats(lenv* e, lval* a);
+lval* builtin_map_del(lenv* e, lval* a);
+lval* builtin_map_get(lenv* e, lval* a);
+lval* builtin_map_has(lenv* e, lval* a);
+lval* builtin_map_keys(lenv* e, lval* a);
+lval* builtin_map_len(lenv* e, lval* a);
+lval* builtin_map_put(lenv* e, lval* a);
+lval* builtin_map_vals(lenv* e, lval* a);
 lval* builtin_mod(lenv* e, lval* a);
 lval* builtin_mul(lenv* e, lval* a);
 lval* builtin_ne(lenv* e, lval* a);
 lval* builtin_not(lenv* e, lval* a);
-lval* builtin_op(lenv* e, lval* a, char* op);
 lval* builtin_or(lenv* e, lval* a);
-lval* builtin_ord(lenv* e, lval* a, char* op);
 lval* builtin_parse(lenv* e, lval* a);
+lval* builtin_pmap(lenv* e, lval* a);
+lval* builtin_pool_stats(lenv* e, lval* a);
+lval* builtin_print(lenv* e, lval* a);
+lval* builtin_pvec(lenv* e, lval* a);
+lval* builtin_pvec_get(lenv* e, lval* a);
+lval* builtin_pvec_len(lenv* e, lval* a);
+lval* builtin_pvec_list(lenv* e, lval* a);
+lval* builtin_pvec_pop(lenv* e, lval* a);
+lval* builtin_pvec_push(lenv* e, lval* a);
+lval* builtin_pvec_set(lenv* e, lval* a);
 lval* builtin_put(lenv* e, lval* a);
+lval* builtin_quasiquote(lenv* e, lval* a);
 lval* builtin_read(lenv* e, lval* a);
+lval* builtin_select(lenv* e, lval* a);
+lval* builtin_select_branch(lenv* e, lval* a);
+lval* builtin_set_add(lenv* e, lval* a);
+lval* builtin_set_del(lenv* e, lval* a);
+lval* builtin_set_has(lenv* e, lval* a);
+lval* builtin_set_len(lenv* e, lval* a);
+lval* builtin_set_list(lenv* e, lval* a);
 lval* builtin_sub(lenv* e, lval* a);
 lval* builtin_tail(lenv* e, lval* a);
-lval* builtin_var(lenv* e, lval* a, char* func);
+lval* builtin_take(lenv* e, lval* a);
+lval* builtin_unquote(lenv* e, lval* a);
+lval* builtin_var(lenv* e, lval* a, char* func,
+                  void (*put)(lenv*, lval*, lval*));
+lval* builtin_vec(lenv* e, lval* a);
+lval* builtin_vec_dot(lenv* e, lval* a);
+lval* builtin_vec_len(lenv* e, lval* a);
+lval* builtin_vec_list(lenv* e, lval* a);
+lval* builtin_vec_max(lenv* e, lval* a);
+lval* builtin_vec_min(lenv* e, lval* a);
+lval* builtin_vec_sum(lenv* e, lval* a);
+
+/* operators of the arithmetic and ordering builtins */
+enum { LOP_ADD, LOP_SUB, LOP_MUL, LOP_DIV, LOP_MOD,
+       LOP_GT, LOP_LT, LOP_GTE, LOP_LTE };
+
+lval*  lbig_add(lval* x, lval* y);
+int    lbig_cmp(lval* x, lval* y);
+lval*  lbig_div(lval* x, lval* y);
+lval*  lbig_mod(lval* x, lval* y);
+lval*  lbig_mul(lval* x, lval* y);
+lval*  lbig_neg(lval* x);
+lval*  lbig_read(char* s);
+char*  lbig_str(lval* x);
+lval*  lbig_sub(lval* x, lval* y);
+double lbig_to_double(lval* x);
+
+/* bytes an element of the vector v takes */
+#define LVEC_SIZE(v) ((v)->vfloat ? sizeof(double) : sizeof(long))
+
+lval* lvec_arith(lval* a, int op);
+lval* lvec_copy(lval* v);
+int   lvec_eq(lval* x, lval* y);
+unsigned long lvec_hash(lval* v);
+lval* lvec_join(lval* a);
+lval* lvec_list(lval* v);
+lval* lvec_order(lval* a, int op);
+void  lvec_print(lval* v);
+lval* lvec_slice(lval* v, int start, int count);
+
+/* a key of a map or set, and its value if a map */
+struct lentry {
+  unsigned long hash;
+  /* NULL once the key is deleted */
+  lval* key;
+  lval* val;
+};
+
+lval* lmap_copy(lval* m);
+void  lmap_del(lval* m);
+int   lmap_eq(lval* x, lval* y);
+unsigned long lmap_hash(lval* m);
+void  lmap_print(lval* m);
+
+lval* lhamt_get(lval* m, lval* k);
+lval* lhamt_list(lval* m, int vals);
+lval* lhamt_put(lval* m, lval* k, lval* v);
+lval* lhamt_remove(lval* m, lval* k);
+lval* ltrie_copy(lval* v);
+void  ltrie_del(lval* v);
+int   ltrie_eq(lval* x, lval* y);
+unsigned long ltrie_hash(lval* v);
+void  ltrie_print(lval* v);
+
+/*
+ * Overflow checked arithmetic on longs: sets *r to x op y and is 0, or
+ * is nonzero if the result does not fit in a long.
+ */
+#ifdef __GNUC__
+#define lint_add(x, y, r) __builtin_add_overflow(x, y, r)
+#define lint_sub(x, y, r) __builtin_sub_overflow(x, y, r)
+#define lint_mul(x, y, r) __builtin_mul_overflow(x, y, r)
+#else
+int lint_add(long x, long y, long* r);
+int lint_sub(long x, long y, long* r);
+int lint_mul(long x, long y, long* r);
+#endif
 
 void  lenv_add_builtin(lenv* e, char* name, lbuiltin func);
 void  lenv_add_builtins(lenv* e);
@@ -118,60 +447,119 @@ lenv* lenv_copy(lenv* e);
 void  lenv_def(lenv* e, lval* k, lval* v);
 void  lenv_del(lenv* e);
 lval* lenv_get(lenv* e, lval* k);
+void  lenv_inherit(lenv* e, lenv* old);
+void  lenv_parent(lenv* e, lenv* par);
+lval* lenv_macro(lenv* e, char* sym);
 lenv* lenv_new(void);
 void  lenv_put(lenv* e, lval* k, lval* v);
 
+char* lsym_intern(char* name);
+
+void  lchunk_del(lchunk* c);
+
+ljit* ljit_compile(lval* f);
+void  ljit_del(ljit* j);
+int   ljit_run(ljit* j, lval* f, lenv* e, long* result);
+
+void* lpool_alloc(size_t size);
+void  lpool_free(void* ptr, size_t size);
+void* lpool_resize(void* ptr, size_t old, size_t size);
+
 char* ltype_name(int t);
 int ltype_numeric(int t);
 int ltype_expr(int t);
 int ltype_expr_or_str(int t);
+int ltype_seq(int t);
+int ltype_map(int t);
 
 lval* lval_add(lval* v, lval* x);
+lval* lval_apply(lenv** e, lval** v, int evaluated, lenv** owned, lval** fn);
 lval* lval_bool(int x);
+lval* lval_bind(lenv* e, lval* f, lval* a, lenv** frame);
+lbody* lval_cache(lval* v);
 lval* lval_call(lenv* e, lval* f, lval* a);
 lval* lval_copy(lval* v);
 void  lval_del(lval* v);
 int   lval_eq(lval* x, lval* y);
+unsigned long lval_hash(lval* v);
 lval* lval_err(char* fmt, ...);
 lval* lval_eval(lenv* e, lval* v);
-lval* lval_eval_sexpr(lenv* e, lval* v);
+lval* lval_eval_cek(lenv* e, lval* v);
+int   lval_eval_count(lenv* e, lval* c, int i, int count);
+lval* lval_eval_vm(lenv* e, lval* v);
+void  lval_enter(lenv** e, lenv** owned, lenv* frame);
+lval* lval_expand(lenv* e, lval* v);
+lval* lval_expand_body(lenv* e, lval* body, lval* formals);
 void  lval_expr_print(lval* v, char open, char close);
 lval* lval_float(double x);
 lval* lval_float_to_int(lval *x);
+int   lval_form(lenv* e, lval* c);
 lval* lval_fun(lbuiltin func);
 lval* lval_join(lval* x, lval* y);
 lval* lval_int(long x);
 lval* lval_int_to_float(lval* x);
 lval* lval_lambda(lval* formals, lval* body);
+lval* lval_macro(lval* formals, lval* body);
+lval* lval_mut(lval* v);
+lval* lval_new(int type);
 lval* lval_ok(void);
+lval* lval_optimized(lenv* e, lval* f);
 lval* lval_pop(lval* v, int i);
 void  lval_print(lval* v);
 void  lval_print_str(lval* v);
 void  lval_println(lval* v);
 lval* lval_qexpr(void);
+void  lval_release(lenv* owned);
 lval* lval_read(mpc_ast_t* t);
+void  lval_read_cleanup(void);
+void  lval_read_init(void);
 lval* lval_read_int(mpc_ast_t* t);
 lval* lval_read_float(mpc_ast_t* t);
 lval* lval_read_str(mpc_ast_t* t);
+lval* lval_ref(lval* v);
+void  lval_reserve(lval* v, int n);
 lval* lval_sexpr(void);
+lval* lval_slice(lval* v, int start, int count);
 lval* lval_str(char* s);
 lval* lval_sym(char* s);
 lval* lval_take(lval* v, int i);
 
+/*
+ * Building with -DLISPY_GC replaces reference counting with a tracing
+ * collector. The evaluator pushes values it holds across nested
+ * evaluation onto the root stack; without the collector these are no-ops.
+ */
+#ifdef LISPY_GC
+lval* builtin_gc_stats(lenv* e, lval* a);
+void  gc_grow(long bytes);
+void  gc_pop(int n);
+void  gc_push(lval* v);
+void  gc_push_env(lenv* e);
+void  gc_safepoint(lenv* e, lval* v);
+void  gc_track_lenv(lenv* e);
+void  gc_track_lval(lval* v);
+#else
+#define gc_grow(bytes)
+#define gc_pop(n)
+#define gc_push(v)
+#define gc_push_env(e)
+#define gc_safepoint(e, v)
+#endif
+
 #define LASSERT(args, cond, fmt, ...) \
   if (!(cond)) { lval* err = lval_err(fmt, ##__VA_ARGS__); lval_del(args); return err; }
 
 #define LASSERT_TYPE(func, args, index, expect) \
-  LASSERT(args, args->cell[index]->type == expect, \
+  LASSERT(args, LTYPE(args->cell[index]) == expect, \
     "Function '%s' passed incorrect type for argument %i. " \
     "Got %s, Expected %s.", \
-    func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
+    func, index, ltype_name(LTYPE(args->cell[index])), ltype_name(expect))
 
 #define LASSERT_TYPEF(func, args, index, expectf, expected)  \
-  LASSERT(args, expectf(args->cell[index]->type),           \
+  LASSERT(args, expectf(LTYPE(args->cell[index])),           \
     "Function '%s' passed incorrect type for argument %i. " \
     "Got %s, Expected %s.", \
-    func, index, ltype_name(args->cell[index]->type), expected)
+    func, index, ltype_name(LTYPE(args->cell[index])), expected)
 
 #define LASSERT_NUM(func, args, num) \
   LASSERT(args, args->count == num, \
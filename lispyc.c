@@ -0,0 +1,697 @@
+#include <limits.h>
+#include "lispy.h"
+
+/*
+ * lispyc: translates Lisp programs into C that links against the
+ * runtime, so they can be run without parsing or walking the tree of
+ * every function body.
+ *
+ *   lispyc stdlib.lsp program.lsp > program.c
+ *
+ * The generated file reads the program into constants when it starts
+ * and then evaluates its top level expressions in order, as load would.
+ * Each top level (fun {name formals...} {body}) becomes a C function
+ * registered with lenv_add_builtin instead. It binds its arguments with
+ * lval_bind, as a lambda would, and runs its body as straight line C:
+ *
+ *  - 'if' with literal branches becomes a C if,
+ *  - the arithmetic and comparison builtins applied to two integers
+ *    are computed in place while the result fits in a long,
+ *  - a call of the function to itself in tail position becomes a jump,
+ *    and elsewhere a direct C call,
+ *  - everything else is evaluated cell by cell, as the evaluator would,
+ *    and applied with lval_apply.
+ *
+ * Since any name can be rebound at run time, each of these checks what
+ * the head of the expression evaluated to and otherwise falls back to
+ * a general application, so results are those of the interpreter. An
+ * expression using a special form checks with lval_form that the name
+ * still is the form, and otherwise is evaluated by the interpreter. The
+ * one visible difference is that compiled functions print as builtins.
+ *
+ * Macro calls are expanded by lispyc, so compiled functions never make
+ * one. It defines each macro, and each function a macro may call, as
+ * it reads the program, and then expands the expressions that follow.
+ * A macro whose expansion depends on anything else that happens when
+ * the program runs cannot be compiled.
+ *
+ * The generated file defines lispyc_load(e), which defines the program
+ * in e, and a main running it unless LISPYC_NO_MAIN is defined.
+ */
+
+/* the function being generated */
+typedef struct {
+  /* index of the top level definition */
+  int fun;
+  /* name the function calls itself by */
+  char* self;
+  /* temporaries declared so far */
+  int temps;
+  int indent;
+} lc_fn;
+
+/* constants, as C expressions reaching them from the roots */
+static char** lc_consts = NULL;
+static int lc_nconsts = 0;
+
+/* function bodies are generated here before the declarations they need */
+static FILE* lc_out;
+
+static struct {
+  char* name;
+  char* builtin;
+  /* C operator, and whether it needs a divisor other than 0 and -1 */
+  char* op;
+  int div;
+  /* lint_* computing it with a check for overflow, if it can overflow */
+  char* checked;
+} lc_ops[] = {
+  { "+",  "builtin_add", "+",  0, "lint_add" },
+  { "-",  "builtin_sub", "-",  0, "lint_sub" },
+  { "*",  "builtin_mul", "*",  0, "lint_mul" },
+  { "/",  "builtin_div", "/",  1, NULL },
+  { "%",  "builtin_mod", "%",  1, NULL },
+  { "==", "builtin_eq",  "==", 0, NULL },
+  { "!=", "builtin_ne",  "!=", 0, NULL },
+  { ">",  "builtin_gt",  ">",  0, NULL },
+  { "<",  "builtin_lt",  "<",  0, NULL },
+  { ">=", "builtin_gte", ">=", 0, NULL },
+  { "<=", "builtin_lte", "<=", 0, NULL }
+};
+
+#define LC_OPS (sizeof(lc_ops) / sizeof(lc_ops[0]))
+
+/* names of the LFORM_* constants */
+static char* lc_forms[] = {
+  "LFORM_NONE", "LFORM_IF", "LFORM_READ", "LFORM_DEFMACRO", "LFORM_DO"
+};
+
+static char* lc_strdup(char* fmt, ...) {
+  va_list va;
+  va_start(va, fmt);
+  int n = vsnprintf(NULL, 0, fmt, va);
+  va_end(va);
+  char* s = malloc(n + 1);
+  va_start(va, fmt);
+  vsnprintf(s, n + 1, fmt, va);
+  va_end(va);
+  return s;
+}
+
+static void lc_line(lc_fn* g, char* fmt, ...) {
+  fprintf(lc_out, "%*s", 2 * g->indent, "");
+  va_list va;
+  va_start(va, fmt);
+  vfprintf(lc_out, fmt, va);
+  va_end(va);
+  fprintf(lc_out, "\n");
+}
+
+/* index of the constant at path */
+static int lc_const(char* path) {
+  for (int i = 0; i < lc_nconsts; i++) {
+    if (strcmp(lc_consts[i], path) == 0) {
+      return i;
+    }
+  }
+  lc_consts = realloc(lc_consts, sizeof(char*) * (lc_nconsts + 1));
+  lc_consts[lc_nconsts] = lc_strdup("%s", path);
+  return lc_nconsts++;
+}
+
+/* s as a C string literal */
+static void lc_string(FILE* f, char* s) {
+  fputc('"', f);
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      fprintf(f, "\\%c", c);
+    } else if (c < 32 || c > 126) {
+      fprintf(f, "\\%03o", c);
+    } else {
+      fputc(c, f);
+    }
+  }
+  fputc('"', f);
+}
+
+/* prints C code adding v to v[depth - 1], or setting v[0] to it */
+static void lc_read(lval* v, int depth) {
+  if (ltype_expr(LTYPE(v))) {
+    printf("  v[%i] = %s;\n", depth,
+           LTYPE(v) == LVAL_QEXPR ? "lval_qexpr()" : "lval_sexpr()");
+    for (int i = 0; i < v->count; i++) {
+      lc_read(v->cell[i], depth + 1);
+    }
+  } else {
+    printf("  v[%i] = ", depth);
+    switch (LTYPE(v)) {
+    case LVAL_INT:
+      if (LNUM(v) == LONG_MIN) {
+        printf("lval_int(-%ldL - 1)", LONG_MAX);
+      } else {
+        printf("lval_int(%ldL)", LNUM(v));
+      }
+      break;
+    case LVAL_FLOAT: printf("lval_float(%.17g)", v->fnum); break;
+    case LVAL_BIGINT: {
+      char* s = lbig_str(v);
+      printf("lbig_read(\"%s\")", s);
+      free(s);
+      break;
+    }
+    case LVAL_BOOL:  printf("lval_bool(%i)", (int) LNUM(v)); break;
+    case LVAL_SYM:   printf("lval_sym("); lc_string(stdout, v->sym); printf(")"); break;
+    case LVAL_STR:   printf("lval_str("); lc_string(stdout, v->str); printf(")"); break;
+    case LVAL_ERR:   printf("lval_err(\"%%s\", "); lc_string(stdout, v->err); printf(")"); break;
+    /* the reader only makes builtins for [...] */
+    case LVAL_FUN:   printf("lval_fun(builtin_list)"); break;
+    default:         printf("lval_ok()"); break;
+    }
+    printf(";\n");
+  }
+  if (depth > 0) {
+    printf("  v[%i] = lval_add(v[%i], v[%i]);\n", depth - 1, depth - 1, depth);
+  }
+}
+
+static int lc_depth(lval* v) {
+  int depth = 0;
+  if (ltype_expr(LTYPE(v))) {
+    for (int i = 0; i < v->count; i++) {
+      int d = lc_depth(v->cell[i]);
+      depth = d > depth ? d : depth;
+    }
+  }
+  return depth + 1;
+}
+
+/* whether x is (fun {name formals...} {body}) */
+static int lc_is_fun(lval* x) {
+  if (LTYPE(x) != LVAL_SEXPR || x->count != 3
+      || LTYPE(x->cell[0]) != LVAL_SYM || strcmp(x->cell[0]->sym, "fun") != 0
+      || LTYPE(x->cell[1]) != LVAL_QEXPR || x->cell[1]->count == 0
+      || LTYPE(x->cell[2]) != LVAL_QEXPR) {
+    return 0;
+  }
+  for (int i = 0; i < x->cell[1]->count; i++) {
+    if (LTYPE(x->cell[1]->cell[i]) != LVAL_SYM) {
+      return 0;
+    }
+  }
+  return x->cell[1]->cell[0]->sym != lsym_amp;
+}
+
+/* whether x is (defmacro ...) */
+static int lc_is_defmacro(lval* x) {
+  return LTYPE(x) == LVAL_SEXPR && x->count > 0
+    && LTYPE(x->cell[0]) == LVAL_SYM && x->cell[0]->form == LFORM_DEFMACRO;
+}
+
+/* a value in v lc_read cannot write, or NULL */
+static lval* lc_unreadable(lval* v) {
+  if (ltype_expr(LTYPE(v))) {
+    for (int i = 0; i < v->count; i++) {
+      lval* x = lc_unreadable(v->cell[i]);
+      if (x) {
+        return x;
+      }
+    }
+    return NULL;
+  }
+  switch (LTYPE(v)) {
+  case LVAL_OK:
+  case LVAL_ERR:
+  case LVAL_MACRO:
+  case LVAL_VEC:
+  case LVAL_MAP:
+  case LVAL_SET:
+  case LVAL_PMAP:
+  case LVAL_PVEC:
+  case LVAL_NODE:
+    return v;
+  case LVAL_FUN:
+    return v->builtin == builtin_list ? NULL : v;
+  default:
+    return NULL;
+  }
+}
+
+/* x with macros expanded in e, and defined there if it defines any */
+static lval* lc_expand(lenv* e, lval* x) {
+  x = lval_expand(e, x);
+  if (lc_is_fun(x)) {
+    x = lval_mut(x);
+    x->cell[2] = lval_expand_body(e, x->cell[2], x->cell[1]);
+  }
+  lval* bad = lc_unreadable(x);
+  if (bad) {
+    if (LTYPE(bad) == LVAL_ERR) {
+      fprintf(stderr, "lispyc: Error: %s\n", bad->err);
+    } else {
+      fprintf(stderr, "lispyc: a macro expanded to a %s, which cannot be "
+              "compiled\n", ltype_name(LTYPE(bad)));
+    }
+    exit(1);
+  }
+  if (lc_is_fun(x) || lc_is_defmacro(x)) {
+    lval* r = lval_eval(e, lval_ref(x));
+    if (LTYPE(r) == LVAL_ERR) {
+      fprintf(stderr, "lispyc: Error: %s\n", r->err);
+      exit(1);
+    }
+    lval_del(r);
+  }
+  return x;
+}
+
+static void lc_sexpr(lc_fn* g, lval* x, char* path, int tail, char* dst);
+
+/* code setting dst to the value of x, found at path */
+static void lc_expr(lc_fn* g, lval* x, char* path, char* dst) {
+  if (LTYPE(x) == LVAL_SYM) {
+    lc_line(g, "%s = lenv_get(x, lc_k[%i]);", dst, lc_const(path));
+  } else if (LTYPE(x) == LVAL_SEXPR) {
+    lc_sexpr(g, x, path, 0, dst);
+  } else {
+    lc_line(g, "%s = lval_ref(lc_k[%i]);", dst, lc_const(path));
+  }
+}
+
+/* "t<first>, t<first + 1>, ..." for n temporaries */
+static char* lc_temps(int first, int n) {
+  char* s = lc_strdup("");
+  for (int i = 0; i < n; i++) {
+    char* t = lc_strdup("%s%st%i", s, i ? ", " : "", first + i);
+    free(s);
+    s = t;
+  }
+  return s;
+}
+
+static void lc_apply_sexpr(lc_fn* g, lval* x, char* path, int tail,
+                           char* dst, int evaluated);
+
+/* code setting dst to the value of S-Expression x, found at path */
+static void lc_sexpr(lc_fn* g, lval* x, char* path, int tail, char* dst) {
+  if (x->count == 0) {
+    lc_line(g, "%s = lval_sexpr();", dst);
+    return;
+  }
+
+  /* cells after the first 'evaluated' are passed as they are */
+  int evaluated = x->count;
+  int i;
+  for (i = 0; i < evaluated; i++) {
+    evaluated = lval_eval_count(NULL, x->cell[i], i, evaluated);
+  }
+  evaluated = i;
+
+  /* names of special forms may not be the forms where the code runs */
+  char* forms = lc_strdup("");
+  for (i = 0; i < evaluated; i++) {
+    int form = lval_form(NULL, x->cell[i]);
+    if (form != LFORM_NONE) {
+      char* p = lc_strdup("%s->cell[%i]", path, i);
+      char* t = lc_strdup("%s%slval_form(x, lc_k[%i]) != %s", forms,
+                          *forms ? " || " : "", lc_const(p), lc_forms[form]);
+      free(p);
+      free(forms);
+      forms = t;
+    }
+  }
+  if (*forms == '\0') {
+    free(forms);
+    lc_apply_sexpr(g, x, path, tail, dst, evaluated);
+    return;
+  }
+  lc_line(g, "if (%s) {", forms);
+  lc_line(g, "  %s = lc_eval(x, lc_k[%i]);", dst, lc_const(path));
+  lc_line(g, "} else {");
+  g->indent++;
+  lc_apply_sexpr(g, x, path, tail, dst, evaluated);
+  g->indent--;
+  lc_line(g, "}");
+  free(forms);
+}
+
+/*
+ * code setting dst to the value of S-Expression x, found at path, when
+ * the first 'evaluated' cells are evaluated
+ */
+static void lc_apply_sexpr(lc_fn* g, lval* x, char* path, int tail,
+                           char* dst, int evaluated) {
+  /* the value of cell i goes in temporary t<first + i> */
+  int n = x->count;
+  int first = g->temps + 1;
+  g->temps += n;
+  lval* h = x->cell[0];
+  int branch = LTYPE(h) == LVAL_SYM && h->form == LFORM_IF && n == 4
+    && ltype_expr(LTYPE(x->cell[2])) && ltype_expr(LTYPE(x->cell[3]));
+  for (int i = 0; i < n; i++) {
+    char* p = lc_strdup("%s->cell[%i]", path, i);
+    if (i < evaluated) {
+      lc_line(g, "lval* t%i;", first + i);
+      lc_expr(g, x->cell[i], p, lc_strdup("t%i", first + i));
+    } else if (!branch) {
+      lc_line(g, "lval* t%i = lval_ref(lc_k[%i]);", first + i, lc_const(p));
+    }
+    free(p);
+    if (i < evaluated - 1) {
+      lc_line(g, "gc_push(t%i);", first + i);
+    }
+  }
+  if (evaluated > 1) {
+    lc_line(g, "gc_pop(%i);", evaluated - 1);
+  }
+
+  if (branch) {
+    int c = first + 1;
+    lc_line(g, "if (lc_is(t%i, builtin_if) && LTYPE(t%i) == LVAL_BOOL) {", first, c);
+    g->indent++;
+    lc_line(g, "int yes = LNUM(t%i);", c);
+    lc_line(g, "lval_del(t%i);", first);
+    lc_line(g, "lval_del(t%i);", c);
+    /* the branches are evaluated as S-Expressions */
+    lc_line(g, "if (yes) {");
+    g->indent++;
+    lc_sexpr(g, x->cell[2], lc_strdup("%s->cell[2]", path), tail, dst);
+    g->indent--;
+    lc_line(g, "} else {");
+    g->indent++;
+    lc_sexpr(g, x->cell[3], lc_strdup("%s->cell[3]", path), tail, dst);
+    g->indent--;
+    lc_line(g, "}");
+    g->indent--;
+    int yes = lc_const(lc_strdup("%s->cell[2]", path));
+    int no = lc_const(lc_strdup("%s->cell[3]", path));
+    lc_line(g, "} else {");
+    lc_line(g, "  %s = lc_apply(x, lc_list(4, t%i, t%i, lval_ref(lc_k[%i]), lval_ref(lc_k[%i])), 2);",
+            dst, first, c, yes, no);
+    lc_line(g, "}");
+    return;
+  }
+
+  if (LTYPE(h) == LVAL_SYM && n == 3 && evaluated == 3) {
+    for (int k = 0; k < LC_OPS; k++) {
+      if (strcmp(h->sym, lc_ops[k].name) != 0) {
+        continue;
+      }
+      char* check = "";
+      if (lc_ops[k].div) {
+        check = lc_strdup(" && LNUM(t%i) != 0 && LNUM(t%i) != -1", first + 2, first + 2);
+      }
+      if (lc_ops[k].checked) {
+        /* the result goes in n<first> unless it overflows */
+        lc_line(g, "long n%i;", first);
+        check = lc_strdup(" && !%s(LNUM(t%i), LNUM(t%i), &n%i)",
+                          lc_ops[k].checked, first + 1, first + 2, first);
+      }
+      lc_line(g, "if (lc_is(t%i, %s) && LTYPE(t%i) == LVAL_INT && LTYPE(t%i) == LVAL_INT%s) {",
+              first, lc_ops[k].builtin, first + 1, first + 2, check);
+      g->indent++;
+      if (lc_ops[k].checked) {
+        lc_line(g, "%s = lval_int(n%i);", dst, first);
+      } else {
+        lc_line(g, "%s = %s(LNUM(t%i) %s LNUM(t%i));", dst,
+                k < 5 ? "lval_int" : "lval_bool", first + 1, lc_ops[k].op, first + 2);
+      }
+      lc_line(g, "lval_del(t%i);", first);
+      lc_line(g, "lval_del(t%i);", first + 1);
+      lc_line(g, "lval_del(t%i);", first + 2);
+      g->indent--;
+      lc_line(g, "} else {");
+      lc_line(g, "  %s = lc_apply(x, lc_list(3, %s), 3);", dst, lc_temps(first, 3));
+      lc_line(g, "}");
+      return;
+    }
+  }
+
+  if (tail && LTYPE(h) == LVAL_SYM && h->sym == g->self && n > 1 && evaluated == n) {
+    /* a call to itself reuses the frame, as lval_enter would */
+    lc_line(g, "if (lc_is(t%i, lc_fun_%i) && !lc_errors(%i, %s)) {",
+            first, g->fun, n - 1, lc_temps(first + 1, n - 1));
+    g->indent++;
+    lc_line(g, "lenv* y;");
+    lc_line(g, "lval_del(t%i);", first);
+    lc_line(g, "lval* b = lval_bind(x, lc_lambda[%i], lc_list(%i, %s), &y);",
+            g->fun, n - 1, lc_temps(first + 1, n - 1));
+    lc_line(g, "if (b == NULL) {");
+    lc_line(g, "  lenv_inherit(y, x);");
+    lc_line(g, "  lval_release(x);");
+    lc_line(g, "  x = y;");
+    lc_line(g, "  gc_push_env(x);");
+    lc_line(g, "  goto top;");
+    lc_line(g, "}");
+    lc_line(g, "%s = b;", dst);
+    g->indent--;
+    lc_line(g, "} else {");
+    lc_line(g, "  %s = lc_apply(x, lc_list(%i, %s), %i);", dst, n, lc_temps(first, n), n);
+    lc_line(g, "}");
+    return;
+  }
+
+  if (LTYPE(h) == LVAL_SYM && h->sym == g->self && n > 1 && evaluated == n) {
+    /* a call to itself skips lval_apply, saving C stack when it recurses */
+    lc_line(g, "if (lc_is(t%i, lc_fun_%i) && !lc_errors(%i, %s)) {",
+            first, g->fun, n - 1, lc_temps(first + 1, n - 1));
+    lc_line(g, "  lval_del(t%i);", first);
+    lc_line(g, "  %s = lc_fun_%i(x, lc_list(%i, %s));", dst, g->fun, n - 1,
+            lc_temps(first + 1, n - 1));
+    lc_line(g, "} else {");
+    lc_line(g, "  %s = lc_apply(x, lc_list(%i, %s), %i);", dst, n, lc_temps(first, n), n);
+    lc_line(g, "}");
+    return;
+  }
+
+  lc_line(g, "%s = lc_apply(x, lc_list(%i, %s), %i);", dst, n, lc_temps(first, n),
+          evaluated);
+}
+
+/* whether S-Expression x, in tail position, calls self there */
+static int lc_loops(lval* x, char* self) {
+  if (x->count == 0 || LTYPE(x->cell[0]) != LVAL_SYM) {
+    return 0;
+  }
+  if (x->cell[0]->form == LFORM_IF && x->count == 4
+      && ltype_expr(LTYPE(x->cell[2])) && ltype_expr(LTYPE(x->cell[3]))) {
+    return lc_loops(x->cell[2], self) || lc_loops(x->cell[3], self);
+  }
+  return x->cell[0]->sym == self && x->count > 1;
+}
+
+static void lc_fun(int fun, lval* def) {
+  lc_fn g = { fun, def->cell[1]->cell[0]->sym, 0, 1 };
+  fprintf(lc_out, "\n/* %s */\n", g.self);
+  fprintf(lc_out, "static lval* lc_fun_%i(lenv* e, lval* a) {\n", fun);
+  lc_line(&g, "lenv* x;");
+  lc_line(&g, "lval* r = lval_bind(e, lc_lambda[%i], a, &x);", fun);
+  lc_line(&g, "if (r) {");
+  lc_line(&g, "  return r;");
+  lc_line(&g, "}");
+  lc_line(&g, "gc_push_env(x);");
+  if (lc_loops(def->cell[2], g.self)) {
+    fprintf(lc_out, " top:;\n");
+  }
+  lc_sexpr(&g, def->cell[2], lc_strdup("lc_lambda[%i]->body", fun), 1, "r");
+  lc_line(&g, "lval_release(x);");
+  lc_line(&g, "return r;");
+  fprintf(lc_out, "}\n");
+}
+
+/* definitions shared by every generated file */
+static char* lc_prelude =
+  "/* whether v is builtin b */\n"
+  "static int lc_is(lval* v, lbuiltin b) {\n"
+  "  return LTYPE(v) == LVAL_FUN && v->builtin == b;\n"
+  "}\n"
+  "\n"
+  "/* an S-Expression of the n values given */\n"
+  "static lval* lc_list(int n, ...) {\n"
+  "  lval* s = lval_sexpr();\n"
+  "  lval_reserve(s, n);\n"
+  "  s->count = n;\n"
+  "  va_list va;\n"
+  "  va_start(va, n);\n"
+  "  for (int i = 0; i < n; i++) {\n"
+  "    s->cell[i] = va_arg(va, lval*);\n"
+  "  }\n"
+  "  va_end(va);\n"
+  "  return s;\n"
+  "}\n"
+  "\n"
+  "/* whether any of the n values given is an error */\n"
+  "static int lc_errors(int n, ...) {\n"
+  "  int errors = 0;\n"
+  "  va_list va;\n"
+  "  va_start(va, n);\n"
+  "  for (int i = 0; i < n; i++) {\n"
+  "    lval* v = va_arg(va, lval*);\n"
+  "    errors |= LTYPE(v) == LVAL_ERR;\n"
+  "  }\n"
+  "  va_end(va);\n"
+  "  return errors;\n"
+  "}\n"
+  "\n"
+  "/* applies s, an S-Expression whose first n cells are evaluated, in e */\n"
+  "static lval* lc_apply(lenv* e, lval* s, int n) {\n"
+  "  lenv* owned = NULL;\n"
+  "  lval* r = lval_apply(&e, &s, n, &owned, NULL);\n"
+  "  if (r == NULL) {\n"
+  "    r = lval_eval(e, s);\n"
+  "  }\n"
+  "  lval_release(owned);\n"
+  "  return r;\n"
+  "}\n"
+  "\n"
+  "/* evaluates the list x in e as an S-Expression, as the interpreter would */\n"
+  "static lval* lc_eval(lenv* e, lval* x) {\n"
+  "  x = lval_mut(lval_ref(x));\n"
+  "  x->type = LVAL_SEXPR;\n"
+  "  return lval_eval(e, x);\n"
+  "}\n"
+  "\n"
+  "/* a lambda with the formals and body of (fun {name formals...} {body}) */\n"
+  "static lval* lc_lambda_of(lval* def) {\n"
+  "  lval* formals = lval_qexpr();\n"
+  "  for (int i = 1; i < def->cell[1]->count; i++) {\n"
+  "    formals = lval_add(formals, lval_ref(def->cell[1]->cell[i]));\n"
+  "  }\n"
+  "  return lval_lambda(formals, lval_ref(def->cell[2]));\n"
+  "}\n";
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: lispyc file.lsp... > file.c\n");
+    return 1;
+  }
+  lval_read_init();
+
+  /* every top level expression of every file, in order */
+  lval* tops = lval_sexpr();
+  for (int i = 1; i < argc; i++) {
+    mpc_result_t r;
+    if (!mpc_parse_contents(argv[i], Lispy, &r)) {
+      mpc_err_print_to(r.error, stderr);
+      mpc_err_delete(r.error);
+      return 1;
+    }
+    lval* x = lval_read(r.output);
+    mpc_ast_delete(r.output);
+    for (int j = 0; j < x->count; j++) {
+      tops = lval_add(tops, lval_ref(x->cell[j]));
+    }
+    lval_del(x);
+  }
+
+  lenv* e = lenv_new();
+  gc_push_env(e);
+  lenv_add_builtins(e);
+  for (int i = 0; i < tops->count; i++) {
+    tops->cell[i] = lc_expand(e, tops->cell[i]);
+  }
+
+  /* functions first, they decide which constants are needed */
+  lc_out = tmpfile();
+  for (int i = 0; i < tops->count; i++) {
+    if (lc_is_fun(tops->cell[i])) {
+      lc_fun(i, tops->cell[i]);
+    }
+  }
+
+  printf("/* generated by lispyc from");
+  for (int i = 1; i < argc; i++) {
+    printf(" %s", argv[i]);
+  }
+  printf(" */\n#include \"lispy.h\"\n\n");
+  printf("static lval* lc_top[%i];\n", tops->count);
+  printf("static lval* lc_lambda[%i];\n", tops->count);
+  printf("static lval* lc_k[%i];\n\n", lc_nconsts ? lc_nconsts : 1);
+  printf("%s", lc_prelude);
+
+  rewind(lc_out);
+  int c;
+  while ((c = fgetc(lc_out)) != EOF) {
+    putchar(c);
+  }
+  fclose(lc_out);
+
+  int depth = 0;
+  for (int i = 0; i < tops->count; i++) {
+    int d = lc_depth(tops->cell[i]);
+    depth = d > depth ? d : depth;
+  }
+  printf("\n/* builds the program and the constants the functions use */\n");
+  printf("static void lc_init(void) {\n");
+  printf("  lval* v[%i];\n", depth);
+  printf("  /* everything is kept for good, and by the collector too */\n");
+  printf("  lval* roots = lval_qexpr();\n");
+  printf("  gc_push(roots);\n");
+  for (int i = 0; i < tops->count; i++) {
+    lc_read(tops->cell[i], 0);
+    printf("  lc_top[%i] = v[0];\n", i);
+    printf("  roots = lval_add(roots, v[0]);\n");
+    if (lc_is_fun(tops->cell[i])) {
+      printf("  lc_lambda[%i] = lc_lambda_of(v[0]);\n", i);
+      printf("  roots = lval_add(roots, lc_lambda[%i]);\n", i);
+    }
+  }
+  for (int i = 0; i < lc_nconsts; i++) {
+    printf("  lc_k[%i] = %s;\n", i, lc_consts[i]);
+  }
+  printf("}\n\n");
+
+  printf("/* defines the program in e, as loading its files would */\n");
+  printf("lval* lispyc_load(lenv* e) {\n");
+  printf("  lc_init();\n");
+  printf("  for (int i = 0; i < %i; i++) {\n", tops->count);
+  printf("    lval* x = NULL;\n");
+  printf("    switch (i) {\n");
+  for (int i = 0; i < tops->count; i++) {
+    lval* t = tops->cell[i];
+    if (lc_is_fun(t)) {
+      printf("    case %i:\n", i);
+      printf("      x = lenv_get(e, lc_top[%i]->cell[0]);\n", i);
+      printf("      if (lc_is(x, builtin_fun)) {\n");
+      printf("        lenv_add_builtin(e, ");
+      lc_string(stdout, t->cell[1]->cell[0]->sym);
+      printf(", lc_fun_%i);\n", i);
+      printf("        lval_del(x);\n");
+      printf("        x = lval_ok();\n");
+      printf("      } else {\n");
+      printf("        lval_del(x);\n");
+      printf("        x = NULL;\n");
+      printf("      }\n");
+      printf("      break;\n");
+    }
+  }
+  printf("    }\n");
+  printf("    if (x == NULL) {\n");
+  printf("      x = lval_eval(e, lval_ref(lc_top[i]));\n");
+  printf("    }\n");
+  printf("    if (LTYPE(x) == LVAL_ERR) {\n");
+  printf("      lval_println(x);\n");
+  printf("    }\n");
+  printf("    lval_del(x);\n");
+  printf("  }\n");
+  printf("  return lval_ok();\n");
+  printf("}\n\n");
+
+  printf("#ifndef LISPYC_NO_MAIN\n");
+  printf("int main(int argc, char** argv) {\n");
+  printf("  lval_read_init();\n");
+  printf("  lenv* e = lenv_new();\n");
+  printf("  gc_push_env(e);\n");
+  printf("  lenv_add_builtins(e);\n");
+  printf("  lval_del(lispyc_load(e));\n");
+  printf("  lenv_del(e);\n");
+  printf("  lval_read_cleanup();\n");
+  printf("  return 0;\n");
+  printf("}\n");
+  printf("#endif\n");
+
+  lval_del(tops);
+  lenv_del(e);
+  lval_read_cleanup();
+  return 0;
+}
@@ -3,8 +3,16 @@
 char* ltype_name(int t) {
   switch (t) {
   case LVAL_FUN:   return "Function";
+  case LVAL_MACRO: return "Macro";
+  case LVAL_VEC:   return "Vector";
+  case LVAL_MAP:   return "Map";
+  case LVAL_SET:   return "Set";
+  case LVAL_PMAP:  return "Persistent Map";
+  case LVAL_PVEC:  return "Persistent Vector";
+  case LVAL_NODE:  return "Node";
   case LVAL_INT:   return "Integer";
   case LVAL_FLOAT: return "Float";
+  case LVAL_BIGINT: return "Big Integer";
   case LVAL_BOOL:  return "Boolean";
   case LVAL_STR:   return "String";
   case LVAL_ERR:   return "Error";
@@ -17,7 +25,7 @@ char* ltype_name(int t) {
 }
 
 int ltype_numeric(int t) {
-  return t == LVAL_INT || t == LVAL_FLOAT;
+  return t == LVAL_INT || t == LVAL_FLOAT || t == LVAL_BIGINT;
 }
 
 int ltype_expr(int t) {
@@ -28,24 +36,51 @@ int ltype_expr_or_str(int t) {
   return t == LVAL_STR || ltype_expr(t);
 }
 
+/* what the map builtins work on */
+int ltype_map(int t) {
+  return t == LVAL_MAP || t == LVAL_PMAP;
+}
+
+/* what head, tail, take and drop work on */
+int ltype_seq(int t) {
+  return t == LVAL_VEC || ltype_expr_or_str(t);
+}
+
 int lval_eq(lval* x, lval* y) {
-  if (x->type != y->type) {
+  if (LTYPE(x) != LTYPE(y)) {
     return 0;
   }
 
   /* Should we allow comparing int and float? */
-  switch(x->type) {
+  switch(LTYPE(x)) {
   case LVAL_BOOL:
-  case LVAL_INT: return x->num == y->num;
+  case LVAL_INT: return LNUM(x) == LNUM(y);
   /* Should we compare with epsilon? */
   case LVAL_FLOAT: return x->fnum == y->fnum;
+  case LVAL_BIGINT: return lbig_cmp(x, y) == 0;
   case LVAL_ERR: return (strcmp(x->err, y->err) == 0);
   case LVAL_STR: return (strcmp(x->str, y->str) == 0);
-  case LVAL_SYM: return (strcmp(x->sym, y->sym) == 0);
+  case LVAL_SYM: return x->sym == y->sym;
+  case LVAL_VEC: return lvec_eq(x, y);
+  case LVAL_MAP:
+  case LVAL_SET: return lmap_eq(x, y);
+  case LVAL_PMAP:
+  case LVAL_PVEC: return ltrie_eq(x, y);
+  case LVAL_MACRO:
   case LVAL_FUN:
     if (x->builtin || y->builtin) {
       return x->builtin == y->builtin;
     } else {
+      int xn = x->args ? x->args->count : 0;
+      int yn = y->args ? y->args->count : 0;
+      if (xn != yn) {
+        return 0;
+      }
+      for (int i = 0; i < xn; i++) {
+        if (!lval_eq(x->args->cell[i], y->args->cell[i])) {
+          return 0;
+        }
+      }
       return lval_eq(x->formals, y->formals)
         && lval_eq(x->body, y->body);
     }
@@ -66,48 +101,201 @@ int lval_eq(lval* x, lval* y) {
   return 0;
 }
 
+/*
+ * Hash of v, the same for values lval_eq finds equal. Integers hash to
+ * themselves, so a run of them indexes a table without collisions.
+ */
+unsigned long lval_hash(lval* v) {
+  unsigned long h = 2166136261u;
+  switch (LTYPE(v)) {
+  case LVAL_BOOL:
+  case LVAL_INT: return (unsigned long) LNUM(v);
+  case LVAL_FLOAT: {
+    /* 0.0 and -0.0 are equal */
+    double f = v->fnum == 0 ? 0 : v->fnum;
+    memcpy(&h, &f, sizeof(h) < sizeof(f) ? sizeof(h) : sizeof(f));
+    return h ^ (h >> 29);
+  }
+  case LVAL_BIGINT:
+    h ^= v->neg;
+    for (int i = 0; i < v->len; i++) {
+      h = (h ^ v->digits[i]) * 16777619u;
+    }
+    return h;
+  case LVAL_SYM: return LSYM(v->sym)->hash;
+  case LVAL_ERR:
+  case LVAL_STR:
+    /* FNV-1a, as symbols are hashed */
+    for (char* s = LTYPE(v) == LVAL_STR ? v->str : v->err; *s; s++) {
+      h = (h ^ (unsigned char) *s) * 16777619u;
+    }
+    return h;
+  case LVAL_QEXPR:
+  case LVAL_SEXPR:
+    h ^= LTYPE(v);
+    for (int i = 0; i < v->count; i++) {
+      h = (h ^ lval_hash(v->cell[i])) * 16777619u;
+    }
+    return h;
+  case LVAL_FUN: return (unsigned long) (size_t) v->builtin;
+  case LVAL_VEC: return lvec_hash(v);
+  case LVAL_MAP:
+  case LVAL_SET: return lmap_hash(v);
+  case LVAL_PMAP:
+  case LVAL_PVEC: return ltrie_hash(v);
+  default: return LTYPE(v);
+  }
+}
+
+lval* lval_new(int type) {
+  lval* v = lpool_alloc(sizeof(lval));
+  v->type = type;
+  v->refs = 1;
+#ifdef LISPY_GC
+  gc_track_lval(v);
+#endif
+  return v;
+}
+
+/* take another reference to v, values are immutable once shared */
+lval* lval_ref(lval* v) {
+  if (LVAL_IMM(v)) {
+    return v;
+  }
+#ifdef LISPY_GC
+  /* counts are never decremented, so only record that v is shared */
+  v->refs = 2;
+#else
+  v->refs++;
+#endif
+  return v;
+}
+
+/* gives v fresh storage for n cells */
+static void lval_cells(lval* v, int n) {
+  v->cell = lpool_alloc(sizeof(lval*) * n);
+  v->cap = n;
+  gc_grow(sizeof(lval*) * n);
+}
+
+/*
+ * Makes room for n cells in the list v, which is not shared or a
+ * slice. The room at least doubles when it grows, so appending takes
+ * constant time on average.
+ */
+void lval_reserve(lval* v, int n) {
+  if (n <= v->cap) {
+    return;
+  }
+  if (n < 2 * v->cap) {
+    n = 2 * v->cap;
+  }
+  lval** cell = v->cell;
+  int cap = v->cap;
+  lval_cells(v, n);
+  if (cell) {
+    memcpy(v->cell, cell, sizeof(lval*) * v->count);
+    lpool_free(cell, sizeof(lval*) * cap);
+  }
+}
+
+/* gives the slice v cells of its own, so they can change */
+static void lval_own(lval* v) {
+  lval** cell = v->cell;
+  lval_cells(v, v->count);
+  for (int i = 0; i < v->count; i++) {
+    v->cell[i] = lval_ref(cell[i]);
+  }
+  lval_del(v->base);
+  v->base = NULL;
+}
+
+/* what running the list v as a function body made, made on first use */
+lbody* lval_cache(lval* v) {
+  if (v->cache == NULL) {
+    v->cache = lpool_alloc(sizeof(lbody));
+    v->cache->epoch = 0;
+    v->cache->opt = NULL;
+    v->cache->chunk = NULL;
+  }
+  return v->cache;
+}
+
+/* drops what running the list v as a function body made */
+static void lval_uncache(lval* v) {
+  if (v->cache->chunk) {
+    lchunk_del(v->cache->chunk);
+  }
+  if (v->cache->opt) {
+    lval_del(v->cache->opt);
+  }
+  lpool_free(v->cache, sizeof(lbody));
+  v->cache = NULL;
+}
+
+/*
+ * Returns a version of v that is safe to modify in place. If v is
+ * shared a copy is made and our reference to the original dropped,
+ * and if it is a slice it is given cells of its own.
+ */
+lval* lval_mut(lval* v) {
+  if (LVAL_IMM(v)) {
+    return v;
+  }
+  if (v->refs == 1) {
+    if (ltype_expr(LTYPE(v)) && v->base) {
+      lval_own(v);
+    }
+    if (ltype_expr(LTYPE(v)) && v->cache) {
+      /* bytecode and optimized body no longer match once it changes */
+      lval_uncache(v);
+    }
+    return v;
+  }
+  lval* x = lval_copy(v);
+  lval_del(v);
+  return x;
+}
+
 lval* lval_int(long x) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_INT;
+  if (x >= LVAL_IMM_MIN && x <= LVAL_IMM_MAX) {
+    return (lval*) (((uintptr_t) x << 1) | 1);
+  }
+  lval* v = lval_new(LVAL_INT);
   v->num = x;
   return v;
 }
 
 lval* lval_int_to_float(lval* x) {
-  if (x->type == LVAL_FLOAT) {
+  if (LTYPE(x) == LVAL_FLOAT) {
     return x;
   }
-  x->type = LVAL_FLOAT;
-  x->fnum = (double) x->num;
-  return x;
+  lval* f = lval_float((double) LNUM(x));
+  lval_del(x);
+  return f;
 }
 
 lval* lval_float(double x) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_FLOAT;
+  lval* v = lval_new(LVAL_FLOAT);
   v->fnum = x;
   return v;
 }
 
 lval* lval_float_to_int(lval* x) {
-  if (x->type == LVAL_INT) {
+  if (LTYPE(x) == LVAL_INT) {
     return x;
   }
-  x->type = LVAL_INT;
-  x->num = (long) x->fnum;
-  return x;
+  lval* i = lval_int((long) x->fnum);
+  lval_del(x);
+  return i;
 }
 
 lval* lval_bool(int b) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_BOOL;
-  v->num = b;
-  return v;
+  return LVAL_IMM_OF(LVAL_BOOL, b != 0);
 }
 
 lval* lval_err(char* fmt, ...) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_ERR;
+  lval* v = lval_new(LVAL_ERR);
 
   va_list va;
   va_start(va, fmt);
@@ -115,6 +303,7 @@ lval* lval_err(char* fmt, ...) {
   v->err = malloc(512);
   vsnprintf(v->err, 511, fmt, va);
   v->err = realloc(v->err, strlen(v->err) + 1);
+  gc_grow(strlen(v->err) + 1);
 
   va_end(va);
 
@@ -122,71 +311,102 @@ lval* lval_err(char* fmt, ...) {
 }
 
 lval* lval_str(char* s) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_STR;
+  lval* v = lval_new(LVAL_STR);
   v->str = malloc(strlen(s) + 1);
   strcpy(v->str, s);
+  gc_grow(strlen(s) + 1);
   return v;
 }
 
 lval* lval_sym(char* s) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_SYM;
-  v->sym = malloc(strlen(s) + 1);
-  strcpy(v->sym, s);
+  lval* v = lval_new(LVAL_SYM);
+  v->sym = lsym_intern(s);
+  v->slot = -1;
+  v->form = LSYM(v->sym)->form;
   return v;
 }
 
 lval* lval_sexpr(void) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_SEXPR;
+  lval* v = lval_new(LVAL_SEXPR);
   v->count = 0;
+  v->cap = 0;
   v->cell = NULL;
+  v->base = NULL;
+  v->cache = NULL;
   return v;
 }
 
 lval* lval_ok(void) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_OK;
-  return v;
+  return LVAL_IMM_OF(LVAL_OK, 0);
 }
 
 lval* lval_fun(lbuiltin func) {
-  lval* v =  malloc(sizeof(lval));
-  v->type = LVAL_FUN;
+  lval* v = lval_new(LVAL_FUN);
   v->builtin = func;
   return v;
 }
 
 lval* lval_qexpr(void) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_QEXPR;
+  lval* v = lval_new(LVAL_QEXPR);
   v->count = 0;
+  v->cap = 0;
   v->cell = NULL;
+  v->base = NULL;
+  v->cache = NULL;
   return v;
 }
 
 void lval_del(lval* v) {
-  switch (v->type) {
+#ifdef LISPY_GC
+  /* unreachable values are freed by the collector */
+  return;
+#endif
+  /* immediates are not allocated, others are freed by the last owner */
+  if (LVAL_IMM(v) || --v->refs > 0) {
+    return;
+  }
+  switch (LTYPE(v)) {
 
   case LVAL_BOOL:
   case LVAL_INT:
   case LVAL_FLOAT:
   case LVAL_OK:
+  case LVAL_SYM:
     break;
 
   case LVAL_ERR: free(v->err);
     break;
 
-  case LVAL_SYM: free(v->sym);
+  case LVAL_STR: free(v->str);
     break;
 
-  case LVAL_STR: free(v->str);
+  case LVAL_BIGINT: lpool_free(v->digits, sizeof(uint32_t) * v->len);
+    break;
+
+  case LVAL_VEC:
+    if (v->vbase) {
+      /* the elements belong to the base */
+      lval_del(v->vbase);
+    } else {
+      lpool_free(v->vints, LVEC_SIZE(v) * v->vlen);
+    }
+    break;
+
+  case LVAL_MAP:
+  case LVAL_SET: lmap_del(v);
+    break;
+
+  case LVAL_PMAP:
+  case LVAL_PVEC:
+  case LVAL_NODE: ltrie_del(v);
     break;
 
+  case LVAL_MACRO:
   case LVAL_FUN:
     if (!v->builtin) {
-      lenv_del(v->env);
+      if (v->args) {
+        lval_del(v->args);
+      }
       lval_del(v->formals);
       lval_del(v->body);
     }
@@ -194,106 +414,127 @@ void lval_del(lval* v) {
     
   case LVAL_QEXPR:
   case LVAL_SEXPR:
-    for (int i = 0; i < v->count; i++) {
-      lval_del(v->cell[i]);
+    if (v->base) {
+      /* the cells belong to the base */
+      lval_del(v->base);
+    } else {
+      for (int i = 0; i < v->count; i++) {
+        lval_del(v->cell[i]);
+      }
+      lpool_free(v->cell, sizeof(lval*) * v->cap);
+    }
+    if (v->cache) {
+      lval_uncache(v);
     }
-    free(v->cell);
     break;
 
   default: printf("Unexpected type\n");
   }
-  free(v);
+  lpool_free(v, sizeof(lval));
 }
 
-lval* lval_call(lenv* e, lval* f, lval* a) {
-  if (f->builtin) {
-    return f->builtin(e, a);
-  }
-
+/*
+ * Binds the arguments a of the lambda f in a new frame whose parent is
+ * e. Returns NULL and sets *frame when every formal is bound, otherwise
+ * returns an error or, given too few arguments, a partial application.
+ * Takes ownership of a but not f.
+ */
+lval* lval_bind(lenv* e, lval* f, lval* a, lenv** frame) {
+  lval* formals = f->formals;
+  /* arguments already supplied by partial application come first */
+  int bound = f->args ? f->args->count : 0;
   int given = a->count;
-  int total = f->formals->count;
-
-  while (a->count) {
-
-    if (f->formals->count == 0) {
-      lval_del(a);
-      return lval_err("Function passed too many arguments. Got %i, Expected %i.",
-                      given, total);
-    }
-
-    /* pop first symbol from the formals */
-    lval* syms = lval_pop(f->formals, 0);
+  int nargs = bound + given;
 
-    if (strcmp(syms->sym, "&") == 0) {
-      /* ensure & is followed by another symbol */
-      if (f->formals->count != 1) {
-        lval_del(a);
-        return lval_err("Function format invalid. "
-                        "Symbol '&' not followed by a single symbol.");
-      }
-      /* next formal symbol should by bound to remaining arguments */
-      lval* nsym = lval_pop(f->formals, 0);
-      lenv_put(f->env, nsym, builtin_list(e, a));
-      lval_del(syms);
-      lval_del(nsym);
+  /* formals before '&', which must be followed by a single symbol */
+  int fixed = formals->count;
+  for (int i = bound; i < formals->count; i++) {
+    if (formals->cell[i]->sym == lsym_amp) {
+      fixed = i;
       break;
     }
-
-    /* pop next argument from the list */
-    lval* val = lval_pop(a, 0);
-
-    /* bind a copy into the function's environment */
-    lenv_put(f->env, syms, val);
-
-    /* delete the symbol and value */
-    lval_del(syms);
-    lval_del(val);
+  }
+  if (fixed < formals->count && formals->count - fixed != 2) {
+    lval_del(a);
+    return lval_err("Function format invalid. "
+                    "Symbol '&' not followed by a single symbol.");
+  }
+  if (fixed == formals->count && nargs > fixed) {
+    lval_del(a);
+    return lval_err("Function passed too many arguments. Got %i, Expected %i.",
+                    given, formals->count - bound);
   }
 
-  /* argument list is now bound so clean up */
-  lval_del(a);
-
-  /* if '&' remains in formal list bind to empty list */
-  if (f->formals->count > 0 &&
-      strcmp(f->formals->cell[0]->sym, "&") == 0) {
-
-    if (f->formals->count != 2) {
-      return lval_err("Function format invalid. "
-                      "Symbol '&' not followed by a single symbol.");
+  if (nargs < fixed) {
+    /* not enough arguments yet, wrap the function and what we have */
+    lval* p = lval_new(LVAL_FUN);
+    p->builtin = NULL;
+    p->formals = lval_ref(formals);
+    p->body = lval_ref(f->body);
+    p->args = lval_qexpr();
+    for (int i = 0; i < bound; i++) {
+      lval_add(p->args, lval_ref(f->args->cell[i]));
     }
+    for (int i = 0; i < given; i++) {
+      lval_add(p->args, lval_ref(a->cell[i]));
+    }
+    lval_del(a);
+    return p;
+  }
 
-    /* pop and delete '&' symbol */
-    lval_del(lval_pop(f->formals, 0));
-
-    /* pop next symbol and create empty list */
-    lval* sym = lval_pop(f->formals, 0);
-    lval* val = lval_qexpr();
-
-    /* bind to environment and delete */
-    lenv_put(f->env, sym, val);
-    lval_del(sym);
-    lval_del(val);
+  /* bind the arguments by position, frame parent = evaluation environment */
+  lenv* x = lenv_new();
+  lenv_parent(x, e);
+  for (int i = 0; i < fixed; i++) {
+    lval* val = i < bound ? f->args->cell[i] : a->cell[i - bound];
+    lenv_put(x, formals->cell[i], val);
+  }
+  if (fixed < formals->count) {
+    /* the symbol after '&' takes the remaining arguments as a list */
+    lval* rest = lval_qexpr();
+    for (int i = fixed; i < nargs; i++) {
+      lval_add(rest, lval_ref(i < bound ? f->args->cell[i]
+                                        : a->cell[i - bound]));
+    }
+    lenv_put(x, formals->cell[fixed + 1], rest);
+    lval_del(rest);
   }
+  lval_del(a);
+  *frame = x;
+  return NULL;
+}
 
-  /* if all formals have been bound, evaluate */
-  if (f->formals->count == 0) {
+/* the body of a lambda called in e as an expression ready to evaluate */
+static lval* lval_body(lenv* e, lval* f) {
+  lval* x = lval_mut(lval_ref(lval_optimized(e, f)));
+  x->type = LVAL_SEXPR;
+  return x;
+}
 
-    /* environment parent = evaluation environment */
-    f->env->par = e;
+lval* lval_call(lenv* e, lval* f, lval* a) {
+  if (f->builtin) {
+    lval* result = f->builtin(e, a);
+    lval_del(f);
+    return result;
+  }
 
-    /* evaluate and return */
-    return builtin_eval(f->env, lval_add(lval_sexpr(),
-                                         lval_copy(f->body)));
-  } else {
-    /* otherwise return partially evaluated function */
-    return lval_copy(f);
+  lenv* frame;
+  lval* result = lval_bind(e, f, a, &frame);
+  if (result == NULL) {
+    gc_push_env(frame);
+    result = lval_eval(frame, lval_body(frame, f));
+    gc_pop(1);
+    lenv_del(frame);
   }
+  lval_del(f);
+  return result;
 }
 
 lval* lval_read_int(mpc_ast_t* t) {
   errno = 0;
   long x = strtol(t->contents, NULL, 10);
-  return errno != ERANGE ? lval_int(x) : lval_err("invalid integer");
+  /* too large for a long */
+  return errno != ERANGE ? lval_int(x) : lbig_read(t->contents);
 }
 
 lval* lval_read_float(mpc_ast_t* t) {
@@ -325,25 +566,149 @@ lval* lval_read_str(mpc_ast_t* t) {
 }
 
 lval* lval_add(lval* v, lval* x) {
-  v->count++;
-  v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-  v->cell[v->count-1] = x;
+  v = lval_mut(v);
+  lval_reserve(v, v->count + 1);
+  v->cell[v->count++] = x;
+  return v;
+}
+
+/* index of sym in the frame built from formals, or -1 */
+static int lval_formal_slot(lval* formals, char* sym) {
+  int slot = 0;
+  for (int i = 0; i < formals->count; i++) {
+    if (formals->cell[i]->sym == lsym_amp) {
+      continue;
+    }
+    if (formals->cell[i]->sym == sym) {
+      return slot;
+    }
+    slot++;
+  }
+  return -1;
+}
+
+/*
+ * Resolves references to formals in v to the slot lval_call binds them
+ * to, so lenv_get can index the frame instead of searching it. Scope is
+ * dynamic, so other symbols can only be found by name at run time.
+ * Shared subtrees are copied before being annotated.
+ */
+static lval* lval_resolve(lval* v, lval* formals) {
+  if (LTYPE(v) == LVAL_SYM) {
+    int slot = lval_formal_slot(formals, v->sym);
+    if (slot < 0 || slot == v->slot) {
+      return v;
+    }
+    lval* x = lval_sym(v->sym);
+    x->slot = slot;
+    lval_del(v);
+    return x;
+  }
+  if (ltype_expr(LTYPE(v))) {
+    for (int i = 0; i < v->count; i++) {
+      lval* c = lval_resolve(lval_ref(v->cell[i]), formals);
+      if (c == v->cell[i]) {
+        lval_del(c);
+        continue;
+      }
+      v = lval_mut(v);
+      lval_del(v->cell[i]);
+      v->cell[i] = c;
+    }
+  }
   return v;
 }
 
 lval* lval_lambda(lval* formals, lval* body) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_FUN;
+  lval* v = lval_new(LVAL_FUN);
 
   v->builtin = NULL;
 
-  v->env = lenv_new();
+  v->args = NULL;
 
   v->formals = formals;
-  v->body = body;
+  v->body = lval_resolve(body, formals);
   return v;
 }
 
+/* a macro is a lambda run on the unevaluated forms it is called with */
+lval* lval_macro(lval* formals, lval* body) {
+  lval* v = lval_lambda(formals, body);
+  v->type = LVAL_MACRO;
+  return v;
+}
+
+/* creates the parsers whose output lval_read reads */
+void lval_read_init(void) {
+  /* Create Some Parsers */
+  Integer  = mpc_new("integer");
+  Float    = mpc_new("float");
+  Boolean  = mpc_new("bool");
+  String   = mpc_new("string");
+  Comment  = mpc_new("comment");
+  Symbol   = mpc_new("symbol");
+  Sexpr    = mpc_new("sexpr");
+  Qexpr    = mpc_new("qexpr");
+  List     = mpc_new("list");
+  Quasi    = mpc_new("quasi");
+  Unquote  = mpc_new("unquote");
+  Splice   = mpc_new("splice");
+  Expr     = mpc_new("expr");
+  Lispy    = mpc_new("lispy");
+
+  /* Define them with the following Language */
+  mpca_lang(MPCA_LANG_DEFAULT, 
+  "                                                      \
+    float   : /-?[0-9]*\\.[0-9]+/ ;                      \
+    integer : /-?[0-9]+/ ;                               \
+    bool    : /(true|false)/ ;                           \
+    string  : /\"(\\\\.|[^\"])*\"/ ;                     \
+    comment : /;[^\\r\\n]*/ ;                            \
+    symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%|]+/ ;       \
+    sexpr   : '(' <expr>* ')' ;                          \
+    qexpr   : '{' <expr>* '}' ;                          \
+    list    : '[' <expr>* ']' ;                          \
+    quasi   : '`' <expr> ;                               \
+    splice  : \",@\" <expr> ;                            \
+    unquote : ',' <expr> ;                               \
+    expr    : <float> | <integer> | <bool> | <string>    \
+            | <comment> | <symbol> | <sexpr> | <qexpr>   \
+            | <list> | <quasi> | <splice> | <unquote> ;  \
+    lispy   : /^/ <expr>* /$/ ;                          \
+  ",
+            Float, Integer, Boolean, String, Comment,
+            Symbol, Sexpr, Qexpr, List, Quasi, Splice, Unquote,
+            Expr, Lispy);
+}
+
+/* undefines and deletes the parsers */
+void lval_read_cleanup(void) {
+  mpc_cleanup(14,
+              Integer, Float, Boolean, String, Comment,
+              Symbol, Sexpr, Qexpr, List, Quasi, Splice, Unquote,
+              Expr, Lispy);
+}
+
+/* (name x) for the expression t prefixed with a mark */
+static lval* lval_read_prefixed(char* name, mpc_ast_t* t) {
+  lval* x = lval_add(lval_sexpr(), lval_sym(name));
+  return lval_add(x, lval_read(t));
+}
+
+/*
+ * `x reads as (quasiquote {x}) and `(x) as (quasiquote {x}), so the
+ * template is a Q-Expression that evaluates to itself.
+ */
+static lval* lval_read_quasi(mpc_ast_t* t) {
+  lval* x = lval_read(t);
+  if (ltype_expr(LTYPE(x))) {
+    x->type = LVAL_QEXPR;
+  } else {
+    x = lval_add(lval_qexpr(), x);
+  }
+  return lval_add(lval_add(lval_sexpr(), lval_sym("quasiquote")), x);
+}
+
 lval* lval_read(mpc_ast_t* t) {
   /* Handle symbols and numbers */
   if (strstr(t->tag, "integer")) {
@@ -361,6 +726,15 @@ lval* lval_read(mpc_ast_t* t) {
   if (strstr(t->tag, "symbol")) {
     return lval_sym(t->contents);
   }
+  if (strstr(t->tag, "quasi")) {
+    return lval_read_quasi(t->children[1]);
+  }
+  if (strstr(t->tag, "splice")) {
+    return lval_read_prefixed("unquote-splicing", t->children[1]);
+  }
+  if (strstr(t->tag, "unquote")) {
+    return lval_read_prefixed("unquote", t->children[1]);
+  }
 
   /* if root (>) or sexpr then create empty list */
   lval* x = NULL;
@@ -429,14 +803,21 @@ void lval_print_str(lval* v) {
 }
 
 void lval_print(lval* v) {
-  switch (v->type) {
-  case LVAL_INT: printf("%li", v->num);
+  switch (LTYPE(v)) {
+  case LVAL_INT: printf("%li", LNUM(v));
     break;
 
   case LVAL_FLOAT: printf("%.3f", v->fnum);
     break;
 
-  case LVAL_BOOL: printf("%s", v->num ? "true" : "false");
+  case LVAL_BIGINT: {
+    char* s = lbig_str(v);
+    printf("%s", s);
+    free(s);
+    break;
+  }
+
+  case LVAL_BOOL: printf("%s", LNUM(v) ? "true" : "false");
     break;
 
   case LVAL_ERR: printf("Error: %s", v->err);
@@ -459,30 +840,71 @@ void lval_print(lval* v) {
     if (v->builtin) {
       printf("<function>");
     } else {
-      printf("(\\ ");
-      lval_print(v->formals);
+      /* a partial application shows the formals still to be bound */
+      int bound = v->args ? v->args->count : 0;
+      printf("(\\ {");
+      for (int i = bound; i < v->formals->count; i++) {
+        lval_print(v->formals->cell[i]);
+        if (i != v->formals->count - 1) {
+          putchar(' ');
+        }
+      }
+      putchar('}');
       putchar(' ');
       lval_print(v->body);
       putchar(')');
     }
     break;
+  case LVAL_MACRO:
+    printf("(macro ");
+    lval_print(v->formals);
+    putchar(' ');
+    lval_print(v->body);
+    putchar(')');
+    break;
+  case LVAL_VEC: lvec_print(v);
+    break;
+  case LVAL_MAP:
+  case LVAL_SET: lmap_print(v);
+    break;
+  case LVAL_PMAP:
+  case LVAL_PVEC: ltrie_print(v);
+    break;
   }
 }
 
+/*
+ * Copies the top level of v. Child values are immutable once shared
+ * so the copy takes references to them rather than duplicating them.
+ */
 lval* lval_copy(lval* v) {
-  lval* x = malloc(sizeof(lval));
-  x->type = v->type;
+  if (LVAL_IMM(v)) {
+    return v;
+  }
+  if (LTYPE(v) == LVAL_VEC) {
+    /* a vector's elements are its top level */
+    return lvec_copy(v);
+  }
+  if (LTYPE(v) == LVAL_MAP || LTYPE(v) == LVAL_SET) {
+    return lmap_copy(v);
+  }
+  if (LTYPE(v) == LVAL_PMAP || LTYPE(v) == LVAL_PVEC || LTYPE(v) == LVAL_NODE) {
+    /* shares the trie, which is copied a node at a time as it changes */
+    return ltrie_copy(v);
+  }
+  lval* x = lval_new(LTYPE(v));
 
-  switch(v->type) {
+  switch(LTYPE(v)) {
 
+  case LVAL_MACRO:
   case LVAL_FUN:
     if (v->builtin) {
       x->builtin = v->builtin;
     } else {
       x->builtin = NULL;
-      x->env = lenv_copy(v->env);
-      x->formals = lval_copy(v->formals);
-      x->body = lval_copy(v->body);
+      x->args = v->args ? lval_ref(v->args) : NULL;
+      x->formals = lval_ref(v->formals);
+      x->body = lval_ref(v->body);
     }
     break;
 
@@ -494,28 +916,41 @@ lval* lval_copy(lval* v) {
   case LVAL_FLOAT:
     x->fnum = v->fnum;
     break;
+
+  case LVAL_BIGINT:
+    x->len = v->len;
+    x->neg = v->neg;
+    x->digits = lpool_alloc(sizeof(uint32_t) * x->len);
+    memcpy(x->digits, v->digits, sizeof(uint32_t) * x->len);
+    gc_grow(sizeof(uint32_t) * x->len);
+    break;
     
   case LVAL_ERR:
     x->err = malloc(strlen(v->err) + 1);
     strcpy(x->err, v->err);
+    gc_grow(strlen(v->err) + 1);
     break;
 
   case LVAL_SYM:
-    x->sym = malloc(strlen(v->sym) + 1);
-    strcpy(x->sym, v->sym);
+    x->sym = v->sym;
+    x->slot = v->slot;
+    x->form = v->form;
     break;
 
   case LVAL_STR:
     x->str = malloc(strlen(v->str) + 1);
     strcpy(x->str, v->str);
+    gc_grow(strlen(v->str) + 1);
     break;
 
   case LVAL_SEXPR:
   case LVAL_QEXPR:
     x->count = v->count;
-    x->cell = malloc(sizeof(lval*) * x->count);
+    x->base = NULL;
+    x->cache = NULL;
+    lval_cells(x, x->count);
     for (int i = 0; i < x->count; i++) {
-      x->cell[i] = lval_copy(v->cell[i]);
+      x->cell[i] = lval_ref(v->cell[i]);
     }
     break;
   }
@@ -523,100 +958,319 @@ lval* lval_copy(lval* v) {
 }
 
 lval* lval_pop(lval* v, int i) {
+  if (v->base) {
+    if (i == 0 || i == v->count - 1) {
+      /* narrow the slice, the item stays owned by the base */
+      lval* x = lval_ref(v->cell[i]);
+      v->cell += i == 0;
+      v->count--;
+      return x;
+    }
+    lval_own(v);
+  }
   /* find item at "i" */
   lval* x = v->cell[i];
   /* shift memory after item "i" over the top */
   memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*) * (v->count-i-1));
-  /* decrement count of items in list */
+  /* decrement count of items in list, keeping the room for them */
   v->count--;
-  /* reallocate memory used*/
-  v->cell = realloc(v->cell, sizeof(lval*) * v->count);
+  return x;
+}
+
+/*
+ * The count cells of the list v from start, sharing v's cells rather
+ * than copying them. Takes v, which stays alive as the base of the
+ * slice while it is.
+ */
+lval* lval_slice(lval* v, int start, int count) {
+  if (start == 0 && count == v->count) {
+    return v;
+  }
+  lval* x = LTYPE(v) == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+  if (count == 0) {
+    lval_del(v);
+    return x;
+  }
+  x->count = count;
+  x->cell = v->cell + start;
+  if (v->base) {
+    /* slice the base rather than chain slices */
+    x->base = lval_ref(v->base);
+    lval_del(v);
+  } else {
+    x->base = v;
+  }
   return x;
 }
 
 lval* lval_take(lval* v, int i) {
+  if (v->refs > 1) {
+    /* v stays alive elsewhere, so share the item instead of popping it */
+    lval* x = lval_ref(v->cell[i]);
+    lval_del(v);
+    return x;
+  }
   lval* x = lval_pop(v, i);
   lval_del(v);
   return x;
 }
 
-lval* lval_eval_sexpr(lenv* e, lval* v) {
-  /* evaluate each cell in v */
-  int eval_count = v->count;
-  for (int i = 0; i < eval_count; i++) {
-    if (v->cell[i]->type == LVAL_SYM) {
-      /* check special symbols */
-      if (strcmp(v->cell[i]->sym, "defmacro") == 0) {
-        /* for macro definitions, we only want to evaluate the first term */
-        eval_count = 1;
-      }
-      if (strcmp(v->cell[i]->sym, "read") == 0) {
-        /* for read, we only want to evaluate the first term */
-        eval_count = 1;
-      }
-      if (strcmp(v->cell[i]->sym, "if") == 0) {
-        /* for if statements, we want to evaluate the 2nd term (the condition) */
-        eval_count = 2;
-      }
+/* the builtin each LFORM_* stands for */
+static lbuiltin lval_form_builtins[] = {
+  NULL, builtin_if, builtin_read, builtin_defmacro, builtin_do
+};
+
+/*
+ * LFORM_* of the cell c, about to be evaluated in e. A name is special
+ * only while it means the builtin of its form. Until the name has been
+ * bound outside the global scope, or rebound there, it can mean nothing
+ * else; after that e is searched to check.
+ *
+ * Code compiled before the environment it runs in is known passes e as
+ * NULL, taking names to be their forms, and must check again with the
+ * environment where it runs.
+ */
+int lval_form(lenv* e, lval* c) {
+  if (LTYPE(c) != LVAL_SYM || c->form == LFORM_NONE) {
+    return LFORM_NONE;
+  }
+  if (e == NULL || !LSYM(c->sym)->local) {
+    return c->form;
+  }
+  lval* f = lenv_get(e, c);
+  int form = LTYPE(f) == LVAL_FUN && f->builtin == lval_form_builtins[c->form]
+    ? c->form : LFORM_NONE;
+  lval_del(f);
+  return form;
+}
+
+/*
+ * Number of leading cells of an S-Expression to evaluate in e, given
+ * the current number and the unevaluated cell c, cell i, about to be
+ * evaluated. e may be NULL, see lval_form.
+ */
+int lval_eval_count(lenv* e, lval* c, int i, int count) {
+  if (LTYPE(c) == LVAL_SYM && c->form != LFORM_NONE) {
+    switch (lval_form(e, c)) {
+    case LFORM_DO:
+      /* do is only the form at the head, elsewhere it is an argument */
+      return i == 0 ? 1 : count;
+    case LFORM_DEFMACRO:
+    case LFORM_READ:
+      /* for macro definitions and read, only evaluate the first term */
+      return 1;
+    case LFORM_IF:
+      /* for if statements, we want to evaluate the 2nd term (the condition) */
+      return 2;
     }
-    v->cell[i] = lval_eval(e, v->cell[i]);
   }
-  
-  for (int i = 0; i < v->count; i++) {
-    if (v->cell[i]->type == LVAL_ERR) {
-      return lval_take(v, i);
+  return count;
+}
+
+/* frees the frame an evaluation owns, if any */
+void lval_release(lenv* owned) {
+  if (owned) {
+    gc_pop(1);
+    lenv_del(owned);
+  }
+}
+
+/*
+ * Makes frame, just bound for a tail call made from *e, the current
+ * environment. Frames made this way are owned by the evaluation. When
+ * the tail call is made from one, *e is that frame: the new frame
+ * inherits its unshadowed bindings and replaces it, so the chain of
+ * frames does not grow however long a tail recursive loop runs.
+ */
+void lval_enter(lenv** e, lenv** owned, lenv* frame) {
+  if (*owned) {
+    lenv_inherit(frame, *owned);
+    lval_release(*owned);
+  }
+  *owned = *e = frame;
+  gc_push_env(frame);
+}
+
+/*
+ * Builtins that decide which expression to evaluate next, and the
+ * function returning it, so the evaluators can evaluate it in tail
+ * position. Calling the builtin itself evaluates it.
+ */
+static struct {
+  lbuiltin fn;
+  lbuiltin expr;
+} lval_tail_builtins[] = {
+  { builtin_if, builtin_if_branch },
+  { builtin_eval, builtin_eval_expr },
+  { builtin_do, builtin_do_expr },
+  { builtin_select, builtin_select_branch },
+  { builtin_case, builtin_case_branch },
+  { builtin_case_table, builtin_case_table_branch },
+  { NULL, NULL }
+};
+
+/*
+ * Applies v, an S-Expression in *e whose first 'evaluated' cells have
+ * been evaluated. Fewer than all of them means a form left the rest as
+ * they are, see lval_eval_count. Returns the result, or NULL when an
+ * expression in tail position is left to evaluate, in which case it is
+ * stored in *v and *e is set to the environment to evaluate it in.
+ *
+ * Frames created for tail calls are owned by the evaluation and passed
+ * in *owned, see lval_enter. If fn is not NULL a lambda being entered
+ * is stored in *fn instead of its body in *v, for the caller to run
+ * its compiled form.
+ */
+lval* lval_apply(lenv** e, lval** v, int evaluated, lenv** owned, lval** fn) {
+  lval* x = *v;
+  for (int i = 0; i < x->count; i++) {
+    if (LTYPE(x->cell[i]) == LVAL_ERR) {
+      return lval_take(x, i);
     }
   }
-  if (v->count == 0) {
-    return v;
-  }  
-  if (v->count == 1) {
-    return lval_eval(e, lval_take(v, 0));
+  if (x->count == 0) {
+    return x;
   }
-  
-  lval* f = lval_pop(v, 0);
-  if (f->type != LVAL_FUN) {
+  if (x->count == 1) {
+    *v = lval_take(x, 0);
+    return NULL;
+  }
+
+  lval* f = lval_pop(x, 0);
+  if (LTYPE(f) == LVAL_MACRO) {
+    /* its arguments have been evaluated, too late to expand it */
+    lval_del(f);
+    lval_del(x);
+    return lval_err("Macro applied at run time. Macros are expanded where "
+                    "they are called by name when code is loaded or a "
+                    "function first runs, see macro.c");
+  }
+  if (LTYPE(f) != LVAL_FUN) {
     lval* err = lval_err("S-Expression starts with incorrect type. Got %s, Expected %s.",
-                         ltype_name(f->type),
+                         ltype_name(LTYPE(f)),
                          ltype_name(LVAL_FUN));
     lval_del(f);
-    lval_del(v);
+    lval_del(x);
     return err;
   }
-  lval* result = lval_call(e, f, v);
+
+  /* do evaluates its arguments only where it is the form, see builtin_do */
+  int values = f->builtin == builtin_do && evaluated > x->count;
+  for (int i = 0; f->builtin && !values && lval_tail_builtins[i].fn; i++) {
+    if (f->builtin == lval_tail_builtins[i].fn) {
+      *v = lval_tail_builtins[i].expr(*e, x);
+      lval_del(f);
+      return NULL;
+    }
+  }
+  if (f->builtin == builtin_let) {
+    /* the body runs in a frame of its own, like a lambda's */
+    *v = builtin_let_expr(*e, x);
+    if (LTYPE(*v) != LVAL_ERR) {
+      lenv* frame = lenv_new();
+      lenv_parent(frame, *e);
+      lval_enter(e, owned, frame);
+    }
+    lval_del(f);
+    return NULL;
+  }
+  if (f->builtin) {
+    return lval_call(*e, f, x);
+  }
+
+  lenv* frame;
+  lval* result = lval_bind(*e, f, x, &frame);
+  if (result) {
+    lval_del(f);
+    return result;
+  }
+  lval_enter(e, owned, frame);
+  if (fn) {
+    *fn = f;
+    return NULL;
+  }
+  *v = lval_body(*e, f);
+  lval_del(f);
+  return NULL;
+}
+
+/*
+ * Evaluates v in e by recursion on the C stack for nested expressions.
+ * Expressions in tail position (a lambda body, the chosen branch of
+ * 'if', the argument of 'eval' and a lone value to be re-evaluated) are
+ * evaluated by the same loop, so iteration written as tail recursion
+ * runs in constant C stack.
+ */
+static lval* lval_eval_tree(lenv* e, lval* v) {
+  lenv* owned = NULL;
+  lval* result;
+
+  while (1) {
+    gc_safepoint(e, v);
+    if (LTYPE(v) == LVAL_SYM) {
+      result = lenv_get(e, v);
+      lval_del(v);
+      break;
+    }
+    if (LTYPE(v) != LVAL_SEXPR) {
+      result = v;
+      break;
+    }
+
+    /* evaluation replaces cells in place */
+    v = lval_mut(v);
+    int eval_count = v->count;
+    gc_push(v);
+    for (int i = 0; i < eval_count; i++) {
+      eval_count = lval_eval_count(e, v->cell[i], i, eval_count);
+      v->cell[i] = lval_eval_tree(e, v->cell[i]);
+    }
+    gc_pop(1);
+
+    result = lval_apply(&e, &v, eval_count, &owned, NULL);
+    if (result) {
+      break;
+    }
+  }
+
+  lval_release(owned);
   return result;
 }
 
+int lval_engine = LVAL_ENGINE_TREE;
+
 lval* lval_eval(lenv* e, lval* v) {
-  if (v->type == LVAL_SYM) {
-    lval* x = lenv_get(e, v);
-    lval_del(v);
-    return x;
+  if (lval_engine == LVAL_ENGINE_CEK) {
+    return lval_eval_cek(e, v);
   }
-  if (v->type == LVAL_SEXPR) {
-    return lval_eval_sexpr(e, v);
+  if (lval_engine == LVAL_ENGINE_VM) {
+    return lval_eval_vm(e, v);
   }
-  return v;
+  return lval_eval_tree(e, v);
 }
 
 lval* lval_join(lval* x, lval* y) {
   /* for each cell in 'y' add it to 'x' */
-  if (x->type == LVAL_STR && y->type == LVAL_STR) {
+  if (LTYPE(x) == LVAL_STR && LTYPE(y) == LVAL_STR) {
+    x = lval_mut(x);
     int orig = strlen(x->str);
     x->str = realloc(x->str, sizeof(char) * (orig + strlen(y->str) + 1));
+    gc_grow(strlen(y->str));
     char* ystart = x->str + (orig * sizeof(char));
     strcpy(ystart, y->str);
     x->str[strlen(x->str)] = '\0';
   } else {
     /* if both are not q-expressions, implicitly convert whichever is not */
-    if (x->type == LVAL_STR) {
+    if (LTYPE(x) == LVAL_STR) {
       x = lval_add(lval_qexpr(), x);
     }
-    if (y->type == LVAL_STR) {
+    if (LTYPE(y) == LVAL_STR) {
       y = lval_add(lval_qexpr(), y);
     }
-    while (y->count) {
-      x = lval_add(x, lval_pop(y, 0));
+    x = lval_mut(x);
+    lval_reserve(x, x->count + y->count);
+    for (int i = 0; i < y->count; i++) {
+      x = lval_add(x, lval_ref(y->cell[i]));
     }
   }
   lval_del(y);
@@ -0,0 +1,479 @@
+#define _POSIX_C_SOURCE 199309L
+#include <time.h>
+#include "lispy.h"
+
+/*
+ * Macros.
+ *
+ * (defmacro (name formals...) body) defines a macro globally. A call of
+ * one, (name forms...), is expanded by binding the forms unevaluated to
+ * the formals and evaluating the body, and the code it returns replaces
+ * the call. Expansion happens once, before the code runs:
+ *
+ *  - each top level expression is expanded as it is loaded, or read by
+ *    the REPL, and each expression given to eval before it is evaluated;
+ *  - the body of a lambda or macro is expanded when lval_optimized
+ *    prepares it for its first call, and the expansion is kept with the
+ *    optimized body, so each call site is expanded once. It is made
+ *    again only if a macro has been defined or redefined since, which
+ *    bumps lval_epoch.
+ *
+ * Expansion walks S-Expressions, the branches of 'if', the body of
+ * 'let' and the expressions in the clauses of 'select' and 'case', but
+ * not the bodies of lambdas, which are expanded when they run. Heads
+ * naming a formal of the lambda being expanded are left alone, as the
+ * formal shadows the macro or builtin. Macros are found by name in the
+ * global scope when the code is expanded; one reached any other way
+ * (passed as a value, or bound in a frame) cannot be expanded and is an
+ * error when applied.
+ *
+ * Macro bodies usually build code with a quasiquote template:
+ * `(if ,c {,body} {()}) reads as (quasiquote {if (unquote c) ...}) and
+ * evaluates to the template with each ,x replaced by the value of x and
+ * each ,@x by the cells of the list x. Templates do not nest.
+ */
+
+/* most times the expansion of a call may itself be a macro call */
+#define LMAC_DEPTH 256
+
+typedef struct {
+  /* environment macros are looked up in */
+  lenv* global;
+  /* formals and body of the lambda whose body is expanded, or NULL */
+  lval* formals;
+  lval* body;
+  /* what the expanded code belongs to, see lmac_site */
+  char* site;
+} lmac;
+
+/* expansions of one macro in the code of one definition, for macro-stats */
+typedef struct {
+  char* name;
+  char* site;
+  long count;
+  double time;
+} lmac_stat;
+
+static lmac_stat* lmac_stats = NULL;
+static int lmac_nstats = 0;
+/* set once any macro is defined, until then there is nothing to expand */
+static int lmac_defined = 0;
+
+static char lmac_top[] = "top level";
+static char lmac_lambda[] = "a lambda";
+
+static double lmac_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the statistics of the macro called name expanded in site, added if new */
+static lmac_stat* lmac_stat_of(char* name, char* site) {
+  for (int i = 0; i < lmac_nstats; i++) {
+    if (lmac_stats[i].name == name && lmac_stats[i].site == site) {
+      return &lmac_stats[i];
+    }
+  }
+  lmac_stats = realloc(lmac_stats, sizeof(lmac_stat) * (lmac_nstats + 1));
+  lmac_stat* s = &lmac_stats[lmac_nstats++];
+  s->name = name;
+  s->site = site;
+  s->count = 0;
+  s->time = 0;
+  return s;
+}
+
+/*
+ * The name of the global function or macro whose body m expands, found
+ * the first time a macro is called in it, "top level" for code that is
+ * loaded or evaluated and "a lambda" for an unnamed body.
+ */
+static char* lmac_site(lmac* m) {
+  if (m->site) {
+    return m->site;
+  }
+  m->site = m->body ? lmac_lambda : lmac_top;
+  lenv* g = m->global;
+  for (int i = 0; m->body && i < g->count; i++) {
+    lval* f = g->vals[i];
+    if ((LTYPE(f) == LVAL_FUN || LTYPE(f) == LVAL_MACRO) && !f->builtin
+        && f->body == m->body) {
+      m->site = g->syms[i];
+      break;
+    }
+  }
+  return m->site;
+}
+
+/* whether a formal of the lambda being expanded is called sym */
+static int lmac_shadowed(lmac* m, char* sym) {
+  for (int i = 0; m->formals && i < m->formals->count; i++) {
+    if (m->formals->cell[i]->sym == sym) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* the macro the list v calls, or NULL */
+static lval* lmac_head(lmac* m, lval* v) {
+  if (v->count == 0 || LTYPE(v->cell[0]) != LVAL_SYM
+      || lmac_shadowed(m, v->cell[0]->sym)) {
+    return NULL;
+  }
+  return lenv_macro(m->global, v->cell[0]->sym);
+}
+
+/* whether v is (name x) */
+static int lmac_is(lval* v, char* name) {
+  return LTYPE(v) == LVAL_SEXPR && v->count == 2
+    && LTYPE(v->cell[0]) == LVAL_SYM && v->cell[0]->sym == name;
+}
+
+/* v with cell i replaced by x, copied first if shared */
+static lval* lmac_replace(lval* v, int i, lval* x) {
+  if (x == v->cell[i]) {
+    lval_del(x);
+    return v;
+  }
+  v = lval_mut(v);
+  lval_del(v->cell[i]);
+  v->cell[i] = x;
+  return v;
+}
+
+/* evaluates the body of macro mac for the call x, taking x */
+static lval* lmac_call(lmac* m, lval* mac, lval* x) {
+  x = lval_mut(x);
+  lval* head = lval_pop(x, 0);
+  char* name = head->sym;
+  lval_del(head);
+  double start = lmac_now();
+
+  /* a redefinition while the body runs could free it */
+  mac = lval_ref(mac);
+  gc_push(mac);
+  lenv* frame;
+  lval* r = lval_bind(m->global, mac, x, &frame);
+  if (r == NULL) {
+    gc_push_env(frame);
+    lval* body = lval_mut(lval_ref(lval_optimized(frame, mac)));
+    body->type = LVAL_SEXPR;
+    r = lval_eval(frame, body);
+    gc_pop(1);
+    lenv_del(frame);
+  } else if (LTYPE(r) != LVAL_ERR) {
+    /* a partial application */
+    lval_del(r);
+    r = lval_err("Macro '%s' passed too few arguments.", name);
+  }
+  gc_pop(1);
+  lval_del(mac);
+
+  lmac_stat* s = lmac_stat_of(name, lmac_site(m));
+  s->count++;
+  s->time += lmac_now() - start;
+  return r;
+}
+
+static lval* lmac_list(lmac* m, lval* v, int keep);
+
+/* expands the code in unquotes of the quasiquote template t */
+static lval* lmac_template(lmac* m, lval* t) {
+  if (!ltype_expr(LTYPE(t))) {
+    return t;
+  }
+  int unquote = lmac_is(t, lsym_unquote) || lmac_is(t, lsym_splice);
+  gc_push(t);
+  for (int i = unquote; i < t->count; i++) {
+    lval* c = lval_ref(t->cell[i]);
+    c = unquote ? (LTYPE(c) == LVAL_SEXPR ? lmac_list(m, c, 0) : c)
+                : lmac_template(m, c);
+    lval* n = lmac_replace(t, i, c);
+    if (n != t) {
+      gc_pop(1);
+      gc_push(n);
+    }
+    t = n;
+  }
+  gc_pop(1);
+  return t;
+}
+
+/* the builtin the head h of a list names where it is expanded, or NULL */
+static lbuiltin lmac_builtin(lmac* m, lval* h) {
+  if (LTYPE(h) == LVAL_FUN) {
+    return h->builtin;
+  }
+  if (LTYPE(h) != LVAL_SYM || lmac_shadowed(m, h->sym)) {
+    return NULL;
+  }
+  lval* f = lenv_get(m->global, h);
+  lbuiltin fn = LTYPE(f) == LVAL_FUN ? f->builtin : NULL;
+  lval_del(f);
+  return fn;
+}
+
+/* v with each cell c replaced by each(m, c) */
+static lval* lmac_each(lmac* m, lval* v, lval* (*each)(lmac*, lval*)) {
+  gc_push(v);
+  for (int i = 0; i < v->count; i++) {
+    lval* n = lmac_replace(v, i, each(m, lval_ref(v->cell[i])));
+    if (n != v) {
+      gc_pop(1);
+      gc_push(n);
+    }
+    v = n;
+  }
+  gc_pop(1);
+  return v;
+}
+
+/* expands x if it is an S-Expression */
+static lval* lmac_expr(lmac* m, lval* x) {
+  return LTYPE(x) == LVAL_SEXPR ? lmac_list(m, x, 0) : x;
+}
+
+/* expands the condition or key and the expression of a clause {x y} */
+static lval* lmac_clause(lmac* m, lval* c) {
+  return LTYPE(c) == LVAL_QEXPR ? lmac_each(m, c, lmac_expr) : c;
+}
+
+/* expands the clauses of a bucket of builtin_case_table, see opt.c */
+static lval* lmac_bucket(lmac* m, lval* b) {
+  return LTYPE(b) == LVAL_QEXPR ? lmac_each(m, b, lmac_clause) : b;
+}
+
+/*
+ * Expands cell i of v, a list whose head is not a macro but the
+ * builtin fn, or NULL if it is not one, if the cell is code.
+ */
+static lval* lmac_code(lmac* m, lbuiltin fn, lval* v, int i) {
+  lval* c = lval_ref(v->cell[i]);
+  if (LTYPE(c) == LVAL_SEXPR) {
+    return lmac_list(m, c, 0);
+  }
+  if (LTYPE(c) != LVAL_QEXPR || i == 0) {
+    return c;
+  }
+  if ((fn == builtin_if && (i == 2 || i == 3)) || (fn == builtin_let && i == 1)) {
+    /* the branches of an 'if' and the body of a 'let' */
+    return lmac_list(m, c, 1);
+  }
+  if (fn == builtin_select || (fn == builtin_case && i > 1)) {
+    return lmac_clause(m, c);
+  }
+  if (fn == builtin_case_table && i == 2) {
+    return lmac_each(m, c, lmac_bucket);
+  }
+  return c;
+}
+
+/* expands the cells of v, a list whose head is not a macro */
+static lval* lmac_cells(lmac* m, lval* v) {
+  if (v->count == 0) {
+    return v;
+  }
+  lval* h = v->cell[0];
+  lbuiltin fn = lmac_builtin(m, h);
+  if (fn == builtin_defmacro) {
+    /* the body is expanded when the macro runs */
+    return v;
+  }
+  int quasi = LTYPE(h) == LVAL_SYM && h->sym == lsym_quasiquote;
+  gc_push(v);
+  for (int i = 0; i < v->count; i++) {
+    lval* c;
+    if (quasi && i > 0) {
+      c = lmac_template(m, lval_ref(v->cell[i]));
+    } else {
+      c = lmac_code(m, fn, v, i);
+    }
+    lval* n = lmac_replace(v, i, c);
+    if (n != v) {
+      gc_pop(1);
+      gc_push(n);
+    }
+    v = n;
+  }
+  gc_pop(1);
+  return v;
+}
+
+/*
+ * Expands v, a list evaluated as an S-Expression whatever its type. A
+ * macro call is replaced by its expansion, expanded in turn, which is
+ * kept a list of the same type as v if keep is set.
+ */
+static lval* lmac_list(lmac* m, lval* v, int keep) {
+  int type = LTYPE(v);
+  lval* mac;
+  for (int depth = 0; (mac = lmac_head(m, v)); depth++) {
+    if (depth == LMAC_DEPTH) {
+      lval* err = lval_err("Macro '%s' expanded more than %i times in a row.",
+                           v->cell[0]->sym, LMAC_DEPTH);
+      lval_del(v);
+      v = err;
+      break;
+    }
+    v = lmac_call(m, mac, v);
+    if (!ltype_expr(LTYPE(v))) {
+      break;
+    }
+    if (LTYPE(v) != type) {
+      v = lval_mut(v);
+      v->type = type;
+    }
+  }
+  if (!ltype_expr(LTYPE(v))) {
+    /* a value, which evaluates to itself */
+    return keep ? lval_add(type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr(), v)
+                : v;
+  }
+  return lmac_cells(m, v);
+}
+
+static void lmac_init(lmac* m, lenv* e, lval* formals, lval* body) {
+  m->global = e->root;
+  m->formals = formals;
+  m->body = body;
+  m->site = NULL;
+}
+
+/* the expression v, about to be evaluated in e, with macros expanded */
+lval* lval_expand(lenv* e, lval* v) {
+  if (!lmac_defined || LTYPE(v) != LVAL_SEXPR) {
+    return v;
+  }
+  lmac m;
+  lmac_init(&m, e, NULL, NULL);
+  return lmac_list(&m, v, 0);
+}
+
+/* the body of a lambda with the given formals, with macros expanded */
+lval* lval_expand_body(lenv* e, lval* body, lval* formals) {
+  if (!lmac_defined) {
+    return body;
+  }
+  lmac m;
+  lmac_init(&m, e, formals, body);
+  return lmac_list(&m, body, 1);
+}
+
+lval* builtin_defmacro(lenv* e, lval* a) {
+  LASSERT_NUM("defmacro", a, 2);
+  LASSERT(a, (LTYPE(a->cell[0]) == LVAL_SYM || LTYPE(a->cell[0]) == LVAL_SEXPR),
+          "Function 'defmacro' takes symbol or s-expression. Got %s",
+          ltype_name(LTYPE(a->cell[0])));
+  lval* def = a->cell[0];
+
+  if (LTYPE(def) == LVAL_SYM) {
+    /* (defmacro name other) gives the macro other another name */
+    lval* mac = LTYPE(a->cell[1]) == LVAL_SYM
+      ? lenv_macro(e, a->cell[1]->sym) : NULL;
+    LASSERT(a, mac, "Function 'defmacro' expected the name of a macro for %s.",
+            def->sym);
+    lmac_defined = 1;
+    lenv_def(e, def, mac);
+    lval_del(a);
+    return lval_ok();
+  }
+
+  LASSERT(a, def->count > 0, "Function 'defmacro' passed () for argument 0.");
+  for (int i = 0; i < def->count; i++) {
+    LASSERT(a, (LTYPE(def->cell[i]) == LVAL_SYM),
+            "Function 'defmacro' cannot define non-symbol. Got %s, Expected %s",
+            ltype_name(LTYPE(def->cell[i])),
+            ltype_name(LVAL_SYM));
+  }
+  def = a->cell[0] = lval_mut(def);
+  lval* name = lval_pop(def, 0);
+  def->type = LVAL_QEXPR;
+  lval* body = lval_ref(a->cell[1]);
+  if (!ltype_expr(LTYPE(body))) {
+    /* bodies are evaluated as S-Expressions */
+    body = lval_add(lval_qexpr(), body);
+  }
+  lval* mac = lval_macro(lval_ref(def), body);
+  lmac_defined = 1;
+  lenv_def(e, name, mac);
+  lval_del(mac);
+  lval_del(name);
+  lval_del(a);
+  return lval_ok();
+}
+
+/* the template t with its unquotes filled in from e, or an error */
+static lval* lmac_fill(lenv* e, lval* t) {
+  if (lmac_is(t, lsym_unquote)) {
+    return lval_eval(e, lval_ref(t->cell[1]));
+  }
+  if (!ltype_expr(LTYPE(t))) {
+    return lval_ref(t);
+  }
+  lval* x = LTYPE(t) == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+  gc_push(x);
+  for (int i = 0; i < t->count; i++) {
+    lval* c = t->cell[i];
+    lval* y;
+    if (lmac_is(c, lsym_splice)) {
+      y = lval_eval(e, lval_ref(c->cell[1]));
+      if (ltype_expr(LTYPE(y))) {
+        for (int j = 0; j < y->count; j++) {
+          x = lval_add(x, lval_ref(y->cell[j]));
+        }
+        lval_del(y);
+        continue;
+      }
+      if (LTYPE(y) != LVAL_ERR) {
+        lval* err = lval_err("Function 'unquote-splicing' passed incorrect "
+                             "type. Got %s, Expected %s.",
+                             ltype_name(LTYPE(y)), ltype_name(LVAL_QEXPR));
+        lval_del(y);
+        y = err;
+      }
+    } else {
+      y = lmac_fill(e, c);
+    }
+    if (LTYPE(y) == LVAL_ERR) {
+      gc_pop(1);
+      lval_del(x);
+      return y;
+    }
+    x = lval_add(x, y);
+  }
+  gc_pop(1);
+  return x;
+}
+
+lval* builtin_quasiquote(lenv* e, lval* a) {
+  LASSERT_NUM("quasiquote", a, 1);
+  LASSERT_TYPE("quasiquote", a, 0, LVAL_QEXPR);
+  gc_push(a);
+  lval* x = lmac_fill(e, a->cell[0]);
+  gc_pop(1);
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_unquote(lenv* e, lval* a) {
+  lval_del(a);
+  return lval_err("Unquote used outside of a quasiquote template.");
+}
+
+/*
+ * Prints, for each macro and each definition whose code called it, how
+ * many times it has been expanded there and the time spent evaluating
+ * its body. Arguments are ignored, call as (macro-stats {}).
+ */
+lval* builtin_macro_stats(lenv* e, lval* a) {
+  lval_del(a);
+  for (int i = 0; i < lmac_nstats; i++) {
+    lmac_stat* s = &lmac_stats[i];
+    printf("%s in %s: %li expansions, %.3f ms, %.3f us each\n",
+           s->name, s->site, s->count, s->time * 1000,
+           s->count ? s->time * 1e6 / s->count : 0.0);
+  }
+  return lval_ok();
+}
@@ -0,0 +1,407 @@
+#include "lispy.h"
+
+/*
+ * Hash maps and sets.
+ *
+ * An LVAL_MAP maps keys to values and an LVAL_SET holds keys alone.
+ * Keys are any values, found by lval_hash and lval_eq, so 1 and 1.0 are
+ * different keys as they are different values.
+ *
+ * Entries are kept in an array in the order their keys were first
+ * added, which is the order keys, values and printing go in. An
+ * open-addressed index of twice as many slots as there is room for
+ * entries finds them, as lenv.c does for symbols. Deleting a key
+ * clears its entry and empties its index slot, moving back any slots
+ * after it that would no longer be found, so the index never fills with
+ * deleted keys. The array is rebuilt without cleared entries when it
+ * fills, doubling it if more than half of the entries are in use.
+ *
+ * The builtins return the map or set they were passed with the change
+ * made, and like other values it is only changed in place when nothing
+ * else holds it. (hash-map k v ...) or (hash-map {k v ...}) builds a
+ * map, (hash-set x ...) or (hash-set {x ...}) a set. The map builtins
+ * take the persistent maps of trie.c as well.
+ */
+
+/* room for entries in a map's first array */
+#define LMAP_MIN 4
+
+static lval* lmap_new(int type) {
+  lval* m = lval_new(type);
+  m->mlen = 0;
+  m->mused = 0;
+  m->mcap = 0;
+  m->mentries = NULL;
+  m->mindex = NULL;
+  return m;
+}
+
+/* adds an entry for a key m does not have, where there is room for it */
+static void lmap_append(lval* m, unsigned long hash, lval* k, lval* v) {
+  unsigned long mask = 2 * m->mcap - 1;
+  unsigned long i = hash & mask;
+  while (m->mindex[i]) {
+    i = (i + 1) & mask;
+  }
+  m->mindex[i] = m->mused + 1;
+  lentry* x = &m->mentries[m->mused++];
+  x->hash = hash;
+  x->key = k;
+  x->val = v;
+  m->mlen++;
+}
+
+/* rebuilds the entries and index of m with room for cap entries */
+static void lmap_resize(lval* m, int cap) {
+  lentry* old = m->mentries;
+  int used = m->mused;
+  int oldcap = m->mcap;
+  lpool_free(m->mindex, sizeof(int) * 2 * oldcap);
+  m->mentries = lpool_alloc(sizeof(lentry) * cap);
+  m->mindex = lpool_alloc(sizeof(int) * 2 * cap);
+  gc_grow((sizeof(lentry) + sizeof(int) * 2) * cap);
+  memset(m->mindex, 0, sizeof(int) * 2 * cap);
+  m->mcap = cap;
+  m->mused = 0;
+  m->mlen = 0;
+  for (int i = 0; i < used; i++) {
+    if (old[i].key) {
+      lmap_append(m, old[i].hash, old[i].key, old[i].val);
+    }
+  }
+  lpool_free(old, sizeof(lentry) * oldcap);
+}
+
+/* the index slot of the entry for k in m, or -1 */
+static long lmap_slot(lval* m, lval* k, unsigned long hash) {
+  if (!m->mcap) {
+    return -1;
+  }
+  unsigned long mask = 2 * m->mcap - 1;
+  for (unsigned long i = hash & mask; m->mindex[i]; i = (i + 1) & mask) {
+    lentry* x = &m->mentries[m->mindex[i] - 1];
+    if (x->hash == hash && lval_eq(x->key, k)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/* the number of the entry for k in m, or -1 */
+static int lmap_find(lval* m, lval* k, unsigned long hash) {
+  long i = lmap_slot(m, k, hash);
+  return i < 0 ? -1 : m->mindex[i] - 1;
+}
+
+/* sets k to v in m, which must be safe to modify, taking k and v */
+static void lmap_put(lval* m, lval* k, lval* v) {
+  unsigned long hash = lval_hash(k);
+  int n = lmap_find(m, k, hash);
+  if (n >= 0) {
+    lval_del(k);
+    if (m->mentries[n].val) {
+      lval_del(m->mentries[n].val);
+    }
+    m->mentries[n].val = v;
+    return;
+  }
+  if (m->mused == m->mcap) {
+    int cap = m->mcap ? m->mcap : LMAP_MIN;
+    lmap_resize(m, m->mlen >= cap / 2 ? cap * 2 : cap);
+  }
+  lmap_append(m, hash, k, v);
+}
+
+/* deletes k from m, which must be safe to modify */
+static void lmap_remove(lval* m, lval* k) {
+  long i = lmap_slot(m, k, lval_hash(k));
+  if (i < 0) {
+    return;
+  }
+  lentry* x = &m->mentries[m->mindex[i] - 1];
+  lval_del(x->key);
+  if (x->val) {
+    lval_del(x->val);
+  }
+  x->key = NULL;
+  x->val = NULL;
+  m->mlen--;
+
+  /* move back slots whose probe from their hash passed through i */
+  unsigned long mask = 2 * m->mcap - 1;
+  for (unsigned long j = (i + 1) & mask; m->mindex[j]; j = (j + 1) & mask) {
+    unsigned long h = m->mentries[m->mindex[j] - 1].hash & mask;
+    if (((j - h) & mask) >= ((j - i) & mask)) {
+      m->mindex[i] = m->mindex[j];
+      i = j;
+    }
+  }
+  m->mindex[i] = 0;
+}
+
+lval* lmap_copy(lval* m) {
+  lval* x = lmap_new(LTYPE(m));
+  if (m->mlen) {
+    int cap = LMAP_MIN;
+    while (cap < m->mlen) {
+      cap *= 2;
+    }
+    lmap_resize(x, cap);
+    for (int i = 0; i < m->mused; i++) {
+      lentry* e = &m->mentries[i];
+      if (e->key) {
+        lmap_append(x, e->hash, lval_ref(e->key),
+                    e->val ? lval_ref(e->val) : NULL);
+      }
+    }
+  }
+  return x;
+}
+
+/* frees what m holds, for lval_del */
+void lmap_del(lval* m) {
+  for (int i = 0; i < m->mused; i++) {
+    if (m->mentries[i].key) {
+      lval_del(m->mentries[i].key);
+    }
+    if (m->mentries[i].val) {
+      lval_del(m->mentries[i].val);
+    }
+  }
+  lpool_free(m->mentries, sizeof(lentry) * m->mcap);
+  lpool_free(m->mindex, sizeof(int) * 2 * m->mcap);
+}
+
+/* equal if they have equal keys, with equal values, in any order */
+int lmap_eq(lval* x, lval* y) {
+  if (x->mlen != y->mlen) {
+    return 0;
+  }
+  for (int i = 0; i < x->mused; i++) {
+    lentry* e = &x->mentries[i];
+    if (!e->key) {
+      continue;
+    }
+    int n = lmap_find(y, e->key, e->hash);
+    if (n < 0 || (e->val && !lval_eq(e->val, y->mentries[n].val))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* combines the entries with a sum, so their order does not matter */
+unsigned long lmap_hash(lval* m) {
+  unsigned long h = 0;
+  for (int i = 0; i < m->mused; i++) {
+    lentry* e = &m->mentries[i];
+    if (e->key) {
+      h += e->val ? (e->hash ^ lval_hash(e->val)) * 16777619u : e->hash;
+    }
+  }
+  return (2166136261u ^ LTYPE(m) ^ h) * 16777619u;
+}
+
+/* #map{k v, k v} or #set{x x} */
+void lmap_print(lval* m) {
+  printf(LTYPE(m) == LVAL_MAP ? "#map{" : "#set{");
+  int first = 1;
+  for (int i = 0; i < m->mused; i++) {
+    lentry* e = &m->mentries[i];
+    if (!e->key) {
+      continue;
+    }
+    if (!first) {
+      printf(e->val ? ", " : " ");
+    }
+    first = 0;
+    lval_print(e->key);
+    if (e->val) {
+      putchar(' ');
+      lval_print(e->val);
+    }
+  }
+  putchar('}');
+}
+
+/* checks the first argument of a is a set, or a map of either kind */
+#define LMAP_ASSERT_TYPE(func, a, t) \
+  LASSERT(a, t == LVAL_MAP ? ltype_map(LTYPE(a->cell[0])) \
+          : LTYPE(a->cell[0]) == t, \
+          "Function '%s' passed incorrect type for argument 0. " \
+          "Got %s, Expected %s.", func, ltype_name(LTYPE(a->cell[0])), \
+          ltype_name(t))
+
+/* the arguments of a, or the items of a single Q-Expression in a */
+static lval* lmap_items(lval* a) {
+  return a->count == 1 && LTYPE(a->cell[0]) == LVAL_QEXPR ? a->cell[0] : a;
+}
+
+lval* builtin_hash_map(lenv* e, lval* a) {
+  lval* l = lmap_items(a);
+  LASSERT(a, l->count % 2 == 0,
+          "Function 'hash-map' passed %i items, Expected keys and values.",
+          l->count);
+  lval* m = lmap_new(LVAL_MAP);
+  for (int i = 0; i < l->count; i += 2) {
+    lmap_put(m, lval_ref(l->cell[i]), lval_ref(l->cell[i + 1]));
+  }
+  lval_del(a);
+  return m;
+}
+
+lval* builtin_hash_set(lenv* e, lval* a) {
+  lval* l = lmap_items(a);
+  lval* m = lmap_new(LVAL_SET);
+  for (int i = 0; i < l->count; i++) {
+    lmap_put(m, lval_ref(l->cell[i]), NULL);
+  }
+  lval_del(a);
+  return m;
+}
+
+/* (map-get m k) or (map-get m k default) */
+lval* builtin_map_get(lenv* e, lval* a) {
+  LASSERT(a, a->count == 2 || a->count == 3,
+          "Function 'map-get' passed incorrect number of arguments. "
+          "Got %i, Expected 2 or 3.", a->count);
+  LMAP_ASSERT_TYPE("map-get", a, LVAL_MAP);
+  lval* m = a->cell[0];
+  lval* v;
+  if (LTYPE(m) == LVAL_PMAP) {
+    v = lhamt_get(m, a->cell[1]);
+  } else {
+    int n = lmap_find(m, a->cell[1], lval_hash(a->cell[1]));
+    v = n >= 0 ? m->mentries[n].val : NULL;
+  }
+  LASSERT(a, v || a->count == 3,
+          "Function 'map-get' passed a key the map does not have.");
+  v = lval_ref(v ? v : a->cell[2]);
+  lval_del(a);
+  return v;
+}
+
+lval* builtin_map_put(lenv* e, lval* a) {
+  LASSERT_NUM("map-put", a, 3);
+  LMAP_ASSERT_TYPE("map-put", a, LVAL_MAP);
+  lval* v = lval_ref(a->cell[2]);
+  lval* k = lval_ref(a->cell[1]);
+  lval* m = lval_take(a, 0);
+  if (LTYPE(m) == LVAL_PMAP) {
+    return lhamt_put(m, k, v);
+  }
+  m = lval_mut(m);
+  lmap_put(m, k, v);
+  return m;
+}
+
+/* (set-add s x ...) */
+lval* builtin_set_add(lenv* e, lval* a) {
+  LASSERT(a, a->count > 0,
+          "Function 'set-add' passed no arguments.");
+  LASSERT_TYPE("set-add", a, 0, LVAL_SET);
+  lval* m = lval_mut(lval_pop(a, 0));
+  for (int i = 0; i < a->count; i++) {
+    lmap_put(m, lval_ref(a->cell[i]), NULL);
+  }
+  lval_del(a);
+  return m;
+}
+
+/* deletes keys from a map or set of type t */
+static lval* lmap_delete(lval* a, char* func, int t) {
+  LASSERT(a, a->count > 0,
+          "Function '%s' passed no arguments.", func);
+  LMAP_ASSERT_TYPE(func, a, t);
+  lval* m = lval_pop(a, 0);
+  if (LTYPE(m) != LVAL_PMAP) {
+    m = lval_mut(m);
+  }
+  for (int i = 0; i < a->count; i++) {
+    if (LTYPE(m) == LVAL_PMAP) {
+      m = lhamt_remove(m, a->cell[i]);
+    } else {
+      lmap_remove(m, a->cell[i]);
+    }
+  }
+  lval_del(a);
+  return m;
+}
+
+lval* builtin_map_del(lenv* e, lval* a) {
+  return lmap_delete(a, "map-del", LVAL_MAP);
+}
+
+lval* builtin_set_del(lenv* e, lval* a) {
+  return lmap_delete(a, "set-del", LVAL_SET);
+}
+
+/* whether a map or set of type t has a key */
+static lval* lmap_has(lval* a, char* func, int t) {
+  LASSERT_NUM(func, a, 2);
+  LMAP_ASSERT_TYPE(func, a, t);
+  lval* m = a->cell[0];
+  int has = LTYPE(m) == LVAL_PMAP ? lhamt_get(m, a->cell[1]) != NULL
+    : lmap_find(m, a->cell[1], lval_hash(a->cell[1])) >= 0;
+  lval_del(a);
+  return lval_bool(has);
+}
+
+lval* builtin_map_has(lenv* e, lval* a) {
+  return lmap_has(a, "map-has", LVAL_MAP);
+}
+
+lval* builtin_set_has(lenv* e, lval* a) {
+  return lmap_has(a, "set-has", LVAL_SET);
+}
+
+/* the number of keys of a map or set of type t */
+static lval* lmap_len(lval* a, char* func, int t) {
+  LASSERT_NUM(func, a, 1);
+  LMAP_ASSERT_TYPE(func, a, t);
+  long n = LTYPE(a->cell[0]) == LVAL_PMAP ? a->cell[0]->plen : a->cell[0]->mlen;
+  lval_del(a);
+  return lval_int(n);
+}
+
+lval* builtin_map_len(lenv* e, lval* a) {
+  return lmap_len(a, "map-len", LVAL_MAP);
+}
+
+lval* builtin_set_len(lenv* e, lval* a) {
+  return lmap_len(a, "set-len", LVAL_SET);
+}
+
+/* the keys, or values if vals, of a map or set of type t */
+static lval* lmap_list(lval* a, char* func, int t, int vals) {
+  LASSERT_NUM(func, a, 1);
+  LMAP_ASSERT_TYPE(func, a, t);
+  lval* m = a->cell[0];
+  if (LTYPE(m) == LVAL_PMAP) {
+    lval* x = lhamt_list(m, vals);
+    lval_del(a);
+    return x;
+  }
+  lval* x = lval_qexpr();
+  lval_reserve(x, m->mlen);
+  for (int i = 0; i < m->mused; i++) {
+    lentry* e = &m->mentries[i];
+    if (e->key) {
+      x->cell[x->count++] = lval_ref(vals ? e->val : e->key);
+    }
+  }
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_map_keys(lenv* e, lval* a) {
+  return lmap_list(a, "map-keys", LVAL_MAP, 0);
+}
+
+lval* builtin_map_vals(lenv* e, lval* a) {
+  return lmap_list(a, "map-vals", LVAL_MAP, 1);
+}
+
+lval* builtin_set_list(lenv* e, lval* a) {
+  return lmap_list(a, "set-list", LVAL_SET, 0);
+}
@@ -0,0 +1,539 @@
+#include "lispy.h"
+
+/*
+ * Optimizer for lambda bodies.
+ *
+ * When a lambda is called, lval_optimized rewrites a copy of its body
+ * and keeps it on the body list next to the bytecode. The evaluators
+ * run the copy; the body itself is still what the function prints as
+ * and is compared by. Macro calls in the body are expanded first, see
+ * macro.c, which is done even when lval_opt is off.
+ *
+ * Names are looked up as the code runs and scope is dynamic, so a
+ * rewrite may only rely on a name meaning what it means now if no frame
+ * has ever bound it (lsym.local) and its global binding stays the same.
+ * lenv_set bumps lval_epoch when either stops being true, and a body
+ * optimized in an earlier epoch is optimized again on its next call.
+ * Within a call, anything a function the optimizer does not know may
+ * do the same, so only code evaluated before the first application of
+ * one is rewritten.
+ *
+ * Four rewrites are made:
+ *  - applications of pure builtins to constants are replaced by their
+ *    value, unless it is an error, and an 'if' whose condition becomes
+ *    constant by the branch it takes;
+ *  - calls of small lambdas whose bodies only apply pure builtins are
+ *    replaced by the body with the arguments put in for the formals.
+ *    Only constants and the caller's formals are put in, as evaluating
+ *    them cannot fail, so errors come out as they did;
+ *  - an application of pure builtins repeated in a body or branch that
+ *    applies nothing else is evaluated once: the first occurrence binds
+ *    its value in the frame under a name the reader cannot produce and
+ *    the others look that name up;
+ *  - a 'case' whose keys are all constants becomes a lookup in a hash
+ *    table of its clauses, built here once rather than comparing x with
+ *    each key in turn on every call.
+ *
+ * Helpers such as fst, flip and comp stay calls. They evaluate or call
+ * their arguments, and whatever runs then can see their formals.
+ */
+
+int lval_opt = 1;
+int lval_epoch = 1;
+
+/* most cells in the body of a lambda that is inlined */
+#define LOPT_INLINE_MAX 32
+/* most applications looked at for sharing in one body or branch */
+#define LOPT_SHARE_MAX 64
+
+typedef struct {
+  /* environment every lookup ends in */
+  lenv* global;
+  /* formals of the lambda whose body is optimized */
+  lval* formals;
+  /* no application of an unknown function has been passed yet */
+  int known;
+  /* whether anything was rewritten */
+  int changed;
+  /* names given to shared values so far */
+  int shared;
+} lopt;
+
+/* builtins whose result only depends on their arguments */
+static lbuiltin lopt_pure[] = {
+  builtin_add, builtin_sub, builtin_mul, builtin_div, builtin_mod,
+  builtin_eq, builtin_ne, builtin_gt, builtin_lt, builtin_gte, builtin_lte,
+  builtin_and, builtin_or, builtin_head, builtin_tail, builtin_list,
+  builtin_take, builtin_drop, builtin_join, NULL
+};
+
+static int lopt_is_pure(lval* f) {
+  for (int i = 0; f && f->builtin && lopt_pure[i]; i++) {
+    if (f->builtin == lopt_pure[i]) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* values that evaluate to themselves */
+static int lopt_const(lval* v) {
+  switch (LTYPE(v)) {
+  case LVAL_INT:
+  case LVAL_FLOAT:
+  case LVAL_BIGINT:
+  case LVAL_BOOL:
+  case LVAL_STR:
+  case LVAL_QEXPR:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/* whether s is one of formals */
+static int lopt_formal(lval* formals, lval* s) {
+  if (LTYPE(s) != LVAL_SYM || s->sym == lsym_amp) {
+    return 0;
+  }
+  for (int i = 0; i < formals->count; i++) {
+    if (formals->cell[i]->sym == s->sym) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* whether formals are mentioned anywhere in v */
+static int lopt_mentions(lval* v, lval* formals) {
+  if (ltype_expr(LTYPE(v))) {
+    for (int i = 0; i < v->count; i++) {
+      if (lopt_mentions(v->cell[i], formals)) {
+        return 1;
+      }
+    }
+    return 0;
+  }
+  return lopt_formal(formals, v);
+}
+
+/* the function symbol s means wherever it is looked up, or NULL */
+static lval* lopt_global(lopt* o, lval* s) {
+  if (LTYPE(s) != LVAL_SYM || LSYM(s->sym)->local) {
+    return NULL;
+  }
+  lval* v = lenv_get(o->global, s);
+  int fun = LTYPE(v) == LVAL_FUN;
+  /* still held by the environment */
+  lval_del(v);
+  return fun ? v : NULL;
+}
+
+/* the function the head h of an application always is, or NULL */
+static lval* lopt_head(lopt* o, lval* h) {
+  return LTYPE(h) == LVAL_FUN ? h : lopt_global(o, h);
+}
+
+/*
+ * number of leading cells of x that are evaluated, taking names of
+ * special forms to be the forms, which leaves more cells alone
+ */
+static int lopt_count(lval* x) {
+  int count = x->count;
+  for (int i = 0; i < count; i++) {
+    count = lval_eval_count(NULL, x->cell[i], i, count);
+  }
+  return count;
+}
+
+/* whether x is (if cond {yes} {no}) with 'if' the builtin */
+static int lopt_is_if(lopt* o, lval* x) {
+  if (x->count != 4 || LTYPE(x->cell[0]) != LVAL_SYM
+      || x->cell[0]->form != LFORM_IF || lopt_count(x) != 2) {
+    return 0;
+  }
+  lval* f = lopt_global(o, x->cell[0]);
+  return f && f->builtin == builtin_if
+    && LTYPE(x->cell[2]) == LVAL_QEXPR && LTYPE(x->cell[3]) == LVAL_QEXPR;
+}
+
+static int lopt_transparent(lopt* o, lval* v, lval* formals, int* size);
+
+/* whether the list x, evaluated, only applies pure builtins */
+static int lopt_transparent_list(lopt* o, lval* x, lval* formals, int* size) {
+  if (x->count == 1) {
+    /* a lone value is evaluated again, which depends on the frame */
+    (*size)++;
+    return lopt_const(x->cell[0]) && !lopt_mentions(x->cell[0], formals);
+  }
+  if (lopt_is_if(o, x)) {
+    *size += 2;
+    return lopt_transparent(o, x->cell[1], formals, size)
+      && lopt_transparent_list(o, x->cell[2], formals, size)
+      && lopt_transparent_list(o, x->cell[3], formals, size);
+  }
+  if (x->count == 0 || lopt_count(x) != x->count
+      || lopt_formal(formals, x->cell[0])
+      || !lopt_is_pure(lopt_head(o, x->cell[0]))) {
+    return 0;
+  }
+  (*size)++;
+  for (int i = 1; i < x->count; i++) {
+    if (!lopt_transparent(o, x->cell[i], formals, size)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* whether evaluating cell v only applies pure builtins */
+static int lopt_transparent(lopt* o, lval* v, lval* formals, int* size) {
+  (*size)++;
+  switch (LTYPE(v)) {
+  case LVAL_SEXPR:
+    return lopt_transparent_list(o, v, formals, size);
+  case LVAL_QEXPR:
+    /* data, which must stay as written */
+    return !lopt_mentions(v, formals);
+  default:
+    return 1;
+  }
+}
+
+/* whether application x of lambda f can be replaced by its body */
+static int lopt_inlinable(lopt* o, lval* f, lval* x) {
+  if (f->builtin || f->args || f->formals->count != x->count - 1) {
+    return 0;
+  }
+  lval* formals = f->formals;
+  for (int i = 0; i < formals->count; i++) {
+    if (formals->cell[i]->sym == lsym_amp) {
+      return 0;
+    }
+    for (int j = 0; j < i; j++) {
+      if (formals->cell[j]->sym == formals->cell[i]->sym) {
+        return 0;
+      }
+    }
+    lval* a = x->cell[i + 1];
+    if (!lopt_const(a) && !lopt_formal(o->formals, a)) {
+      return 0;
+    }
+  }
+  int size = 0;
+  return lopt_transparent_list(o, f->body, formals, &size)
+    && size <= LOPT_INLINE_MAX;
+}
+
+/* a copy of v with the formals replaced by the arguments of x */
+static lval* lopt_subst(lval* v, lval* formals, lval* x) {
+  if (LTYPE(v) == LVAL_SYM) {
+    for (int i = 0; i < formals->count; i++) {
+      if (formals->cell[i]->sym == v->sym) {
+        return lval_ref(x->cell[i + 1]);
+      }
+    }
+  }
+  if (!ltype_expr(LTYPE(v))) {
+    return lval_ref(v);
+  }
+  lval* y = LTYPE(v) == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+  for (int i = 0; i < v->count; i++) {
+    y = lval_add(y, lopt_subst(v->cell[i], formals, x));
+  }
+  return y;
+}
+
+/* the value of pure builtin f applied to the constants in x, or NULL */
+static lval* lopt_fold(lopt* o, lval* f, lval* x) {
+  /* division is left to run time, where LONG_MIN / -1 traps */
+  if (x->count < 2 || f->builtin == builtin_div || f->builtin == builtin_mod) {
+    return NULL;
+  }
+  lval* a = lval_sexpr();
+  for (int i = 1; i < x->count; i++) {
+    if (!lopt_const(x->cell[i])) {
+      lval_del(a);
+      return NULL;
+    }
+    a = lval_add(a, lval_ref(x->cell[i]));
+  }
+  lval* r = f->builtin(o->global, a);
+  if (!lopt_const(r)) {
+    lval_del(r);
+    return NULL;
+  }
+  return r;
+}
+
+static lval* lopt_list(lopt* o, lval* x);
+static lval* lopt_apply(lopt* o, lval* x);
+
+/* whether x is (case x {key expr}...) with 'case' the builtin and constant keys */
+static int lopt_is_case(lopt* o, lval* x) {
+  lval* f = lopt_global(o, x->cell[0]);
+  if (x->count < 3 || !f || f->builtin != builtin_case) {
+    return 0;
+  }
+  for (int i = 2; i < x->count; i++) {
+    lval* c = x->cell[i];
+    if (LTYPE(c) != LVAL_QEXPR || c->count < 2 || !lopt_const(c->cell[0])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* the case x as an application of builtin_case_table */
+static lval* lopt_case(lopt* o, lval* x) {
+  if (LTYPE(x->cell[1]) == LVAL_SEXPR) {
+    x->cell[1] = lopt_apply(o, x->cell[1]);
+  }
+  int n = 1;
+  while (n < 2 * (x->count - 2)) {
+    n *= 2;
+  }
+  lval* buckets = lval_qexpr();
+  for (int i = 0; i < n; i++) {
+    buckets = lval_add(buckets, lval_qexpr());
+  }
+  for (int i = 2; i < x->count; i++) {
+    lval** b = &buckets->cell[lval_hash(x->cell[i]->cell[0]) & (n - 1)];
+    *b = lval_add(*b, lval_ref(x->cell[i]));
+  }
+  lval* y = lval_add(lval_sexpr(), lval_fun(builtin_case_table));
+  y = lval_add(lval_add(y, lval_ref(x->cell[1])), buckets);
+  lval_del(x);
+  o->changed = 1;
+  /* the clause chosen may run anything */
+  o->known = 0;
+  return y;
+}
+
+/* optimizes x, evaluated as an S-Expression, returning what replaces it */
+static lval* lopt_apply(lopt* o, lval* x) {
+  if (!o->known || x->count == 0) {
+    return x;
+  }
+  /* every list rewritten is a copy, the body may be running elsewhere */
+  x = lval_mut(x);
+
+  if (lopt_is_if(o, x)) {
+    if (LTYPE(x->cell[1]) == LVAL_SEXPR) {
+      x->cell[1] = lopt_apply(o, x->cell[1]);
+    }
+    if (LTYPE(x->cell[1]) == LVAL_BOOL) {
+      /* the condition is known, so is the branch 'if' evaluates */
+      lval* y = lval_mut(lval_ref(x->cell[LNUM(x->cell[1]) ? 2 : 3]));
+      y->type = LVAL_SEXPR;
+      lval_del(x);
+      o->changed = 1;
+      return lopt_apply(o, y);
+    }
+    int known = o->known;
+    x->cell[2] = lopt_list(o, x->cell[2]);
+    int yes = o->known;
+    o->known = known;
+    x->cell[3] = lopt_list(o, x->cell[3]);
+    o->known = o->known && yes;
+    return x;
+  }
+  if (lopt_is_case(o, x)) {
+    return lopt_case(o, x);
+  }
+
+  int count = lopt_count(x);
+  for (int i = 0; i < count; i++) {
+    if (LTYPE(x->cell[i]) == LVAL_SEXPR) {
+      x->cell[i] = lopt_apply(o, x->cell[i]);
+    }
+  }
+  if (!o->known) {
+    return x;
+  }
+  if (x->count == 1) {
+    /* a lone value is evaluated again, which may run anything */
+    o->known = lopt_const(x->cell[0]);
+    return x;
+  }
+
+  lval* f = count == x->count ? lopt_head(o, x->cell[0]) : NULL;
+  if (lopt_is_pure(f)) {
+    lval* r = lopt_fold(o, f, x);
+    if (r) {
+      lval_del(x);
+      o->changed = 1;
+      return r;
+    }
+    return x;
+  }
+  if (f && lopt_inlinable(o, f, x)) {
+    lval* y = lopt_subst(f->body, f->formals, x);
+    y->type = LVAL_SEXPR;
+    lval_del(x);
+    o->changed = 1;
+    return lopt_apply(o, y);
+  }
+  o->known = 0;
+  return x;
+}
+
+/* (bind {name} value): binds name to value in e and returns the value */
+static lval* lopt_bind(lenv* e, lval* a) {
+  lenv_put(e, a->cell[0]->cell[0], a->cell[1]);
+  return lval_take(a, 1);
+}
+
+/* number of applications in x if it only applies pure builtins, or 0 */
+static int lopt_pure_apps(lopt* o, lval* x) {
+  if (x->count < 2 || lopt_count(x) != x->count
+      || !lopt_is_pure(lopt_head(o, x->cell[0]))) {
+    return 0;
+  }
+  int n = 1;
+  for (int i = 1; i < x->count; i++) {
+    if (LTYPE(x->cell[i]) == LVAL_SEXPR) {
+      int k = lopt_pure_apps(o, x->cell[i]);
+      if (k == 0) {
+        return 0;
+      }
+      n += k;
+    }
+  }
+  return n;
+}
+
+/* collects the places in x of applications always evaluated, in order */
+static void lopt_places(lval* x, lval*** places, int* n) {
+  int count = lopt_count(x);
+  for (int i = 0; i < count && *n < LOPT_SHARE_MAX; i++) {
+    if (LTYPE(x->cell[i]) == LVAL_SEXPR) {
+      places[(*n)++] = &x->cell[i];
+      lopt_places(x->cell[i], places, n);
+    }
+  }
+}
+
+/*
+ * Evaluates repeated applications of pure builtins in x, a list whose
+ * applications are all known, only once.
+ */
+static lval* lopt_share(lopt* o, lval* x) {
+  while (1) {
+    lval** places[LOPT_SHARE_MAX];
+    int n = 0;
+    lopt_places(x, places, &n);
+
+    /* the largest application that appears again later */
+    int best = -1;
+    int best_apps = 1;
+    for (int i = 0; i < n; i++) {
+      int apps = lopt_pure_apps(o, *places[i]);
+      if (apps <= best_apps) {
+        continue;
+      }
+      for (int j = i + 1; j < n; j++) {
+        if (lval_eq(*places[i], *places[j])) {
+          best = i;
+          best_apps = apps;
+          break;
+        }
+      }
+    }
+    if (best < 0) {
+      return x;
+    }
+
+    /* find every occurrence before freeing any, they may hold places */
+    lval* v = *places[best];
+    int same[LOPT_SHARE_MAX];
+    for (int j = best + 1; j < n; j++) {
+      same[j] = lval_eq(v, *places[j]);
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "#%i", ++o->shared);
+    for (int j = best + 1; j < n; j++) {
+      if (same[j]) {
+        lval_del(*places[j]);
+        *places[j] = lval_sym(name);
+      }
+    }
+    lval* bind = lval_add(lval_sexpr(), lval_fun(lopt_bind));
+    bind = lval_add(bind, lval_add(lval_qexpr(), lval_sym(name)));
+    *places[best] = lval_add(bind, v);
+    o->changed = 1;
+  }
+}
+
+/* optimizes x, a body or branch evaluated as an S-Expression */
+static lval* lopt_list(lopt* o, lval* x) {
+  int type = LTYPE(x);
+  int known = o->known;
+  lval* r = lopt_apply(o, x);
+  if (!ltype_expr(LTYPE(r))) {
+    /* folded to a value, which evaluates to itself */
+    r = lval_add(type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr(), r);
+  }
+  if (LTYPE(r) != type) {
+    r = lval_mut(r);
+    r->type = type;
+  }
+  if (known && o->known && r->count > 1) {
+    r = lopt_share(o, r);
+  }
+  return r;
+}
+
+/*
+ * The body of f with macros expanded and, if lval_opt is set, optimized
+ * for a call in e, or NULL if nothing changed.
+ */
+static lval* lopt_body(lenv* e, lval* f) {
+  lval* x = lval_expand_body(e, lval_ref(f->body), f->formals);
+  int expanded = x != f->body;
+  if (!lval_opt) {
+    if (!expanded) {
+      lval_del(x);
+      return NULL;
+    }
+    return x;
+  }
+
+  lopt o;
+  o.global = e->root;
+  o.formals = f->formals;
+  o.known = 1;
+  o.changed = 0;
+  o.shared = 0;
+
+  gc_push(x);
+  x = lopt_list(&o, x);
+  gc_pop(1);
+  if (!o.changed && !expanded) {
+    lval_del(x);
+    return NULL;
+  }
+  return x;
+}
+
+/*
+ * The body to evaluate for a call of lambda f in e: the expanded and
+ * optimized one, made again if anything it relied on may have changed,
+ * or f->body.
+ */
+lval* lval_optimized(lenv* e, lval* f) {
+  lval* b = f->body;
+  lbody* c = lval_cache(b);
+  if (c->epoch != lval_epoch) {
+    if (c->opt) {
+      lval_del(c->opt);
+    }
+    /* expanding runs macros, which may call f before this returns */
+    c->opt = NULL;
+    c->epoch = lval_epoch;
+    lval* opt = lopt_body(e, f);
+    /* c is not held across it, changing b there would drop it */
+    lval_cache(b)->opt = opt;
+  }
+  return b->cache->opt ? b->cache->opt : b;
+}
@@ -0,0 +1,160 @@
+#include "lispy.h"
+
+/*
+ * Size-segregated pool allocator for the small, short lived blocks the
+ * interpreter churns through: lvals, lenvs and the cell and symbol
+ * arrays they own.
+ *
+ * Requests up to LPOOL_MAX bytes are rounded up to a multiple of
+ * LPOOL_ALIGN and served from a per-class free list. Empty free lists
+ * are refilled by carving a fresh slab. Free lists and slabs are thread
+ * local, so no locking is needed; a block freed on another thread
+ * simply joins that thread's cache. Larger requests go to malloc.
+ *
+ * Building with -DLISPY_NO_POOL sends everything to malloc, which is
+ * useful under memory checkers.
+ */
+
+#ifndef LISPY_NO_POOL
+
+#define LPOOL_ALIGN   8
+#define LPOOL_MAX     256
+#define LPOOL_CLASSES (LPOOL_MAX / LPOOL_ALIGN)
+#define LPOOL_SLAB    (64 * 1024)
+/* slabs start on a cache line, so a block of a size dividing it, such
+   as the cells of a short list, never straddles two */
+#define LPOOL_LINE    64
+
+typedef struct lpool_block {
+  struct lpool_block* next;
+} lpool_block;
+
+typedef struct {
+  /* recycled blocks */
+  lpool_block* free;
+  /* unused part of the current slab */
+  char* slab;
+  char* slab_end;
+  /* allocations served from the free list */
+  long hits;
+  /* allocations that had to carve a new block */
+  long misses;
+  long frees;
+} lpool_class;
+
+static __thread lpool_class lpools[LPOOL_CLASSES];
+/* requests too large for any class */
+static __thread long lpool_large = 0;
+
+static int lpool_class_of(size_t size) {
+  return (int) ((size + LPOOL_ALIGN - 1) / LPOOL_ALIGN) - 1;
+}
+
+#endif
+
+void* lpool_alloc(size_t size) {
+#ifdef LISPY_NO_POOL
+  return malloc(size);
+#else
+  if (size == 0) {
+    return NULL;
+  }
+  if (size > LPOOL_MAX) {
+    lpool_large++;
+    return malloc(size);
+  }
+  int c = lpool_class_of(size);
+  lpool_class* p = &lpools[c];
+  if (p->free) {
+    lpool_block* b = p->free;
+    p->free = b->next;
+    p->hits++;
+    return b;
+  }
+  size_t block = (size_t) (c + 1) * LPOOL_ALIGN;
+  if (p->slab == NULL || p->slab + block > p->slab_end) {
+    /* the tail of the old slab is too small for a block, abandon it */
+    uintptr_t s = (uintptr_t) malloc(LPOOL_SLAB + LPOOL_LINE - 1);
+    p->slab = (char*) ((s + LPOOL_LINE - 1) & ~(uintptr_t) (LPOOL_LINE - 1));
+    p->slab_end = p->slab + LPOOL_SLAB;
+  }
+  void* b = p->slab;
+  p->slab += block;
+  p->misses++;
+  return b;
+#endif
+}
+
+/* size must be the size the block was allocated or last resized with */
+void lpool_free(void* ptr, size_t size) {
+#ifdef LISPY_NO_POOL
+  free(ptr);
+#else
+  if (ptr == NULL) {
+    return;
+  }
+  if (size > LPOOL_MAX) {
+    free(ptr);
+    return;
+  }
+  lpool_class* p = &lpools[lpool_class_of(size)];
+  lpool_block* b = ptr;
+  b->next = p->free;
+  p->free = b;
+  p->frees++;
+#endif
+}
+
+/* realloc for pooled blocks, growth within a size class is free */
+void* lpool_resize(void* ptr, size_t old, size_t size) {
+#ifdef LISPY_NO_POOL
+  if (size == 0) {
+    free(ptr);
+    return NULL;
+  }
+  return realloc(ptr, size);
+#else
+  if (ptr == NULL) {
+    return lpool_alloc(size);
+  }
+  if (size == 0) {
+    lpool_free(ptr, old);
+    return NULL;
+  }
+  if (old > LPOOL_MAX && size > LPOOL_MAX) {
+    return realloc(ptr, size);
+  }
+  if (old <= LPOOL_MAX && size <= LPOOL_MAX
+      && lpool_class_of(old) == lpool_class_of(size)) {
+    return ptr;
+  }
+  void* n = lpool_alloc(size);
+  memcpy(n, ptr, old < size ? old : size);
+  lpool_free(ptr, old);
+  return n;
+#endif
+}
+
+/*
+ * Prints allocation counts and free list hit rates for each size class
+ * in use. Arguments are ignored, call as (pool-stats {}).
+ */
+lval* builtin_pool_stats(lenv* e, lval* a) {
+  lval_del(a);
+#ifdef LISPY_NO_POOL
+  printf("pools disabled\n");
+#else
+  for (int c = 0; c < LPOOL_CLASSES; c++) {
+    lpool_class* p = &lpools[c];
+    long allocs = p->hits + p->misses;
+    if (allocs == 0) {
+      continue;
+    }
+    printf("%4i bytes: %10li allocs, %6.2f%% hits, %8li in use\n",
+           (c + 1) * LPOOL_ALIGN, allocs, 100.0 * p->hits / allocs,
+           allocs - p->frees);
+  }
+  printf("large: %li allocs\n", lpool_large);
+#endif
+  return lval_ok();
+}
@@ -5,41 +5,62 @@
 #include <editline/readline.h>
 #include "lispy.h"
 
+/*
+ * Options start with "--", every other argument is a file to load:
+ *   --engine=tree|cek|vm  evaluator to use, see lval_engine
+ *   --max-depth=N         continuation frames the cek and vm engines may use
+ *   --jit                 vm engine, compiling hot functions to native code
+ *   --jit-threshold=N     calls before a function is compiled
+ *   --jit-dump            print the native code generated
+ *   --no-opt              run lambda bodies as written, see opt.c
+ *   --no-simd             use plain C vector kernels, see vec.c
+ * Returns the number of files, or -1 on a bad option.
+ */
+int parse_options(int argc, char** argv) {
+  int files = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) != 0) {
+      files++;
+    } else if (strcmp(argv[i], "--engine=tree") == 0) {
+      lval_engine = LVAL_ENGINE_TREE;
+    } else if (strcmp(argv[i], "--engine=cek") == 0) {
+      lval_engine = LVAL_ENGINE_CEK;
+    } else if (strcmp(argv[i], "--engine=vm") == 0) {
+      lval_engine = LVAL_ENGINE_VM;
+    } else if (strcmp(argv[i], "--jit") == 0) {
+      lval_engine = LVAL_ENGINE_VM;
+      lval_jit = 1;
+    } else if (strncmp(argv[i], "--jit-threshold=", 16) == 0
+               && atoi(argv[i] + 16) > 0) {
+      lval_jit_threshold = atoi(argv[i] + 16);
+    } else if (strcmp(argv[i], "--jit-dump") == 0) {
+      lval_jit_dump = 1;
+    } else if (strcmp(argv[i], "--no-opt") == 0) {
+      lval_opt = 0;
+    } else if (strcmp(argv[i], "--no-simd") == 0) {
+      lval_simd = 0;
+    } else if (strncmp(argv[i], "--max-depth=", 12) == 0
+               && atoi(argv[i] + 12) > 0) {
+      lval_cek_max_depth = atoi(argv[i] + 12);
+    } else {
+      fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+      return -1;
+    }
+  }
+  return files;
+}
+
 int main(int argc, char** argv) {
-  /* Create Some Parsers */
-  Integer  = mpc_new("integer");
-  Float    = mpc_new("float");
-  Boolean  = mpc_new("bool");
-  String   = mpc_new("string");
-  Comment  = mpc_new("comment");
-  Symbol   = mpc_new("symbol");
-  Sexpr    = mpc_new("sexpr");
-  Qexpr    = mpc_new("qexpr");
-  List     = mpc_new("list");
-  Expr     = mpc_new("expr");
-  Lispy    = mpc_new("lispy");
+  int files = parse_options(argc, argv);
+  if (files < 0) {
+    return 1;
+  }
 
-  /* Define them with the following Language */
-  mpca_lang(MPCA_LANG_DEFAULT, 
-  "                                                      \
-    float   : /-?[0-9]*\\.[0-9]+/ ;                      \
-    integer : /-?[0-9]+/ ;                               \
-    bool    : /(true|false)/ ;                           \
-    string  : /\"(\\\\.|[^\"])*\"/ ;                     \
-    comment : /;[^\\r\\n]*/ ;                            \
-    symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%|]+/ ;       \
-    sexpr   : '(' <expr>* ')' ;                          \
-    qexpr   : '{' <expr>* '}' ;                          \
-    list    : '[' <expr>* ']' ;                          \
-    expr    : <float> | <integer> | <bool> | <string>    \
-            | <comment> | <symbol> | <sexpr> | <qexpr>   \
-            | <list> ;                                   \
-    lispy   : /^/ <expr>* /$/ ;                          \
-  ",
-            Float, Integer, Boolean, String, Comment,
-            Symbol, Sexpr, Qexpr, List, Expr, Lispy);
+  lval_read_init();
 
   lenv* e = lenv_new();
+  /* the global environment is the root of everything the collector keeps */
+  gc_push_env(e);
   lenv_add_builtins(e);
   char* home = getenv("LISPY_HOME");
   char stdlib_loc[1024];
@@ -53,16 +74,19 @@ int main(int argc, char** argv) {
   }
   lval* args = lval_add(lval_sexpr(), lval_str(stdlib_loc));
   lval* x = builtin_load(e, args);
-  if (x->type == LVAL_ERR) {
+  if (LTYPE(x) == LVAL_ERR) {
     lval_println(x);
   }
   lval_del(x);
-  if (argc >= 2) {
+  if (files > 0) {
     for (int i = 1; i < argc; i++) {
+      if (strncmp(argv[i], "--", 2) == 0) {
+        continue;
+      }
       lval* args = lval_add(lval_sexpr(), lval_str(argv[i]));
       lval* x = builtin_load(e, args);
 
-      if (x->type == LVAL_ERR) {
+      if (LTYPE(x) == LVAL_ERR) {
         lval_println(x);
       }
       /* args is already deleted by builtin_load */
@@ -81,7 +105,7 @@ int main(int argc, char** argv) {
           /* On Success Print the AST
              mpc_ast_print(r.output);
           */
-          lval* result = lval_eval(e, lval_read(r.output));
+          lval* result = lval_eval(e, lval_expand(e, lval_read(r.output)));
           lval_println(result);
           lval_del(result);
           mpc_ast_delete(r.output);
@@ -95,9 +119,6 @@ int main(int argc, char** argv) {
     }
   }
   lenv_del(e);
-  /* Undefine and Delete our Parsers */
-  mpc_cleanup(11,
-              Integer, Float, Boolean, String, Comment,
-              Symbol, Sexpr, Qexpr, List, Expr, Lispy);
+  lval_read_cleanup();
   return 0;
 }
@@ -15,17 +15,6 @@
 (def {curry} unpack)
 (def {uncurry} pack)
 
-; Perform Several things in Sequence
-(fun {do & l} {
-  if (== l nil)
-    {nil}
-    {last l}
-})
-
-; Open new scope
-(fun {let b} {
-  ((\ {_} b) ())
-})
 (fun {flip f a b} {f b a})
 (fun {ghost & xs} {eval xs})
 (fun {comp f g x} {f (g x)})
@@ -34,12 +23,13 @@
 (fun {fst l} { eval (head l) })
 (fun {snd l} { eval (head (tail l)) })
 (fun {trd l} { eval (head (tail (tail l))) })
-; List Length
-(fun {len l} {
+; List Length, counting onto n in a tail call
+(fun {len-onto n l} {
   if (== l nil)
-    {0}
-    {+ 1 (len (tail l))}
+    {n}
+    {len-onto (+ n 1) (tail l)}
 })
+(fun {len l} {len-onto 0 l})
 ; Nth item in List
 (fun {nth n l} {
   if (== n 0)
@@ -48,18 +38,6 @@
 })
 ; Last item in List
 (fun {last l} {nth (- (len l) 1) l})
-; Take N items
-(fun {take n l} {
-  if (== n 0)
-    {nil}
-    {join (head l) (take (- n 1) (tail l))}
-})
-; Drop N items
-(fun {drop n l} {
-  if (== n 0)
-    {l}
-    {drop (- n 1) (tail l)}
-})
 ; Split at N
 (fun {split n l} {list (take n l) (drop n l)})
 
@@ -93,12 +71,6 @@
 (fun {sum l} {foldl + 0 l})
 (fun {product l} {foldl * 1 l})
 
-(fun {select & cs} {
-  if (== cs nil)
-    {error "No Selection Found"}
-    {if (fst (fst cs)) {snd (fst cs)} {unpack select (tail cs)}}
-})
-
 (def {otherwise} true)
 
 ; Print Day of Month suffix
@@ -110,13 +82,6 @@
     {otherwise "th"}
 })
 
-(fun {case x & cs} {
-  if (== cs nil)
-    {error "No Case Found"}
-    {if (== x (fst (fst cs))) {snd (fst cs)} {
-      unpack case (join (list x) (tail cs))}}
-})
-
 (fun {day-name x} {
   case x
     {0 "Monday"}
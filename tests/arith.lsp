@@ -0,0 +1,22 @@
+; integers, floats and the promotion between them
+(print (+ 1 2 3) (- 10 4) (* 6 7) (/ 20 3) (% 20 3))
+(print (- 5) (+ 1.5 2) (* 2 0.25) (/ 7.0 2))
+(print (> 3 2) (< 3 2) (>= 2 2) (<= 3 2) (== 1 1) (!= 1 2))
+(print (== 1 1.0) (< 1 1.5) (== {1 2} {1 2}) (== "a" "b"))
+
+; integers promote to bignums on overflow, and back when they fit
+(print (* 4611686018427387904 2))
+(print (+ 9223372036854775807 1))
+(print (- -9223372036854775807 10))
+(print (* 99999999999 99999999999 99999999))
+(print (- (* 4611686018427387904 4) (* 4611686018427387904 4)))
+(print (/ (* 100000000000 100000000000) 100000000000))
+(print (% (* 100000000000 100000000000) 7))
+(fun {fact n} {if (== n 0) {1} {* n (fact (- n 1))}})
+(print (fact 25))
+
+; errors
+(print (/ 1 0))
+(print (% 5 0))
+(print (+ 1 "a"))
+(print (% 5.5 2))
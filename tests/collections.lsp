@@ -0,0 +1,27 @@
+; numeric vectors
+(def {v} (vec 1 2 3))
+(print v (vec-len v) (vec-sum v) (vec-min v) (vec-max v))
+(print (+ v (vec 10 20 30)) (* v 2) (vec-dot v v))
+(print (vec 1.5 2) (vec-list v) (head v) (tail v))
+(print (> v (vec 0 5 1)))
+
+; hash maps and sets, in insertion order
+(def {m} (hash-map "a" 1 "b" 2))
+(def {m2} (map-put m "c" 3))
+(print m m2 (map-len m2) (map-get m2 "c") (map-has m "c"))
+(print (map-keys m2) (map-vals m2) (map-del m2 "a"))
+(def {s} (hash-set 1 2 3 2))
+(print s (set-len s) (set-has s 2) (set-add s 4) (set-del s 1) (set-list s))
+(print (map-get m "zz"))
+
+; persistent maps and vectors share structure with older versions
+(def {p} (pmap "x" 1 "y" 2))
+(def {p2} (map-put p "z" 3))
+(print (map-len p) (map-len p2) (map-get p2 "z") (map-has p "z"))
+(def {pv} (pvec 1 2 3))
+(def {pv2} (pvec-push pv 4))
+(print pv pv2 (pvec-get pv2 3) (pvec-set pv 0 9) (pvec-pop pv2) (pvec-len pv2))
+(fun {fill v n} {if (== n 0) {v} {fill (pvec-push v n) (- n 1)}})
+(def {big} (fill (pvec 0) 2000))
+(print (pvec-len big) (pvec-get big 0) (pvec-get big 1) (pvec-get big 2000))
+(print (pvec-get pv 10))
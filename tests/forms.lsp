@@ -0,0 +1,58 @@
+; if, do, let, select and case
+(print (if (> 2 1) {"yes"} {"no"}) (if false {1} {2}))
+(print (if true {+ 1 2} {error "not taken"}))
+(print (do 1 2 3) (do (+ 1 1)))
+(print (let {do (= {x} 5) (+ x 1)}))
+(print (let {do (= {x} 1) (let {do (= {x} 2) x})}))
+(fun {classify n} {
+  select
+    {(< n 0) "negative"}
+    {(== n 0) "zero"}
+    {otherwise "positive"}
+})
+(print (classify -5) (classify 0) (classify 5))
+(print (month-day-suffix 0) (month-day-suffix 2) (month-day-suffix 9))
+(print (day-name 0) (day-name 6))
+(print (case 9 {1 "one"}))
+(print (select {false 1}))
+; items after the expression of a clause are ignored
+(print (select {false 1 2} {true 3 4 5}) (case 2 {1 "one" "x"} {2 "two" "y"}))
+(fun {pick x} {case x {1 "one" "x"} {2 "two" "y"}})
+(print (pick 2))
+(print (select {true}))
+
+; logic
+(print (&& true true) (&& true false) (|| false true) (|| false false) (! true))
+
+; eval and quoting
+(print {+ 1 2} (eval {+ 1 2}) (eval (list + 1 2)))
+(print (eval (head {(+ 1 2) (+ 3 4)})))
+
+; names of special forms are only special while they mean the builtin
+(fun {call-read read x} {read x})
+(print (call-read (\ {y} {+ y 1}) 5))
+(fun {call-if if c a b} {if c a b})
+(print (call-if list (== 1 1) (+ 1 1) (+ 2 2)))
+(fun {inner-read read} {(\ {x} {read x}) 5})
+(print (inner-read (\ {y} {* y 10})))
+(def {old-if} if)
+(def {if} (\ {c a b} {list c a b}))
+(print (if (== 1 1) (+ 1 1) (+ 2 2)))
+(def {if} old-if)
+(print (if (== 1 1) {"restored"} {"no"}))
+(fun {call-do do} {do (+ 1 1) (+ 2 2)})
+(print (call-do (\ {a b} {* a b})))
+(fun {do-later do x} {list x (do x)})
+(print (do-later (\ {y} {- y}) (+ 1 2)))
+(print (do (+ 1 1) (+ 2 2)))
+; do reached other than as the form returns its last value as it is
+(def {code} (pvec {x (+ 1 2)}))
+(def {x} 5)
+(def {seq} do)
+(print (seq (pvec-get code 1) (pvec-get code 0)) (seq (pvec-get code 0) (pvec-get code 1)))
+(print (foldl do 0 {1 2 3}) (unpack do (pvec-list (pvec {1 2}))))
+(print (unpack do (list (+ 1 1) (pvec-list code))))
+
+; errors
+(print (error "boom"))
+(print (if 1 {2} {3}))
@@ -0,0 +1,53 @@
+; lambdas, definitions and partial application
+(def {add3} (\ {a b c} {+ a b c}))
+(print (add3 1 2 3))
+(def {add1} (add3 1))
+(def {add3to} (add1 2))
+(print (add1 10 20) (add3to 5) (add3to 6))
+(fun {twice f x} {f (f x)})
+(print (twice (\ {x} {* x 2}) 5))
+(print (unpack + {1 2 3}) (pack head 4 5 6))
+(print (flip - 1 10) (comp (\ {x} {* x 2}) (\ {x} {+ x 1}) 4))
+
+; variable arguments
+(fun {count-args & xs} {len xs})
+(print (count-args 1) (count-args 1 2 3))
+(fun {first-rest x & xs} {list x xs})
+(print (first-rest 1) (first-rest 1 2 3))
+
+; recursion and tail recursion
+(print (fib 15))
+(fun {loop n acc} {if (== n 0) {acc} {loop (- n 1) (+ acc n)}})
+(print (loop 100000 0))
+(fun {even n} {if (== n 0) {true} {odd (- n 1)}})
+(fun {odd n} {if (== n 0) {false} {even (- n 1)}})
+(print (even 10001) (odd 10001))
+
+; scope is dynamic, functions see the bindings of their callers
+(fun {get-y _} {y})
+(fun {with-y y} {get-y 0})
+(print (with-y 42))
+
+; = binds in the current frame, def in the global one
+(fun {local-set x} {do (= {tmp} x) tmp})
+(print (local-set 1))
+(fun {global-set x} {def {gv} x})
+(global-set 7)
+(print gv)
+
+; redefining a function changes its callers
+(fun {sq x} {* x x})
+(fun {sq-sum a b} {+ (sq a) (sq b)})
+(print (sq-sum 3 4))
+(fun {sq x} {+ x x})
+(print (sq-sum 3 4))
+
+; recursion deeper than the native code and the C stack allow
+(fun {depth n} {if (== n 0) {0} {+ 1 (depth (- n 1))}})
+(print (depth 25000))
+(print (depth 25000))
+
+; errors
+(print (add3 1 2 3 4))
+(print (undefined-function 1))
+(print (1 2 3))
@@ -0,0 +1,29 @@
+; Q-Expressions as lists
+(def {xs} {1 2 3 4 5})
+(print (head xs) (tail xs) (take 2 xs) (drop 3 xs))
+(print (join xs {6 7}) (list 1 (+ 1 1) {3}) (eval {+ 1 2}))
+(print (len xs) (reverse xs) (nth 2 xs) (last xs))
+(print (split 2 xs) (elem 3 xs) (elem 9 xs))
+(print (map (\ {x} {* x x}) xs))
+(print (filter (\ {x} {> x 2}) xs))
+(print (foldl + 0 xs) (sum xs) (product xs))
+(print (fst xs) (snd xs) (trd xs))
+(print (head {}) (tail {}))
+
+; len only counts, it does not evaluate the elements
+(print (len {a b c}) (len {(error "x") 2}) (len {+ - *}) (len {}))
+(print (last {1 (error "x") 3}))
+
+; slices share the list they come from
+(def {ys} (drop 1 xs))
+(def {zs} (take 2 ys))
+(print xs ys zs (join zs {9}) ys)
+
+; building a long list
+(fun {range a b} {if (>= a b) {nil} {join (list a) (range (+ a 1) b)}})
+(def {big} (range 0 300))
+(print (len big) (sum big) (nth 250 big))
+
+; strings
+(print (join "ab" "cd") (head "abc") (tail "abc"))
+(print (join {a} "b"))
@@ -0,0 +1,43 @@
+; macros are expanded once, before the code runs
+(defmacro (unless c body) `(if ,c {()} {,body}))
+(print (unless false (+ 1 2)))
+(print (unless true (+ 1 2)))
+(defmacro (swap-args f a b) `(,f ,b ,a))
+(print (swap-args - 1 10))
+(defmacro (call & xs) `(,@xs))
+(print (call + 1 (+ 1 1)))
+
+; macros expanding to macro calls
+(defmacro (when c body) `(unless (! ,c) ,body))
+(print (when true "ran") (when false "ran"))
+
+; expanded inside function bodies
+(fun {abs x} {unless (>= x 0) (- x)})
+(print (abs -4))
+(defmacro (sq x) `(* ,x ,x))
+(fun {sq-plus x} {+ (sq x) 1})
+(print (sq-plus 5))
+
+; expanded in let bodies and in select and case clauses
+(print (let {sq 7}))
+(fun {sq-let x} {let {sq x}})
+(print (sq-let 3))
+(defmacro (negative x) `(< ,x 0))
+(fun {sign x} {select {(negative x) (- (sq 1))} {otherwise (sq 1)}})
+(print (sign -2) (sign 2))
+(print (case 2 {1 (sq 10)} {(sq 1) "one"} {2 (sq 8)}))
+; constant keys, a case_table once optimized
+(fun {sq-case x} {case x {1 (sq 10)} {2 (sq 20)} {"k" (unless false "key")}})
+(print (sq-case 1) (sq-case 2) (sq-case "k"))
+
+; quasiquote templates outside macros
+(def {n} 3)
+(print `{a ,n ,(+ n 1) ,@{5 6}})
+(print (quasiquote {b (unquote n)}))
+
+; a formal named like a macro shadows it
+(fun {shadow sq} {sq 4})
+(print (shadow (\ {x} {+ x 100})))
+
+; errors
+(print (unquote 1))
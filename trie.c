@@ -0,0 +1,674 @@
+#include "lispy.h"
+
+/*
+ * Persistent maps and vectors.
+ *
+ * An LVAL_PMAP or LVAL_PVEC is a small header over a trie of LVAL_NODE
+ * values. Nodes are counted and collected like any other value, so
+ * versions of a map or vector share the nodes they have in common.
+ * Changes go through lval_mut from the header down: a node nothing else
+ * holds is changed in place, a shared one is copied, so an update
+ * copies only the nodes on the path to it, O(log32 n) of them, and the
+ * older versions keep the nodes they had. Hash maps and lists copy all
+ * of themselves when changed while shared, which is what a fold does
+ * to its accumulator.
+ *
+ * Maps are hash array mapped tries. A node branches 32 ways on five
+ * bits of a key's hash, lowest first, and its kids are the key and
+ * value pairs of the branches holding one key, then the nodes of the
+ * branches holding several; ndata and nnodes mark which branches are
+ * which. Keys whose hashes are equal in every bit end up in a node
+ * past the last bits, which has neither mark and holds its pairs in a
+ * plain list. Deleting the second to last key of a node moves the last
+ * up in its place. The map builtins in map.c take persistent maps too,
+ * which keep their keys in hash order rather than insertion order.
+ *
+ * Vectors are tries with 32 items to a leaf, in index order, as Clojure
+ * has them. The root branches on the bits of an index from pshift up,
+ * five at a time, and the last 1 to 32 items wait in a tail node, so a
+ * push usually touches nothing else.
+ */
+
+#define LTRIE_BITS  5
+#define LTRIE_WIDTH (1 << LTRIE_BITS)
+#define LTRIE_MASK  (LTRIE_WIDTH - 1)
+
+/* hash bits a map has to branch on */
+#define LHAMT_BITS ((int) sizeof(unsigned long) * 8)
+
+static lval* lnode_new(int cap) {
+  lval* n = lval_new(LVAL_NODE);
+  n->ndata = 0;
+  n->nnodes = 0;
+  n->nlen = 0;
+  n->ncap = cap;
+  n->nkids = lpool_alloc(sizeof(lval*) * cap);
+  gc_grow(sizeof(lval*) * cap);
+  return n;
+}
+
+static lval* ltrie_new(int type) {
+  lval* v = lval_new(type);
+  v->plen = 0;
+  v->pshift = LTRIE_BITS;
+  v->proot = NULL;
+  v->ptail = NULL;
+  return v;
+}
+
+/* a node or header sharing everything under it */
+lval* ltrie_copy(lval* v) {
+  if (LTYPE(v) != LVAL_NODE) {
+    lval* x = ltrie_new(LTYPE(v));
+    x->plen = v->plen;
+    x->pshift = v->pshift;
+    x->proot = v->proot ? lval_ref(v->proot) : NULL;
+    x->ptail = v->ptail ? lval_ref(v->ptail) : NULL;
+    return x;
+  }
+  lval* x = lnode_new(v->ncap);
+  x->ndata = v->ndata;
+  x->nnodes = v->nnodes;
+  x->nlen = v->nlen;
+  for (int i = 0; i < v->nlen; i++) {
+    x->nkids[i] = lval_ref(v->nkids[i]);
+  }
+  return x;
+}
+
+/* frees what v holds, for lval_del */
+void ltrie_del(lval* v) {
+  if (LTYPE(v) != LVAL_NODE) {
+    if (v->proot) {
+      lval_del(v->proot);
+    }
+    if (v->ptail) {
+      lval_del(v->ptail);
+    }
+    return;
+  }
+  for (int i = 0; i < v->nlen; i++) {
+    lval_del(v->nkids[i]);
+  }
+  lpool_free(v->nkids, sizeof(lval*) * v->ncap);
+}
+
+/*
+ * Replaces remove kids of n from at with insert slots for the caller to
+ * fill. Map nodes have exactly the room they use.
+ */
+static void lnode_splice(lval* n, int at, int remove, int insert) {
+  int len = n->nlen - remove + insert;
+  lval** kids = lpool_alloc(sizeof(lval*) * len);
+  gc_grow(sizeof(lval*) * len);
+  if (at) {
+    memcpy(kids, n->nkids, sizeof(lval*) * at);
+  }
+  if (n->nlen - at - remove) {
+    memcpy(kids + at + insert, n->nkids + at + remove,
+           sizeof(lval*) * (n->nlen - at - remove));
+  }
+  lpool_free(n->nkids, sizeof(lval*) * n->ncap);
+  n->nkids = kids;
+  n->nlen = len;
+  n->ncap = len;
+}
+
+static int lhamt_count(uint32_t x) {
+#ifdef __GNUC__
+  return __builtin_popcount(x);
+#else
+  int n = 0;
+  for (; x; x &= x - 1) {
+    n++;
+  }
+  return n;
+#endif
+}
+
+/* the branch of a node shift bits down that hash takes */
+static uint32_t lhamt_bit(unsigned long hash, int shift) {
+  return (uint32_t) 1 << ((hash >> shift) & LTRIE_MASK);
+}
+
+/* the kid of n for bit, which must be set in ndata or nnodes */
+static int lhamt_data(lval* n, uint32_t bit) {
+  return 2 * lhamt_count(n->ndata & (bit - 1));
+}
+
+static int lhamt_node(lval* n, uint32_t bit) {
+  return 2 * lhamt_count(n->ndata) + lhamt_count(n->nnodes & (bit - 1));
+}
+
+/* the pairs of a node past the last bits come first, as entries do */
+static int lhamt_pairs(lval* n) {
+  return n->ndata || n->nnodes ? 2 * lhamt_count(n->ndata) : n->nlen;
+}
+
+/* the value for k under n, or NULL */
+static lval* lhamt_find(lval* n, lval* k, unsigned long hash) {
+  for (int shift = 0; n; shift += LTRIE_BITS) {
+    if (shift >= LHAMT_BITS) {
+      for (int i = 0; i < n->nlen; i += 2) {
+        if (lval_eq(n->nkids[i], k)) {
+          return n->nkids[i + 1];
+        }
+      }
+      return NULL;
+    }
+    uint32_t bit = lhamt_bit(hash, shift);
+    if (n->ndata & bit) {
+      int i = lhamt_data(n, bit);
+      return lval_eq(n->nkids[i], k) ? n->nkids[i + 1] : NULL;
+    }
+    n = n->nnodes & bit ? n->nkids[lhamt_node(n, bit)] : NULL;
+  }
+  return NULL;
+}
+
+/* a node for two keys first sharing a branch shift bits down */
+static lval* lhamt_pair(lval* k1, lval* v1, unsigned long h1,
+                        lval* k2, lval* v2, unsigned long h2, int shift) {
+  if (shift >= LHAMT_BITS) {
+    lval* n = lnode_new(4);
+    n->nkids[0] = k1;
+    n->nkids[1] = v1;
+    n->nkids[2] = k2;
+    n->nkids[3] = v2;
+    n->nlen = 4;
+    return n;
+  }
+  uint32_t b1 = lhamt_bit(h1, shift);
+  uint32_t b2 = lhamt_bit(h2, shift);
+  if (b1 == b2) {
+    lval* n = lnode_new(1);
+    n->nnodes = b1;
+    n->nkids[0] = lhamt_pair(k1, v1, h1, k2, v2, h2, shift + LTRIE_BITS);
+    n->nlen = 1;
+    return n;
+  }
+  lval* n = lnode_new(4);
+  n->ndata = b1 | b2;
+  int first = b1 < b2 ? 0 : 2;
+  n->nkids[first] = k1;
+  n->nkids[first + 1] = v1;
+  n->nkids[2 - first] = k2;
+  n->nkids[3 - first] = v2;
+  n->nlen = 4;
+  return n;
+}
+
+/* sets k to v under n, taking n, k and v, and sets *added if k is new */
+static lval* lhamt_insert(lval* n, lval* k, lval* v, unsigned long hash,
+                          int shift, int* added) {
+  if (!n) {
+    n = lnode_new(2);
+    n->ndata = lhamt_bit(hash, shift);
+    n->nkids[0] = k;
+    n->nkids[1] = v;
+    n->nlen = 2;
+    *added = 1;
+    return n;
+  }
+  n = lval_mut(n);
+  if (shift >= LHAMT_BITS) {
+    for (int i = 0; i < n->nlen; i += 2) {
+      if (lval_eq(n->nkids[i], k)) {
+        lval_del(k);
+        lval_del(n->nkids[i + 1]);
+        n->nkids[i + 1] = v;
+        return n;
+      }
+    }
+    lnode_splice(n, n->nlen, 0, 2);
+    n->nkids[n->nlen - 2] = k;
+    n->nkids[n->nlen - 1] = v;
+    *added = 1;
+    return n;
+  }
+
+  uint32_t bit = lhamt_bit(hash, shift);
+  if (n->ndata & bit) {
+    int i = lhamt_data(n, bit);
+    if (lval_eq(n->nkids[i], k)) {
+      lval_del(k);
+      lval_del(n->nkids[i + 1]);
+      n->nkids[i + 1] = v;
+      return n;
+    }
+    /* the branch now holds two keys, which move down into a node */
+    lval* sub = lhamt_pair(n->nkids[i], n->nkids[i + 1],
+                           lval_hash(n->nkids[i]), k, v, hash,
+                           shift + LTRIE_BITS);
+    lnode_splice(n, i, 2, 0);
+    n->ndata ^= bit;
+    int j = lhamt_node(n, bit);
+    lnode_splice(n, j, 0, 1);
+    n->nnodes |= bit;
+    n->nkids[j] = sub;
+    *added = 1;
+  } else if (n->nnodes & bit) {
+    int j = lhamt_node(n, bit);
+    n->nkids[j] = lhamt_insert(n->nkids[j], k, v, hash, shift + LTRIE_BITS,
+                               added);
+  } else {
+    int i = lhamt_data(n, bit);
+    lnode_splice(n, i, 0, 2);
+    n->ndata |= bit;
+    n->nkids[i] = k;
+    n->nkids[i + 1] = v;
+    *added = 1;
+  }
+  return n;
+}
+
+/* deletes k, which must be there, from under n, NULL if none are left */
+static lval* lhamt_delete(lval* n, lval* k, unsigned long hash, int shift) {
+  n = lval_mut(n);
+  if (shift >= LHAMT_BITS) {
+    for (int i = 0; i < n->nlen; i += 2) {
+      if (lval_eq(n->nkids[i], k)) {
+        lval_del(n->nkids[i]);
+        lval_del(n->nkids[i + 1]);
+        lnode_splice(n, i, 2, 0);
+        break;
+      }
+    }
+  } else {
+    uint32_t bit = lhamt_bit(hash, shift);
+    if (n->ndata & bit) {
+      int i = lhamt_data(n, bit);
+      lval_del(n->nkids[i]);
+      lval_del(n->nkids[i + 1]);
+      lnode_splice(n, i, 2, 0);
+      n->ndata ^= bit;
+    } else {
+      int j = lhamt_node(n, bit);
+      lval* sub = lhamt_delete(n->nkids[j], k, hash, shift + LTRIE_BITS);
+      if (sub && (sub->nnodes || sub->nlen > 2)) {
+        n->nkids[j] = sub;
+      } else {
+        lnode_splice(n, j, 1, 0);
+        n->nnodes ^= bit;
+        if (sub) {
+          /* the one key left below moves up into this node */
+          int i = lhamt_data(n, bit);
+          lnode_splice(n, i, 0, 2);
+          n->ndata |= bit;
+          n->nkids[i] = lval_ref(sub->nkids[0]);
+          n->nkids[i + 1] = lval_ref(sub->nkids[1]);
+          lval_del(sub);
+        }
+      }
+    }
+  }
+  if (!n->nlen) {
+    lval_del(n);
+    return NULL;
+  }
+  return n;
+}
+
+lval* lhamt_get(lval* m, lval* k) {
+  return lhamt_find(m->proot, k, lval_hash(k));
+}
+
+/* sets k to v in m, taking all three */
+lval* lhamt_put(lval* m, lval* k, lval* v) {
+  m = lval_mut(m);
+  int added = 0;
+  m->proot = lhamt_insert(m->proot, k, v, lval_hash(k), 0, &added);
+  m->plen += added;
+  return m;
+}
+
+/* deletes k from m, taking m */
+lval* lhamt_remove(lval* m, lval* k) {
+  if (!lhamt_get(m, k)) {
+    return m;
+  }
+  m = lval_mut(m);
+  m->proot = lhamt_delete(m->proot, k, lval_hash(k), 0);
+  m->plen--;
+  return m;
+}
+
+typedef int (*lhamt_fn)(lval* k, lval* v, void* data);
+
+/* calls f on the pairs under n until it returns nonzero, then returns 1 */
+static int lhamt_walk(lval* n, lhamt_fn f, void* data) {
+  if (!n) {
+    return 0;
+  }
+  int pairs = lhamt_pairs(n);
+  for (int i = 0; i < pairs; i += 2) {
+    if (f(n->nkids[i], n->nkids[i + 1], data)) {
+      return 1;
+    }
+  }
+  for (int i = pairs; i < n->nlen; i++) {
+    if (lhamt_walk(n->nkids[i], f, data)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int lhamt_add_key(lval* k, lval* v, void* data) {
+  lval* l = data;
+  l->cell[l->count++] = lval_ref(k);
+  return 0;
+}
+
+static int lhamt_add_val(lval* k, lval* v, void* data) {
+  lval* l = data;
+  l->cell[l->count++] = lval_ref(v);
+  return 0;
+}
+
+/* the keys, or values if vals, of m as a Q-Expression */
+lval* lhamt_list(lval* m, int vals) {
+  lval* l = lval_qexpr();
+  lval_reserve(l, m->plen);
+  lhamt_walk(m->proot, vals ? lhamt_add_val : lhamt_add_key, l);
+  return l;
+}
+
+static int lhamt_differs(lval* k, lval* v, void* data) {
+  lval* w = lhamt_get(data, k);
+  return !w || !lval_eq(v, w);
+}
+
+static int lhamt_hash_pair(lval* k, lval* v, void* data) {
+  /* a sum, so the order pairs are met in does not matter */
+  *(unsigned long*) data += (lval_hash(k) ^ lval_hash(v)) * 16777619u;
+  return 0;
+}
+
+static int lhamt_print_pair(lval* k, lval* v, void* data) {
+  int* first = data;
+  if (!*first) {
+    printf(", ");
+  }
+  *first = 0;
+  lval_print(k);
+  putchar(' ');
+  lval_print(v);
+  return 0;
+}
+
+/* the index of the first item of v in its tail */
+static long lpvec_tail(lval* v) {
+  return v->plen < LTRIE_WIDTH ? 0 : (v->plen - 1) & ~(long) LTRIE_MASK;
+}
+
+/* the leaf of v holding item i */
+static lval* lpvec_leaf(lval* v, long i) {
+  if (i >= lpvec_tail(v)) {
+    return v->ptail;
+  }
+  lval* n = v->proot;
+  for (int shift = v->pshift; shift > 0; shift -= LTRIE_BITS) {
+    n = n->nkids[(i >> shift) & LTRIE_MASK];
+  }
+  return n;
+}
+
+static lval* lpvec_item(lval* v, long i) {
+  return lpvec_leaf(v, i)->nkids[i & LTRIE_MASK];
+}
+
+/* x == y for maps or vectors of the same type */
+int ltrie_eq(lval* x, lval* y) {
+  if (x->plen != y->plen) {
+    return 0;
+  }
+  if (LTYPE(x) == LVAL_PMAP) {
+    return !lhamt_walk(x->proot, lhamt_differs, y);
+  }
+  for (long i = 0; i < x->plen; i++) {
+    if (!lval_eq(lpvec_item(x, i), lpvec_item(y, i))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+unsigned long ltrie_hash(lval* v) {
+  unsigned long h = 0;
+  if (LTYPE(v) == LVAL_PMAP) {
+    lhamt_walk(v->proot, lhamt_hash_pair, &h);
+    return (2166136261u ^ LTYPE(v) ^ h) * 16777619u;
+  }
+  /* as lists are hashed */
+  h = 2166136261u ^ LTYPE(v);
+  for (long i = 0; i < v->plen; i++) {
+    h = (h ^ lval_hash(lpvec_item(v, i))) * 16777619u;
+  }
+  return h;
+}
+
+/* #pmap{k v, k v} or #pvec[x y] */
+void ltrie_print(lval* v) {
+  if (LTYPE(v) == LVAL_PMAP) {
+    int first = 1;
+    printf("#pmap{");
+    lhamt_walk(v->proot, lhamt_print_pair, &first);
+    putchar('}');
+    return;
+  }
+  printf("#pvec[");
+  for (long i = 0; i < v->plen; i++) {
+    if (i) {
+      putchar(' ');
+    }
+    lval_print(lpvec_item(v, i));
+  }
+  putchar(']');
+}
+
+/* the node for item i of v, taking n, with the item set to x */
+static lval* lpvec_assign(lval* n, int shift, long i, lval* x) {
+  n = lval_mut(n);
+  lval** kid = &n->nkids[(i >> shift) & LTRIE_MASK];
+  if (shift) {
+    *kid = lpvec_assign(*kid, shift - LTRIE_BITS, i, x);
+  } else {
+    lval_del(*kid);
+    *kid = x;
+  }
+  return n;
+}
+
+/* leaf as the first leaf of a new branch shift bits up */
+static lval* lpvec_path(int shift, lval* leaf) {
+  if (!shift) {
+    return leaf;
+  }
+  lval* n = lnode_new(LTRIE_WIDTH);
+  n->nkids[0] = lpvec_path(shift - LTRIE_BITS, leaf);
+  n->nlen = 1;
+  return n;
+}
+
+/* n with the full tail of v added as its last leaf */
+static lval* lpvec_push_leaf(lval* v, lval* n, int shift, lval* leaf) {
+  n = lval_mut(n);
+  int i = ((v->plen - 1) >> shift) & LTRIE_MASK;
+  if (shift > LTRIE_BITS && i < n->nlen) {
+    n->nkids[i] = lpvec_push_leaf(v, n->nkids[i], shift - LTRIE_BITS, leaf);
+  } else {
+    n->nkids[i] = lpvec_path(shift - LTRIE_BITS, leaf);
+    n->nlen++;
+  }
+  return n;
+}
+
+/* v with x added at the end, taking both */
+static lval* lpvec_push(lval* v, lval* x) {
+  v = lval_mut(v);
+  if (v->ptail && v->ptail->nlen == LTRIE_WIDTH) {
+    /* the full tail goes into the tree, growing it a level if it is full */
+    lval* leaf = v->ptail;
+    if (!v->proot) {
+      v->proot = lpvec_path(LTRIE_BITS, leaf);
+    } else if ((v->plen >> LTRIE_BITS) > (1L << v->pshift)) {
+      lval* n = lnode_new(LTRIE_WIDTH);
+      n->nkids[0] = v->proot;
+      n->nkids[1] = lpvec_path(v->pshift, leaf);
+      n->nlen = 2;
+      v->proot = n;
+      v->pshift += LTRIE_BITS;
+    } else {
+      v->proot = lpvec_push_leaf(v, v->proot, v->pshift, leaf);
+    }
+    v->ptail = NULL;
+  }
+  v->ptail = v->ptail ? lval_mut(v->ptail) : lnode_new(LTRIE_WIDTH);
+  v->ptail->nkids[v->ptail->nlen++] = x;
+  v->plen++;
+  return v;
+}
+
+/* n without the last leaf of v, NULL if it had no other */
+static lval* lpvec_pop_leaf(lval* v, lval* n, int shift) {
+  n = lval_mut(n);
+  int i = ((v->plen - 2) >> shift) & LTRIE_MASK;
+  if (shift > LTRIE_BITS) {
+    n->nkids[i] = lpvec_pop_leaf(v, n->nkids[i], shift - LTRIE_BITS);
+  } else {
+    lval_del(n->nkids[i]);
+    n->nkids[i] = NULL;
+  }
+  if (!n->nkids[i]) {
+    n->nlen--;
+  }
+  if (!n->nlen) {
+    lval_del(n);
+    return NULL;
+  }
+  return n;
+}
+
+/* v without its last item, taking v, which must have one */
+static lval* lpvec_pop(lval* v) {
+  v = lval_mut(v);
+  if (v->ptail->nlen > 1 || v->plen == 1) {
+    v->ptail = lval_mut(v->ptail);
+    lval_del(v->ptail->nkids[--v->ptail->nlen]);
+  } else {
+    /* the tail empties, and the last leaf of the tree takes its place */
+    lval* leaf = lval_ref(lpvec_leaf(v, v->plen - 2));
+    v->proot = lpvec_pop_leaf(v, v->proot, v->pshift);
+    if (!v->proot) {
+      v->pshift = LTRIE_BITS;
+    } else if (v->pshift > LTRIE_BITS && v->proot->nlen == 1) {
+      lval* n = lval_ref(v->proot->nkids[0]);
+      lval_del(v->proot);
+      v->proot = n;
+      v->pshift -= LTRIE_BITS;
+    }
+    lval_del(v->ptail);
+    v->ptail = leaf;
+  }
+  v->plen--;
+  return v;
+}
+
+/* (pmap k v ...) or (pmap {k v ...}) */
+lval* builtin_pmap(lenv* e, lval* a) {
+  lval* l = a->count == 1 && LTYPE(a->cell[0]) == LVAL_QEXPR ? a->cell[0] : a;
+  LASSERT(a, l->count % 2 == 0,
+          "Function 'pmap' passed %i items, Expected keys and values.",
+          l->count);
+  lval* m = ltrie_new(LVAL_PMAP);
+  for (int i = 0; i < l->count; i += 2) {
+    m = lhamt_put(m, lval_ref(l->cell[i]), lval_ref(l->cell[i + 1]));
+  }
+  lval_del(a);
+  return m;
+}
+
+/* (pvec x ...) or (pvec {x ...}) */
+lval* builtin_pvec(lenv* e, lval* a) {
+  lval* l = a->count == 1 && LTYPE(a->cell[0]) == LVAL_QEXPR ? a->cell[0] : a;
+  lval* v = ltrie_new(LVAL_PVEC);
+  for (int i = 0; i < l->count; i++) {
+    v = lpvec_push(v, lval_ref(l->cell[i]));
+  }
+  lval_del(a);
+  return v;
+}
+
+/* checks argument 1 of a is an index of the vector in argument 0 */
+#define LPVEC_ASSERT_INDEX(func, a) \
+  LASSERT_TYPE(func, a, 0, LVAL_PVEC); \
+  LASSERT_TYPE(func, a, 1, LVAL_INT); \
+  LASSERT(a, LNUM(a->cell[1]) >= 0 && LNUM(a->cell[1]) < a->cell[0]->plen, \
+          "Function '%s' passed index %li for a length of %li.", func, \
+          LNUM(a->cell[1]), a->cell[0]->plen)
+
+lval* builtin_pvec_get(lenv* e, lval* a) {
+  LASSERT_NUM("pvec-get", a, 2);
+  LPVEC_ASSERT_INDEX("pvec-get", a);
+  lval* x = lval_ref(lpvec_item(a->cell[0], LNUM(a->cell[1])));
+  lval_del(a);
+  return x;
+}
+
+lval* builtin_pvec_set(lenv* e, lval* a) {
+  LASSERT_NUM("pvec-set", a, 3);
+  LPVEC_ASSERT_INDEX("pvec-set", a);
+  long i = LNUM(a->cell[1]);
+  lval* x = lval_ref(a->cell[2]);
+  lval* v = lval_mut(lval_take(a, 0));
+  if (i >= lpvec_tail(v)) {
+    v->ptail = lpvec_assign(v->ptail, 0, i, x);
+  } else {
+    v->proot = lpvec_assign(v->proot, v->pshift, i, x);
+  }
+  return v;
+}
+
+/* (pvec-push v x ...) */
+lval* builtin_pvec_push(lenv* e, lval* a) {
+  LASSERT(a, a->count > 0, "Function 'pvec-push' passed no arguments.");
+  LASSERT_TYPE("pvec-push", a, 0, LVAL_PVEC);
+  lval* v = lval_pop(a, 0);
+  for (int i = 0; i < a->count; i++) {
+    v = lpvec_push(v, lval_ref(a->cell[i]));
+  }
+  lval_del(a);
+  return v;
+}
+
+lval* builtin_pvec_pop(lenv* e, lval* a) {
+  LASSERT_NUM("pvec-pop", a, 1);
+  LASSERT_TYPE("pvec-pop", a, 0, LVAL_PVEC);
+  LASSERT(a, a->cell[0]->plen > 0, "Function 'pvec-pop' passed #pvec[]");
+  return lpvec_pop(lval_take(a, 0));
+}
+
+lval* builtin_pvec_len(lenv* e, lval* a) {
+  LASSERT_NUM("pvec-len", a, 1);
+  LASSERT_TYPE("pvec-len", a, 0, LVAL_PVEC);
+  long n = a->cell[0]->plen;
+  lval_del(a);
+  return lval_int(n);
+}
+
+lval* builtin_pvec_list(lenv* e, lval* a) {
+  LASSERT_NUM("pvec-list", a, 1);
+  LASSERT_TYPE("pvec-list", a, 0, LVAL_PVEC);
+  lval* v = a->cell[0];
+  lval* l = lval_qexpr();
+  lval_reserve(l, v->plen);
+  for (long i = 0; i < v->plen; i += LTRIE_WIDTH) {
+    lval* leaf = lpvec_leaf(v, i);
+    for (int j = 0; j < leaf->nlen; j++) {
+      l->cell[l->count++] = lval_ref(leaf->nkids[j]);
+    }
+  }
+  lval_del(a);
+  return l;
+}
@@ -0,0 +1,906 @@
+#include <limits.h>
+#include "lispy.h"
+
+/*
+ * Numeric vectors.
+ *
+ * An LVAL_VEC holds numbers unboxed in one array, all longs or all
+ * doubles, where a list would hold a separately allocated lval for
+ * each. (vec 1 2 3) or (vec {1 2 3}) builds one, of floats if any
+ * element is a float, and (vec-list v) gives the elements back as a
+ * Q-Expression.
+ *
+ * The arithmetic builtins work elementwise when an argument is a
+ * vector. Vectors must have the same length, and a number stands for
+ * an element of each. Integer vectors stay integer vectors, so an
+ * element that overflows is an error rather than a bignum. The ordering
+ * builtins compare elementwise too, giving an integer vector of 1s and
+ * 0s, while == and != still compare whole values. vec-sum, vec-min,
+ * vec-max and vec-dot reduce vectors to a number; integer sums and dot
+ * products that overflow continue on bignums, as the builtins do.
+ *
+ * head, tail, take and drop give slices sharing the elements, as they
+ * do for lists, and join joins vectors.
+ *
+ * The loops are kernels chosen once for the processor: AVX2 or SSE2 on
+ * x86-64, plain C elsewhere or when lval_simd is unset (--no-simd).
+ * Float sums and dot products add in several lanes at once, so they
+ * may round differently from adding left to right.
+ */
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define LVEC_X86
+#include <immintrin.h>
+#endif
+
+int lval_simd = 1;
+
+/* operator names, only used in error messages */
+static char* lvec_names[] = { "+", "-", "*", "/", "%", ">", "<", ">=", "<=" };
+
+/*
+ * Loops over elements. A step of 1 walks an array and a step of 0
+ * repeats its first element, which is how a number meets a vector.
+ */
+typedef struct {
+  /* r[i] = x[i] op y[i] for add, sub, mul and div */
+  void   (*fop)(int op, double* r, double* x, int xs, double* y, int ys,
+                long n);
+  /* the same for add, sub and mul on longs, nonzero if any overflows */
+  int    (*iop)(int op, long* r, long* x, int xs, long* y, int ys, long n);
+  double (*fsum)(double* x, long n);
+  double (*fdot)(double* x, double* y, long n);
+  /* the extremes of n > 0 elements */
+  double (*fmin)(double* x, long n);
+  double (*fmax)(double* x, long n);
+  long   (*imin)(long* x, long n);
+  long   (*imax)(long* x, long n);
+  /* *r = the sum, or nonzero if it may overflow */
+  int    (*isum)(long* x, long n, long* r);
+} lvec_kernels;
+
+static void lvec_fop_c(int op, double* r, double* x, int xs, double* y,
+                       int ys, long n) {
+  for (long i = 0; i < n; i++) {
+    double a = x[i * xs];
+    double b = y[i * ys];
+    switch (op) {
+    case LOP_ADD: r[i] = a + b; break;
+    case LOP_SUB: r[i] = a - b; break;
+    case LOP_MUL: r[i] = a * b; break;
+    default: r[i] = a / b; break;
+    }
+  }
+}
+
+static int lvec_iop_c(int op, long* r, long* x, int xs, long* y, int ys,
+                      long n) {
+  int over = 0;
+  for (long i = 0; i < n; i++) {
+    long a = x[i * xs];
+    long b = y[i * ys];
+    switch (op) {
+    case LOP_ADD: over |= lint_add(a, b, &r[i]); break;
+    case LOP_SUB: over |= lint_sub(a, b, &r[i]); break;
+    default: over |= lint_mul(a, b, &r[i]); break;
+    }
+  }
+  return over;
+}
+
+static double lvec_fsum_c(double* x, long n) {
+  double s = 0;
+  for (long i = 0; i < n; i++) {
+    s += x[i];
+  }
+  return s;
+}
+
+static double lvec_fdot_c(double* x, double* y, long n) {
+  double s = 0;
+  for (long i = 0; i < n; i++) {
+    s += x[i] * y[i];
+  }
+  return s;
+}
+
+static double lvec_fmin_c(double* x, long n) {
+  double m = x[0];
+  for (long i = 1; i < n; i++) {
+    m = x[i] < m ? x[i] : m;
+  }
+  return m;
+}
+
+static double lvec_fmax_c(double* x, long n) {
+  double m = x[0];
+  for (long i = 1; i < n; i++) {
+    m = x[i] > m ? x[i] : m;
+  }
+  return m;
+}
+
+static long lvec_imin_c(long* x, long n) {
+  long m = x[0];
+  for (long i = 1; i < n; i++) {
+    m = x[i] < m ? x[i] : m;
+  }
+  return m;
+}
+
+static long lvec_imax_c(long* x, long n) {
+  long m = x[0];
+  for (long i = 1; i < n; i++) {
+    m = x[i] > m ? x[i] : m;
+  }
+  return m;
+}
+
+static int lvec_isum_c(long* x, long n, long* r) {
+  long s = 0;
+  for (long i = 0; i < n; i++) {
+    if (lint_add(s, x[i], &s)) {
+      return 1;
+    }
+  }
+  *r = s;
+  return 0;
+}
+
+static lvec_kernels lvec_c = {
+  lvec_fop_c, lvec_iop_c, lvec_fsum_c, lvec_fdot_c, lvec_fmin_c,
+  lvec_fmax_c, lvec_imin_c, lvec_imax_c, lvec_isum_c
+};
+
+#ifdef LVEC_X86
+
+/* SSE2 is part of x86-64, so these always run there; doubles only */
+
+static void lvec_fop_sse2(int op, double* r, double* x, int xs, double* y,
+                          int ys, long n) {
+  long i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128d a = xs ? _mm_loadu_pd(x + i) : _mm_set1_pd(x[0]);
+    __m128d b = ys ? _mm_loadu_pd(y + i) : _mm_set1_pd(y[0]);
+    switch (op) {
+    case LOP_ADD: a = _mm_add_pd(a, b); break;
+    case LOP_SUB: a = _mm_sub_pd(a, b); break;
+    case LOP_MUL: a = _mm_mul_pd(a, b); break;
+    default: a = _mm_div_pd(a, b); break;
+    }
+    _mm_storeu_pd(r + i, a);
+  }
+  lvec_fop_c(op, r + i, x + i * xs, xs, y + i * ys, ys, n - i);
+}
+
+/* the lanes of x added together */
+static double lvec_hsum_sse2(__m128d x) {
+  double t[2];
+  _mm_storeu_pd(t, x);
+  return t[0] + t[1];
+}
+
+static double lvec_fsum_sse2(double* x, long n) {
+  __m128d s0 = _mm_setzero_pd();
+  __m128d s1 = _mm_setzero_pd();
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 = _mm_add_pd(s0, _mm_loadu_pd(x + i));
+    s1 = _mm_add_pd(s1, _mm_loadu_pd(x + i + 2));
+  }
+  return lvec_hsum_sse2(_mm_add_pd(s0, s1)) + lvec_fsum_c(x + i, n - i);
+}
+
+static double lvec_fdot_sse2(double* x, double* y, long n) {
+  __m128d s0 = _mm_setzero_pd();
+  __m128d s1 = _mm_setzero_pd();
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(x + i),
+                                   _mm_loadu_pd(y + i)));
+    s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(x + i + 2),
+                                   _mm_loadu_pd(y + i + 2)));
+  }
+  return lvec_hsum_sse2(_mm_add_pd(s0, s1))
+    + lvec_fdot_c(x + i, y + i, n - i);
+}
+
+static double lvec_fmin_sse2(double* x, long n) {
+  __m128d m = _mm_set1_pd(x[0]);
+  long i = 0;
+  for (; i + 2 <= n; i += 2) {
+    m = _mm_min_pd(m, _mm_loadu_pd(x + i));
+  }
+  double t[3];
+  _mm_storeu_pd(t, m);
+  t[2] = i < n ? x[i] : x[0];
+  return lvec_fmin_c(t, 3);
+}
+
+static double lvec_fmax_sse2(double* x, long n) {
+  __m128d m = _mm_set1_pd(x[0]);
+  long i = 0;
+  for (; i + 2 <= n; i += 2) {
+    m = _mm_max_pd(m, _mm_loadu_pd(x + i));
+  }
+  double t[3];
+  _mm_storeu_pd(t, m);
+  t[2] = i < n ? x[i] : x[0];
+  return lvec_fmax_c(t, 3);
+}
+
+static lvec_kernels lvec_sse2 = {
+  lvec_fop_sse2, lvec_iop_c, lvec_fsum_sse2, lvec_fdot_sse2,
+  lvec_fmin_sse2, lvec_fmax_sse2, lvec_imin_c, lvec_imax_c, lvec_isum_c
+};
+
+/* AVX2 kernels, compiled for it whatever the target and used if present */
+#define LVEC_AVX2 __attribute__((target("avx2")))
+
+LVEC_AVX2
+static void lvec_fop_avx2(int op, double* r, double* x, int xs, double* y,
+                          int ys, long n) {
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d a = xs ? _mm256_loadu_pd(x + i) : _mm256_set1_pd(x[0]);
+    __m256d b = ys ? _mm256_loadu_pd(y + i) : _mm256_set1_pd(y[0]);
+    switch (op) {
+    case LOP_ADD: a = _mm256_add_pd(a, b); break;
+    case LOP_SUB: a = _mm256_sub_pd(a, b); break;
+    case LOP_MUL: a = _mm256_mul_pd(a, b); break;
+    default: a = _mm256_div_pd(a, b); break;
+    }
+    _mm256_storeu_pd(r + i, a);
+  }
+  lvec_fop_c(op, r + i, x + i * xs, xs, y + i * ys, ys, n - i);
+}
+
+/*
+ * Adds and subtracts four longs at a time. A lane overflows when the
+ * sign of the result differs from both operands of an addition, or
+ * from the first but not the second of a subtraction; the sign bits of
+ * those differences are gathered and checked once at the end.
+ */
+LVEC_AVX2
+static int lvec_iop_avx2(int op, long* r, long* x, int xs, long* y, int ys,
+                         long n) {
+  if (op == LOP_MUL) {
+    /* there is no 64 bit multiply to check */
+    return lvec_iop_c(op, r, x, xs, y, ys, n);
+  }
+  __m256i over = _mm256_setzero_si256();
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i a = xs ? _mm256_loadu_si256((__m256i*) (x + i))
+      : _mm256_set1_epi64x(x[0]);
+    __m256i b = ys ? _mm256_loadu_si256((__m256i*) (y + i))
+      : _mm256_set1_epi64x(y[0]);
+    __m256i c;
+    if (op == LOP_ADD) {
+      c = _mm256_add_epi64(a, b);
+      over = _mm256_or_si256(over, _mm256_and_si256(_mm256_xor_si256(a, c),
+                                                    _mm256_xor_si256(b, c)));
+    } else {
+      c = _mm256_sub_epi64(a, b);
+      over = _mm256_or_si256(over, _mm256_and_si256(_mm256_xor_si256(a, b),
+                                                    _mm256_xor_si256(a, c)));
+    }
+    _mm256_storeu_si256((__m256i*) (r + i), c);
+  }
+  int lanes = _mm256_movemask_pd(_mm256_castsi256_pd(over));
+  return lvec_iop_c(op, r + i, x + i * xs, xs, y + i * ys, ys, n - i)
+    || lanes;
+}
+
+LVEC_AVX2
+static double lvec_hsum_avx2(__m256d x) {
+  double t[4];
+  _mm256_storeu_pd(t, x);
+  return (t[0] + t[1]) + (t[2] + t[3]);
+}
+
+LVEC_AVX2
+static double lvec_fsum_avx2(double* x, long n) {
+  __m256d s0 = _mm256_setzero_pd();
+  __m256d s1 = _mm256_setzero_pd();
+  long i = 0;
+  for (; i + 8 <= n; i += 8) {
+    s0 = _mm256_add_pd(s0, _mm256_loadu_pd(x + i));
+    s1 = _mm256_add_pd(s1, _mm256_loadu_pd(x + i + 4));
+  }
+  return lvec_hsum_avx2(_mm256_add_pd(s0, s1)) + lvec_fsum_c(x + i, n - i);
+}
+
+LVEC_AVX2
+static double lvec_fdot_avx2(double* x, double* y, long n) {
+  __m256d s0 = _mm256_setzero_pd();
+  __m256d s1 = _mm256_setzero_pd();
+  long i = 0;
+  for (; i + 8 <= n; i += 8) {
+    s0 = _mm256_add_pd(s0, _mm256_mul_pd(_mm256_loadu_pd(x + i),
+                                         _mm256_loadu_pd(y + i)));
+    s1 = _mm256_add_pd(s1, _mm256_mul_pd(_mm256_loadu_pd(x + i + 4),
+                                         _mm256_loadu_pd(y + i + 4)));
+  }
+  return lvec_hsum_avx2(_mm256_add_pd(s0, s1))
+    + lvec_fdot_c(x + i, y + i, n - i);
+}
+
+LVEC_AVX2
+static double lvec_fmin_avx2(double* x, long n) {
+  __m256d m = _mm256_set1_pd(x[0]);
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    m = _mm256_min_pd(m, _mm256_loadu_pd(x + i));
+  }
+  /* the lanes and the elements left over */
+  double t[7];
+  _mm256_storeu_pd(t, m);
+  int k = 4;
+  for (; i < n; i++) {
+    t[k++] = x[i];
+  }
+  return lvec_fmin_c(t, k);
+}
+
+LVEC_AVX2
+static double lvec_fmax_avx2(double* x, long n) {
+  __m256d m = _mm256_set1_pd(x[0]);
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    m = _mm256_max_pd(m, _mm256_loadu_pd(x + i));
+  }
+  /* the lanes and the elements left over */
+  double t[7];
+  _mm256_storeu_pd(t, m);
+  int k = 4;
+  for (; i < n; i++) {
+    t[k++] = x[i];
+  }
+  return lvec_fmax_c(t, k);
+}
+
+LVEC_AVX2
+static long lvec_imin_avx2(long* x, long n) {
+  __m256i m = _mm256_set1_epi64x(x[0]);
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i v = _mm256_loadu_si256((__m256i*) (x + i));
+    m = _mm256_blendv_epi8(m, v, _mm256_cmpgt_epi64(m, v));
+  }
+  /* the lanes and the elements left over */
+  long t[7];
+  _mm256_storeu_si256((__m256i*) t, m);
+  int k = 4;
+  for (; i < n; i++) {
+    t[k++] = x[i];
+  }
+  return lvec_imin_c(t, k);
+}
+
+LVEC_AVX2
+static long lvec_imax_avx2(long* x, long n) {
+  __m256i m = _mm256_set1_epi64x(x[0]);
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i v = _mm256_loadu_si256((__m256i*) (x + i));
+    m = _mm256_blendv_epi8(m, v, _mm256_cmpgt_epi64(v, m));
+  }
+  /* the lanes and the elements left over */
+  long t[7];
+  _mm256_storeu_si256((__m256i*) t, m);
+  int k = 4;
+  for (; i < n; i++) {
+    t[k++] = x[i];
+  }
+  return lvec_imax_c(t, k);
+}
+
+/* sums in four lanes; an overflow in any sends the caller to bignums */
+LVEC_AVX2
+static int lvec_isum_avx2(long* x, long n, long* r) {
+  __m256i s = _mm256_setzero_si256();
+  __m256i over = _mm256_setzero_si256();
+  long i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i v = _mm256_loadu_si256((__m256i*) (x + i));
+    __m256i c = _mm256_add_epi64(s, v);
+    over = _mm256_or_si256(over, _mm256_and_si256(_mm256_xor_si256(s, c),
+                                                  _mm256_xor_si256(v, c)));
+    s = c;
+  }
+  if (_mm256_movemask_pd(_mm256_castsi256_pd(over))) {
+    return 1;
+  }
+  long t[5];
+  _mm256_storeu_si256((__m256i*) t, s);
+  return lvec_isum_c(x + i, n - i, &t[4]) || lvec_isum_c(t, 5, r);
+}
+
+static lvec_kernels lvec_avx2 = {
+  lvec_fop_avx2, lvec_iop_avx2, lvec_fsum_avx2, lvec_fdot_avx2,
+  lvec_fmin_avx2, lvec_fmax_avx2, lvec_imin_avx2, lvec_imax_avx2,
+  lvec_isum_avx2
+};
+
+#endif
+
+/* the kernels for this processor, found on first use */
+static lvec_kernels* lvec_pick(void) {
+  static lvec_kernels* best = NULL;
+  if (!lval_simd) {
+    return &lvec_c;
+  }
+  if (!best) {
+#ifdef LVEC_X86
+    __builtin_cpu_init();
+    best = __builtin_cpu_supports("avx2") ? &lvec_avx2 : &lvec_sse2;
+#else
+    best = &lvec_c;
+#endif
+  }
+  return best;
+}
+
+/* a vector of n elements, which are left for the caller to fill in */
+static lval* lvec_new(int n, int is_float) {
+  lval* v = lval_new(LVAL_VEC);
+  v->vlen = n;
+  v->vfloat = is_float;
+  v->vbase = NULL;
+  v->vints = lpool_alloc(LVEC_SIZE(v) * n);
+  gc_grow(LVEC_SIZE(v) * n);
+  return v;
+}
+
+lval* lvec_copy(lval* v) {
+  lval* x = lvec_new(v->vlen, v->vfloat);
+  if (v->vlen) {
+    memcpy(x->vints, v->vints, LVEC_SIZE(v) * v->vlen);
+  }
+  return x;
+}
+
+/* element i of v, boxed */
+static lval* lvec_item(lval* v, int i) {
+  return v->vfloat ? lval_float(v->vfloats[i]) : lval_int(v->vints[i]);
+}
+
+/*
+ * The count elements of v from start, sharing v's elements. Takes v,
+ * which stays alive as the base of the slice while it is.
+ */
+lval* lvec_slice(lval* v, int start, int count) {
+  if (start == 0 && count == v->vlen) {
+    return v;
+  }
+  lval* x = lval_new(LVAL_VEC);
+  x->vlen = count;
+  x->vfloat = v->vfloat;
+  if (v->vfloat) {
+    x->vfloats = v->vfloats + start;
+  } else {
+    x->vints = v->vints + start;
+  }
+  if (v->vbase) {
+    /* slice the base rather than chain slices */
+    x->vbase = lval_ref(v->vbase);
+    lval_del(v);
+  } else {
+    x->vbase = v;
+  }
+  return x;
+}
+
+/* the elements of v as a Q-Expression, taking v */
+lval* lvec_list(lval* v) {
+  lval* x = lval_qexpr();
+  lval_reserve(x, v->vlen);
+  for (int i = 0; i < v->vlen; i++) {
+    x->cell[x->count++] = lvec_item(v, i);
+  }
+  lval_del(v);
+  return x;
+}
+
+int lvec_eq(lval* x, lval* y) {
+  if (x->vfloat != y->vfloat || x->vlen != y->vlen) {
+    return 0;
+  }
+  for (int i = 0; i < x->vlen; i++) {
+    if (x->vfloat ? x->vfloats[i] != y->vfloats[i]
+        : x->vints[i] != y->vints[i]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+unsigned long lvec_hash(lval* v) {
+  unsigned long h = 2166136261u ^ v->vfloat;
+  for (int i = 0; i < v->vlen; i++) {
+    unsigned long k = 0;
+    if (v->vfloat) {
+      /* 0.0 and -0.0 are equal */
+      double f = v->vfloats[i] == 0 ? 0 : v->vfloats[i];
+      memcpy(&k, &f, sizeof(k) < sizeof(f) ? sizeof(k) : sizeof(f));
+    } else {
+      k = (unsigned long) v->vints[i];
+    }
+    h = (h ^ k) * 16777619u;
+  }
+  return h;
+}
+
+void lvec_print(lval* v) {
+  putchar('[');
+  for (int i = 0; i < v->vlen; i++) {
+    if (v->vfloat) {
+      printf("%.3f", v->vfloats[i]);
+    } else {
+      printf("%li", v->vints[i]);
+    }
+    if (i != v->vlen - 1) {
+      putchar(' ');
+    }
+  }
+  putchar(']');
+}
+
+/* whether x, a number or vector, is of floats */
+static int lvec_is_float(lval* x) {
+  return LTYPE(x) == LVAL_VEC ? x->vfloat : LTYPE(x) == LVAL_FLOAT;
+}
+
+/*
+ * Points *p at the elements of x, a vector or number, as doubles, with
+ * *step 0 for a number, which is kept in *one. Returns an array to free
+ * with lpool_free if the elements had to be converted, or NULL.
+ */
+static double* lvec_doubles(lval* x, double** p, int* step, double* one) {
+  *step = LTYPE(x) == LVAL_VEC;
+  if (LTYPE(x) != LVAL_VEC) {
+    *one = LTYPE(x) == LVAL_FLOAT ? x->fnum : (double) LNUM(x);
+    *p = one;
+    return NULL;
+  }
+  if (x->vfloat) {
+    *p = x->vfloats;
+    return NULL;
+  }
+  double* d = lpool_alloc(sizeof(double) * x->vlen);
+  for (int i = 0; i < x->vlen; i++) {
+    d[i] = (double) x->vints[i];
+  }
+  *p = d;
+  return d;
+}
+
+/* frees d, returned by lvec_doubles for x */
+static void lvec_free_doubles(double* d, lval* x) {
+  if (d) {
+    lpool_free(d, sizeof(double) * x->vlen);
+  }
+}
+
+/* the same for x of integers, which never need converting */
+static void lvec_longs(lval* x, long** p, int* step, long* one) {
+  *step = LTYPE(x) == LVAL_VEC;
+  if (LTYPE(x) != LVAL_VEC) {
+    *one = LNUM(x);
+    *p = one;
+    return;
+  }
+  *p = x->vints;
+}
+
+/* x op y, where at least one is a vector and the other may be a number */
+static lval* lvec_binary(int op, lval* x, lval* y) {
+  char* name = lvec_names[op];
+  if (LTYPE(x) == LVAL_VEC && LTYPE(y) == LVAL_VEC && x->vlen != y->vlen) {
+    return lval_err("Function %s passed vectors of lengths %i and %i",
+                    name, x->vlen, y->vlen);
+  }
+  int n = LTYPE(x) == LVAL_VEC ? x->vlen : y->vlen;
+
+  if (lvec_is_float(x) || lvec_is_float(y)) {
+    if (op == LOP_MOD) {
+      return lval_err("Cannot perform floating point modulus");
+    }
+    double one[2];
+    double* xp;
+    double* yp;
+    int xs, ys;
+    double* xd = lvec_doubles(x, &xp, &xs, &one[0]);
+    double* yd = lvec_doubles(y, &yp, &ys, &one[1]);
+    lval* r = NULL;
+    if (op == LOP_DIV) {
+      for (int i = 0; i < n && !r; i++) {
+        if (yp[i * ys] == 0.0) {
+          r = lval_err("Division by zero");
+        }
+      }
+    }
+    if (!r) {
+      r = lvec_new(n, 1);
+      lvec_pick()->fop(op, r->vfloats, xp, xs, yp, ys, n);
+    }
+    lvec_free_doubles(xd, x);
+    lvec_free_doubles(yd, y);
+    return r;
+  }
+
+  long* xp;
+  long* yp;
+  long xone, yone;
+  int xs, ys;
+  lvec_longs(x, &xp, &xs, &xone);
+  lvec_longs(y, &yp, &ys, &yone);
+  lval* r = lvec_new(n, 0);
+  if (op == LOP_DIV || op == LOP_MOD) {
+    /* no processor divides longs in parallel */
+    for (int i = 0; i < n; i++) {
+      long a = xp[i * xs];
+      long b = yp[i * ys];
+      if (b == 0) {
+        lval_del(r);
+        return lval_err("Division by zero");
+      }
+      if (a == LONG_MIN && b == -1) {
+        lval_del(r);
+        return lval_err("Function %s overflowed a vector element", name);
+      }
+      r->vints[i] = op == LOP_DIV ? a / b : a % b;
+    }
+  } else if (lvec_pick()->iop(op, r->vints, xp, xs, yp, ys, n)) {
+    lval_del(r);
+    return lval_err("Function %s overflowed a vector element", name);
+  }
+  return r;
+}
+
+/* checks argument i of a is a number or vector the kernels can take */
+static lval* lvec_check(lval* a, int i, char* name) {
+  int t = LTYPE(a->cell[i]);
+  if (t == LVAL_INT || t == LVAL_FLOAT || t == LVAL_VEC) {
+    return NULL;
+  }
+  return lval_err("Function %s passed incorrect type for argument %i. "
+                  "Got %s, Expected Integer, Float or Vector.",
+                  name, i, ltype_name(t));
+}
+
+/*
+ * Folds the numbers and vectors in a from left to right with op, for
+ * builtin_arith once it finds a vector among them.
+ */
+lval* lvec_arith(lval* a, int op) {
+  for (int i = 0; i < a->count; i++) {
+    lval* err = lvec_check(a, i, lvec_names[op]);
+    if (err) {
+      lval_del(a);
+      return err;
+    }
+  }
+  lval* x;
+  if (a->count == 1 && op == LOP_SUB) {
+    lval* zero = lval_int(0);
+    x = lvec_binary(op, zero, a->cell[0]);
+    lval_del(zero);
+  } else {
+    x = lval_ref(a->cell[0]);
+    for (int i = 1; i < a->count && LTYPE(x) != LVAL_ERR; i++) {
+      lval* y = lvec_binary(op, x, a->cell[i]);
+      lval_del(x);
+      x = y;
+    }
+  }
+  lval_del(a);
+  return x;
+}
+
+/* compares elementwise with op, for builtin_order given a vector */
+lval* lvec_order(lval* a, int op) {
+  for (int i = 0; i < 2; i++) {
+    lval* err = lvec_check(a, i, lvec_names[op]);
+    if (err) {
+      lval_del(a);
+      return err;
+    }
+  }
+  lval* x = a->cell[0];
+  lval* y = a->cell[1];
+  if (LTYPE(x) == LVAL_VEC && LTYPE(y) == LVAL_VEC && x->vlen != y->vlen) {
+    lval* err = lval_err("Function %s passed vectors of lengths %i and %i",
+                         lvec_names[op], x->vlen, y->vlen);
+    lval_del(a);
+    return err;
+  }
+  int n = LTYPE(x) == LVAL_VEC ? x->vlen : y->vlen;
+  double one[2];
+  double* xp;
+  double* yp;
+  int xs, ys;
+  double* xd = lvec_doubles(x, &xp, &xs, &one[0]);
+  double* yd = lvec_doubles(y, &yp, &ys, &one[1]);
+  lval* r = lvec_new(n, 0);
+  for (int i = 0; i < n; i++) {
+    double p = xp[i * xs];
+    double q = yp[i * ys];
+    r->vints[i] = op == LOP_GT ? p > q : op == LOP_LT ? p < q
+      : op == LOP_GTE ? p >= q : p <= q;
+  }
+  lvec_free_doubles(xd, x);
+  lvec_free_doubles(yd, y);
+  lval_del(a);
+  return r;
+}
+
+/* the vectors in a joined into one, of floats if any is */
+lval* lvec_join(lval* a) {
+  int n = 0;
+  int is_float = 0;
+  for (int i = 0; i < a->count; i++) {
+    n += a->cell[i]->vlen;
+    is_float |= a->cell[i]->vfloat;
+  }
+  lval* r = lvec_new(n, is_float);
+  n = 0;
+  for (int i = 0; i < a->count; i++) {
+    lval* x = a->cell[i];
+    for (int j = 0; j < x->vlen; j++, n++) {
+      if (is_float) {
+        r->vfloats[n] = x->vfloat ? x->vfloats[j] : (double) x->vints[j];
+      } else {
+        r->vints[n] = x->vints[j];
+      }
+    }
+  }
+  lval_del(a);
+  return r;
+}
+
+/* (vec 1 2 3) or (vec {1 2 3}) */
+lval* builtin_vec(lenv* e, lval* a) {
+  if (a->count == 1 && LTYPE(a->cell[0]) == LVAL_VEC) {
+    return lval_take(a, 0);
+  }
+  lval* l = a->count == 1 && LTYPE(a->cell[0]) == LVAL_QEXPR ? a->cell[0] : a;
+  int is_float = 0;
+  for (int i = 0; i < l->count; i++) {
+    int t = LTYPE(l->cell[i]);
+    LASSERT(a, t == LVAL_INT || t == LVAL_FLOAT,
+            "Function 'vec' passed incorrect type for element %i. "
+            "Got %s, Expected Integer or Float.", i, ltype_name(t));
+    is_float |= t == LVAL_FLOAT;
+  }
+  lval* v = lvec_new(l->count, is_float);
+  for (int i = 0; i < l->count; i++) {
+    lval* x = l->cell[i];
+    if (is_float) {
+      v->vfloats[i] = LTYPE(x) == LVAL_FLOAT ? x->fnum : (double) LNUM(x);
+    } else {
+      v->vints[i] = LNUM(x);
+    }
+  }
+  lval_del(a);
+  return v;
+}
+
+lval* builtin_vec_list(lenv* e, lval* a) {
+  LASSERT_NUM("vec-list", a, 1);
+  LASSERT_TYPE("vec-list", a, 0, LVAL_VEC);
+  return lvec_list(lval_take(a, 0));
+}
+
+lval* builtin_vec_len(lenv* e, lval* a) {
+  LASSERT_NUM("vec-len", a, 1);
+  LASSERT_TYPE("vec-len", a, 0, LVAL_VEC);
+  int n = a->cell[0]->vlen;
+  lval_del(a);
+  return lval_int(n);
+}
+
+/* the sum of n longs, on bignums */
+static lval* lvec_bigsum(long* x, long n) {
+  lval* s = lval_int(0);
+  for (long i = 0; i < n; i++) {
+    lval* y = lval_int(x[i]);
+    lval* t = lbig_add(s, y);
+    lval_del(y);
+    lval_del(s);
+    s = t;
+  }
+  return s;
+}
+
+lval* builtin_vec_sum(lenv* e, lval* a) {
+  LASSERT_NUM("vec-sum", a, 1);
+  LASSERT_TYPE("vec-sum", a, 0, LVAL_VEC);
+  lval* v = a->cell[0];
+  lval* r;
+  long s;
+  if (v->vfloat) {
+    r = lval_float(lvec_pick()->fsum(v->vfloats, v->vlen));
+  } else if (lvec_pick()->isum(v->vints, v->vlen, &s)) {
+    r = lvec_bigsum(v->vints, v->vlen);
+  } else {
+    r = lval_int(s);
+  }
+  lval_del(a);
+  return r;
+}
+
+/* the smallest or largest element of a vector */
+static lval* lvec_extreme(lval* a, char* name, int max) {
+  LASSERT_NUM(name, a, 1);
+  LASSERT_TYPE(name, a, 0, LVAL_VEC);
+  lval* v = a->cell[0];
+  LASSERT(a, v->vlen > 0, "Function '%s' passed an empty vector", name);
+  lvec_kernels* k = lvec_pick();
+  lval* r = v->vfloat
+    ? lval_float((max ? k->fmax : k->fmin)(v->vfloats, v->vlen))
+    : lval_int((max ? k->imax : k->imin)(v->vints, v->vlen));
+  lval_del(a);
+  return r;
+}
+
+lval* builtin_vec_min(lenv* e, lval* a) {
+  return lvec_extreme(a, "vec-min", 0);
+}
+
+lval* builtin_vec_max(lenv* e, lval* a) {
+  return lvec_extreme(a, "vec-max", 1);
+}
+
+/* the dot product of n longs, on bignums once it overflows */
+static lval* lvec_idot(long* x, long* y, long n) {
+  long s = 0;
+  long i = 0;
+  for (long p; i < n; i++) {
+    if (lint_mul(x[i], y[i], &p) || lint_add(s, p, &p)) {
+      break;
+    }
+    s = p;
+  }
+  lval* r = lval_int(s);
+  for (; i < n; i++) {
+    lval* xi = lval_int(x[i]);
+    lval* yi = lval_int(y[i]);
+    lval* p = lbig_mul(xi, yi);
+    lval* t = lbig_add(r, p);
+    lval_del(xi);
+    lval_del(yi);
+    lval_del(p);
+    lval_del(r);
+    r = t;
+  }
+  return r;
+}
+
+lval* builtin_vec_dot(lenv* e, lval* a) {
+  LASSERT_NUM("vec-dot", a, 2);
+  LASSERT_TYPE("vec-dot", a, 0, LVAL_VEC);
+  LASSERT_TYPE("vec-dot", a, 1, LVAL_VEC);
+  lval* x = a->cell[0];
+  lval* y = a->cell[1];
+  LASSERT(a, x->vlen == y->vlen,
+          "Function 'vec-dot' passed vectors of lengths %i and %i",
+          x->vlen, y->vlen);
+  lval* r;
+  if (x->vfloat || y->vfloat) {
+    double one[2];
+    double* xp;
+    double* yp;
+    int xs, ys;
+    double* xd = lvec_doubles(x, &xp, &xs, &one[0]);
+    double* yd = lvec_doubles(y, &yp, &ys, &one[1]);
+    r = lval_float(lvec_pick()->fdot(xp, yp, x->vlen));
+    lvec_free_doubles(xd, x);
+    lvec_free_doubles(yd, y);
+  } else {
+    r = lvec_idot(x->vints, y->vints, x->vlen);
+  }
+  lval_del(a);
+  return r;
+}
@@ -0,0 +1,665 @@
+#include "lispy.h"
+
+/*
+ * Bytecode compiler and stack machine, used when lval_engine is
+ * LVAL_ENGINE_VM.
+ *
+ * The body of a lambda, as lval_optimized returns it, is compiled the
+ * first time the lambda is called. The chunk is kept on the body list,
+ * so partial applications and copies of the function share it.
+ *
+ * Compilation mirrors what the tree evaluator does with the body:
+ * cells that lval_eval_count says are evaluated become loads and nested
+ * code, the others become constants, and each S-Expression ends in an
+ * application. Applications of 'if' and of the arithmetic and
+ * comparison builtins get their own opcodes; since any of those names
+ * can be rebound, the opcodes check that the name still resolves to the
+ * builtin when they run and otherwise fall back to a general
+ * application. General applications go through lval_apply, so results
+ * are the same as the tree evaluator's.
+ *
+ * Names of special forms are compiled as the forms. An S-Expression
+ * with one among its evaluated cells first checks with lval_form that
+ * it still is the form, and if not is evaluated by vm_drive instead.
+ *
+ * Expressions only known at run time, such as the argument of eval or
+ * a line typed at the prompt, are walked by vm_drive as the tree
+ * evaluator would, except that the lambdas they call run as bytecode.
+ *
+ * A lambda called from bytecode outside tail position runs in the same
+ * loop as its caller, which waits on a heap allocated frame stack
+ * rather than the C stack, so deep non-tail recursion cannot overflow
+ * it. The stack is bounded by lval_cek_max_depth, as the cek engine's
+ * is, and running out is a "stack exhausted" error.
+ *
+ * With lval_jit set, a body called often enough is also handed to the
+ * native code generator in jit.c, and calls it can handle skip the
+ * bytecode altogether.
+ */
+
+enum {
+  /* k: push constant k */
+  OP_CONST,
+  /* push an empty S-Expression */
+  OP_EMPTY,
+  /* k: push the value of symbol k, which names a formal */
+  OP_LOCAL,
+  /* k: push the value of symbol k */
+  OP_NAME,
+  /* push the value of a lone cell, evaluating it again if needed */
+  OP_VALUE,
+  /* n m: apply the top n values, the first m of them evaluated */
+  OP_CALL,
+  /* n m: apply the top n values in tail position, as OP_CALL */
+  OP_TAIL,
+  /* k l: continue if symbol k names its special form, see lval_form, else jump to l */
+  OP_FORM,
+  /* n: evaluate the top n values as an S-Expression, as vm_drive does */
+  OP_DRIVE,
+  /* t f l m: pop the condition of an if with branches t and f, jump to l if false, m if it is not a boolean */
+  OP_BRANCH,
+  /* l: jump to l */
+  OP_JUMP,
+  /* b k: apply builtin b, named by symbol k, to the top two values */
+  OP_BINOP,
+  OP_RETURN
+};
+
+/* builtins with opcodes of their own */
+enum {
+  VM_IF, VM_ADD, VM_SUB, VM_MUL, VM_DIV, VM_MOD,
+  VM_EQ, VM_NE, VM_GT, VM_LT, VM_GTE, VM_LTE, VM_BUILTINS
+};
+
+static struct {
+  char* name;
+  lbuiltin fn;
+} vm_builtins[VM_BUILTINS] = {
+  { "if", builtin_if },
+  { "+",  builtin_add },
+  { "-",  builtin_sub },
+  { "*",  builtin_mul },
+  { "/",  builtin_div },
+  { "%",  builtin_mod },
+  { "==", builtin_eq },
+  { "!=", builtin_ne },
+  { ">",  builtin_gt },
+  { "<",  builtin_lt },
+  { ">=", builtin_gte },
+  { "<=", builtin_lte }
+};
+
+struct lchunk {
+  int* code;
+  int count;
+  int cap;
+  /* constants are parts of the body, which owns the chunk */
+  lval** consts;
+  int nconsts;
+  int consts_cap;
+  /* calls so far, -1 once native code is out of the question */
+  int calls;
+  ljit* native;
+};
+
+void lchunk_del(lchunk* c) {
+  if (c->native) {
+    ljit_del(c->native);
+  }
+  free(c->code);
+  free(c->consts);
+  free(c);
+}
+
+static int vm_emit(lchunk* c, int x) {
+  if (c->count == c->cap) {
+    c->cap = c->cap ? c->cap * 2 : 64;
+    c->code = realloc(c->code, sizeof(int) * c->cap);
+  }
+  c->code[c->count] = x;
+  return c->count++;
+}
+
+static int vm_const(lchunk* c, lval* v) {
+  if (c->nconsts == c->consts_cap) {
+    c->consts_cap = c->consts_cap ? c->consts_cap * 2 : 16;
+    c->consts = realloc(c->consts, sizeof(lval*) * c->consts_cap);
+  }
+  c->consts[c->nconsts] = v;
+  return c->nconsts++;
+}
+
+/* index in vm_builtins of the builtin x names, or -1 */
+static int vm_builtin_of(lval* x) {
+  if (LTYPE(x) != LVAL_SYM) {
+    return -1;
+  }
+  for (int i = 0; i < VM_BUILTINS; i++) {
+    if (x->sym == lsym_intern(vm_builtins[i].name)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void vm_sexpr(lchunk* c, lval** cells, int count, int tail);
+
+static void vm_expr(lchunk* c, lval* x) {
+  switch (LTYPE(x)) {
+  case LVAL_SYM:
+    vm_emit(c, x->slot >= 0 ? OP_LOCAL : OP_NAME);
+    vm_emit(c, vm_const(c, x));
+    break;
+  case LVAL_SEXPR:
+    vm_sexpr(c, x->cell, x->count, 0);
+    break;
+  default:
+    vm_emit(c, OP_CONST);
+    vm_emit(c, vm_const(c, x));
+    break;
+  }
+}
+
+/*
+ * code applying the S-Expression made of cells, of which the first
+ * 'evaluated' are evaluated, with any special forms among them
+ */
+static void vm_apply(lchunk* c, lval** cells, int count, int evaluated,
+                     int tail) {
+  int b = vm_builtin_of(cells[0]);
+  if (b == VM_IF && count == 4
+      && ltype_expr(LTYPE(cells[2])) && ltype_expr(LTYPE(cells[3]))) {
+    vm_expr(c, cells[1]);
+    vm_emit(c, OP_BRANCH);
+    vm_emit(c, vm_const(c, cells[2]));
+    vm_emit(c, vm_const(c, cells[3]));
+    int other = vm_emit(c, 0);
+    int end_cond = vm_emit(c, 0);
+    vm_sexpr(c, cells[2]->cell, cells[2]->count, tail);
+    vm_emit(c, OP_JUMP);
+    int end_then = vm_emit(c, 0);
+    c->code[other] = c->count;
+    vm_sexpr(c, cells[3]->cell, cells[3]->count, tail);
+    c->code[end_cond] = c->code[end_then] = c->count;
+    return;
+  }
+
+  if (b > VM_IF && count == 3 && evaluated == 3) {
+    vm_expr(c, cells[1]);
+    vm_expr(c, cells[2]);
+    vm_emit(c, OP_BINOP);
+    vm_emit(c, b);
+    vm_emit(c, vm_const(c, cells[0]));
+    return;
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (i < evaluated) {
+      vm_expr(c, cells[i]);
+    } else {
+      vm_emit(c, OP_CONST);
+      vm_emit(c, vm_const(c, cells[i]));
+    }
+  }
+  vm_emit(c, tail ? OP_TAIL : OP_CALL);
+  vm_emit(c, count);
+  vm_emit(c, evaluated);
+}
+
+/* code evaluating the S-Expression made of cells */
+static void vm_sexpr(lchunk* c, lval** cells, int count, int tail) {
+  if (count == 0) {
+    vm_emit(c, OP_EMPTY);
+    return;
+  }
+
+  /* cells after the first 'evaluated' are passed as they are */
+  int evaluated = count;
+  int i;
+  for (i = 0; i < evaluated; i++) {
+    evaluated = lval_eval_count(NULL, cells[i], i, evaluated);
+  }
+  evaluated = i;
+
+  if (count == 1) {
+    vm_expr(c, cells[0]);
+    if (LTYPE(cells[0]) == LVAL_SYM || LTYPE(cells[0]) == LVAL_SEXPR) {
+      vm_emit(c, OP_VALUE);
+    }
+    return;
+  }
+
+  /*
+   * a form stops evaluation at the second cell at the latest, so at
+   * most the first two are checked
+   */
+  int checks[2];
+  int nchecks = 0;
+  for (i = 0; i < evaluated; i++) {
+    if (lval_form(NULL, cells[i]) != LFORM_NONE) {
+      vm_emit(c, OP_FORM);
+      vm_emit(c, vm_const(c, cells[i]));
+      checks[nchecks++] = vm_emit(c, 0);
+    }
+  }
+  vm_apply(c, cells, count, evaluated, tail);
+  if (nchecks == 0) {
+    return;
+  }
+
+  /* a name is not its form here, evaluate the cells as they are */
+  vm_emit(c, OP_JUMP);
+  int end = vm_emit(c, 0);
+  for (i = 0; i < nchecks; i++) {
+    c->code[checks[i]] = c->count;
+  }
+  for (i = 0; i < count; i++) {
+    vm_emit(c, OP_CONST);
+    vm_emit(c, vm_const(c, cells[i]));
+  }
+  vm_emit(c, OP_DRIVE);
+  vm_emit(c, count);
+  c->code[end] = c->count;
+}
+
+static lchunk* vm_compile(lval* body) {
+  lchunk* c = calloc(1, sizeof(lchunk));
+  vm_sexpr(c, body->cell, body->count, 1);
+  vm_emit(c, OP_RETURN);
+  lval_cache(body)->chunk = c;
+  return c;
+}
+
+/* values being worked on, shared by nested runs */
+static lval** vm_stack = NULL;
+static int vm_top = 0;
+static int vm_cap = 0;
+
+static void vm_push(lval* v) {
+  if (vm_top == vm_cap) {
+    vm_cap = vm_cap ? vm_cap * 2 : 256;
+    vm_stack = realloc(vm_stack, sizeof(lval*) * vm_cap);
+  }
+  vm_stack[vm_top++] = v;
+  gc_push(v);
+}
+
+static lval* vm_pop(void) {
+  gc_pop(1);
+  return vm_stack[--vm_top];
+}
+
+/* pops the top n values into an S-Expression */
+static lval* vm_collect(int n) {
+  lval* x = lval_sexpr();
+  lval_reserve(x, n);
+  x->count = n;
+  vm_top -= n;
+  memcpy(x->cell, vm_stack + vm_top, sizeof(lval*) * n);
+  gc_pop(n);
+  return x;
+}
+
+static lval* vm_drive(lenv* e, lval* v, lenv* owned, lval* f);
+
+/* a lambda waiting in vm_run for the lambda it called to return */
+typedef struct {
+  lenv* e;
+  lenv* owned;
+  lval* f;
+  lval* body;
+  int pc;
+} vm_frame;
+
+/* frames of every run, each run's own above the top when it started */
+static vm_frame* vm_frames = NULL;
+static int vm_nframes = 0;
+static int vm_frames_cap = 0;
+
+/* applies x, an evaluated S-Expression, outside tail position */
+static lval* vm_call(lenv* e, lval* x, int evaluated) {
+  lenv* owned = NULL;
+  lval* f = NULL;
+  lval* result = lval_apply(&e, &x, evaluated, &owned, &f);
+  if (result) {
+    return result;
+  }
+  return vm_drive(e, x, owned, f);
+}
+
+/*
+ * x op y for two integers, or NULL to leave it to the builtin when it
+ * divides by zero or the result does not fit in a long.
+ */
+static lval* vm_binop(int b, long x, long y) {
+  long r;
+  switch (b) {
+  case VM_ADD: return lint_add(x, y, &r) ? NULL : lval_int(r);
+  case VM_SUB: return lint_sub(x, y, &r) ? NULL : lval_int(r);
+  case VM_MUL: return lint_mul(x, y, &r) ? NULL : lval_int(r);
+  case VM_DIV: return y && y != -1 ? lval_int(x / y) : NULL;
+  case VM_MOD: return y && y != -1 ? lval_int(x % y) : NULL;
+  case VM_EQ:  return lval_bool(x == y);
+  case VM_NE:  return lval_bool(x != y);
+  case VM_GT:  return lval_bool(x > y);
+  case VM_LT:  return lval_bool(x < y);
+  case VM_GTE: return lval_bool(x >= y);
+  case VM_LTE: return lval_bool(x <= y);
+  }
+  return NULL;
+}
+
+/*
+ * Runs f, whose arguments are bound in e, as native code if its body c
+ * is hot and the code applies. Returns the result, or NULL to run the
+ * bytecode instead.
+ */
+static lval* vm_native(lchunk* c, lval* f, lenv* e) {
+  if (c->native == NULL) {
+    if (c->calls < 0 || ++c->calls < lval_jit_threshold) {
+      return NULL;
+    }
+    c->native = ljit_compile(f);
+    if (c->native == NULL) {
+      c->calls = -1;
+      return NULL;
+    }
+  }
+  long n;
+  switch (ljit_run(c->native, f, e, &n)) {
+  case 1:
+    return lval_int(n);
+  case -1:
+    /* it bailed out, whatever stopped it is likely to again */
+    ljit_del(c->native);
+    c->native = NULL;
+    c->calls = -1;
+    break;
+  }
+  return NULL;
+}
+
+#ifdef __GNUC__
+#define VM_DISPATCH() goto *vm_labels[code[pc++]]
+#define VM_CASE(op) op_##op
+#else
+#define VM_DISPATCH() continue
+#define VM_CASE(op) case OP_##op
+#endif
+
+/*
+ * Runs lambda f, whose arguments are bound in *e. Returns the result,
+ * or NULL with an expression left to evaluate in *v and *e, as for
+ * lval_apply. Tail calls to lambdas are made without leaving the loop.
+ */
+static lval* vm_run(lenv** e, lval** v, lenv** owned, lval* f) {
+#ifdef __GNUC__
+  static void* vm_labels[] = {
+    &&op_CONST, &&op_EMPTY, &&op_LOCAL, &&op_NAME, &&op_VALUE, &&op_CALL,
+    &&op_TAIL, &&op_FORM, &&op_DRIVE, &&op_BRANCH, &&op_JUMP, &&op_BINOP,
+    &&op_RETURN
+  };
+#endif
+  /* frames below base belong to an enclosing run */
+  int base = vm_nframes;
+  lval* result;
+  lval* body;
+  int* code;
+  lval** k;
+  int pc;
+  gc_push(f);
+
+ call:
+  gc_safepoint(*e, NULL);
+  /* held while it runs, a redefinition can replace f's optimized body */
+  body = lval_ref(lval_optimized(*e, f));
+  gc_push(body);
+  lchunk* c = body->cache && body->cache->chunk
+    ? body->cache->chunk : vm_compile(body);
+  if (lval_jit && (result = vm_native(c, f, *e))) {
+    gc_pop(2);
+    lval_del(body);
+    lval_del(f);
+    goto ret;
+  }
+  code = c->code;
+  k = c->consts;
+  pc = 0;
+
+#ifdef __GNUC__
+  VM_DISPATCH();
+#endif
+  for (;;) switch (code[pc++]) {
+
+  VM_CASE(CONST):
+    vm_push(lval_ref(k[code[pc++]]));
+    VM_DISPATCH();
+
+  VM_CASE(EMPTY):
+    vm_push(lval_sexpr());
+    VM_DISPATCH();
+
+  VM_CASE(LOCAL): {
+    lval* s = k[code[pc++]];
+    lenv* x = *e;
+    if (s->slot < x->count && x->syms[s->slot] == s->sym) {
+      vm_push(lval_ref(x->vals[s->slot]));
+    } else {
+      vm_push(lenv_get(x, s));
+    }
+    VM_DISPATCH();
+  }
+
+  VM_CASE(NAME):
+    vm_push(lenv_get(*e, k[code[pc++]]));
+    VM_DISPATCH();
+
+  VM_CASE(VALUE): {
+    lval* x = vm_pop();
+    if (LTYPE(x) == LVAL_SYM || LTYPE(x) == LVAL_SEXPR) {
+      x = vm_drive(*e, x, NULL, NULL);
+    }
+    vm_push(x);
+    VM_DISPATCH();
+  }
+
+  VM_CASE(CALL): {
+    lval* x = vm_collect(code[pc++]);
+    int evaluated = code[pc++];
+    lenv* ce = *e;
+    lenv* owned_ce = NULL;
+    lval* g = NULL;
+    lval* r = lval_apply(&ce, &x, evaluated, &owned_ce, &g);
+    if (r == NULL && g == NULL) {
+      r = vm_drive(ce, x, owned_ce, NULL);
+    } else if (g && vm_nframes >= lval_cek_max_depth) {
+      lval_del(g);
+      lval_release(owned_ce);
+      r = lval_err("stack exhausted, more than %i frames",
+                   lval_cek_max_depth);
+    } else if (g) {
+      /* wait for g on the frame stack and run it here */
+      if (vm_nframes == vm_frames_cap) {
+        vm_frames_cap = vm_frames_cap ? vm_frames_cap * 2 : 256;
+        vm_frames = realloc(vm_frames, sizeof(vm_frame) * vm_frames_cap);
+      }
+      vm_frame* w = &vm_frames[vm_nframes++];
+      w->e = *e;
+      w->owned = *owned;
+      w->f = f;
+      w->body = body;
+      w->pc = pc;
+      *e = ce;
+      *owned = owned_ce;
+      f = g;
+      gc_push(f);
+      goto call;
+    }
+    vm_push(r);
+    VM_DISPATCH();
+  }
+
+  VM_CASE(TAIL): {
+    lval* x = vm_collect(code[pc++]);
+    int evaluated = code[pc++];
+    lval* g = NULL;
+    /* f is popped first, lval_apply may replace the frame under it */
+    gc_pop(2);
+    result = lval_apply(e, &x, evaluated, owned, &g);
+    lval_del(body);
+    lval_del(f);
+    if (g) {
+      f = g;
+      gc_push(f);
+      goto call;
+    }
+    if (result == NULL && vm_nframes == base) {
+      *v = x;
+      return NULL;
+    }
+    if (result == NULL) {
+      /* a caller waits for the value, it cannot be left to the driver */
+      result = vm_drive(*e, x, *owned, NULL);
+      *owned = NULL;
+    }
+    goto ret;
+  }
+
+  VM_CASE(FORM): {
+    lval* s = k[code[pc++]];
+    int l = code[pc++];
+    if (lval_form(*e, s) == LFORM_NONE) {
+      pc = l;
+    }
+    VM_DISPATCH();
+  }
+
+  VM_CASE(DRIVE):
+    vm_push(vm_drive(*e, vm_collect(code[pc++]), NULL, NULL));
+    VM_DISPATCH();
+
+  VM_CASE(BRANCH): {
+    lval* yes = k[code[pc++]];
+    lval* no = k[code[pc++]];
+    int other = code[pc++];
+    int end = code[pc++];
+    lval* x = vm_pop();
+    if (LTYPE(x) == LVAL_BOOL) {
+      if (!LNUM(x)) {
+        pc = other;
+      }
+      lval_del(x);
+    } else if (LTYPE(x) == LVAL_ERR) {
+      vm_push(x);
+      pc = end;
+    } else {
+      /* let 'if' report the bad condition */
+      lval* a = lval_add(lval_sexpr(), x);
+      a = lval_add(lval_add(a, lval_ref(yes)), lval_ref(no));
+      vm_push(builtin_if(*e, a));
+      pc = end;
+    }
+    VM_DISPATCH();
+  }
+
+  VM_CASE(JUMP):
+    pc = code[pc];
+    VM_DISPATCH();
+
+  VM_CASE(BINOP): {
+    int b = code[pc++];
+    lval* h = lenv_get(*e, k[code[pc++]]);
+    lval* y = vm_pop();
+    lval* x = vm_pop();
+    lval* r = NULL;
+    if (LTYPE(h) == LVAL_FUN && h->builtin == vm_builtins[b].fn
+        && LTYPE(x) == LVAL_INT && LTYPE(y) == LVAL_INT) {
+      r = vm_binop(b, LNUM(x), LNUM(y));
+    }
+    if (r) {
+      lval_del(h);
+      lval_del(x);
+      lval_del(y);
+    } else {
+      lval* a = lval_add(lval_add(lval_add(lval_sexpr(), h), x), y);
+      r = vm_call(*e, a, 3);
+    }
+    vm_push(r);
+    VM_DISPATCH();
+  }
+
+  VM_CASE(RETURN):
+    result = vm_pop();
+    gc_pop(2);
+    lval_del(body);
+    lval_del(f);
+  ret:
+    if (vm_nframes == base) {
+      return result;
+    }
+    /* back to the lambda that called this one */
+    lval_release(*owned);
+    vm_frame* w = &vm_frames[--vm_nframes];
+    *e = w->e;
+    *owned = w->owned;
+    f = w->f;
+    body = w->body;
+    code = body->cache->chunk->code;
+    k = body->cache->chunk->consts;
+    pc = w->pc;
+    vm_push(result);
+    VM_DISPATCH();
+  }
+}
+
+/*
+ * Evaluates v in e like lval_eval_tree, running lambdas as bytecode.
+ * If f is not NULL, evaluation starts by running it in e, which owned
+ * is the frame of.
+ */
+static lval* vm_drive(lenv* e, lval* v, lenv* owned, lval* f) {
+  lval* result;
+
+  while (1) {
+    if (f) {
+      result = vm_run(&e, &v, &owned, f);
+      f = NULL;
+      if (result) {
+        break;
+      }
+      continue;
+    }
+
+    gc_safepoint(e, v);
+    if (LTYPE(v) == LVAL_SYM) {
+      result = lenv_get(e, v);
+      lval_del(v);
+      break;
+    }
+    if (LTYPE(v) != LVAL_SEXPR) {
+      result = v;
+      break;
+    }
+
+    v = lval_mut(v);
+    int eval_count = v->count;
+    gc_push(v);
+    for (int i = 0; i < eval_count; i++) {
+      eval_count = lval_eval_count(e, v->cell[i], i, eval_count);
+      v->cell[i] = vm_drive(e, v->cell[i], NULL, NULL);
+    }
+    gc_pop(1);
+
+    result = lval_apply(&e, &v, eval_count, &owned, &f);
+    if (result) {
+      break;
+    }
+  }
+
+  lval_release(owned);
+  return result;
+}
+
+lval* lval_eval_vm(lenv* e, lval* v) {
+  return vm_drive(e, v, NULL, NULL);
+}